@@ -1,15 +1,16 @@
+#include <stdlib.h>
 #include "app.h"
 #include "crc16.h"
+#include "crc32.h"
 #include "ihex.h"
+#include "journal.h"
 #include "log.h"
 #include "phy.h"
+#include "profile.h"
 #include "progress.h"
 #include "sleep.h"
 #include "xtea.h"
 
-#define FLASH_MAX_SIZE        (1024UL * 128)
-#define FLASH_PAGE_SIZE       256
-
 const char APP_CMD_Power[] = "PWR%1d";
 const char APP_CMD_SetIface[] = "SI%d";
 const char APP_CMD_SetBaudrate[] = "SB%d";
@@ -18,272 +19,1019 @@ const char APP_CMD_StartBL[] = "BLS";
 const char APP_CMD_StopBL[] = "BLQ";
 const char APP_CMD_WriteBL[] = "BLF%02X";
 const char APP_CMD_CheckBL[] = "BLC%02X:%04X";
+const char APP_CMD_InfoBL[] = "BLI";
+const char APP_CMD_BulkBL[] = "BLW%02X:%04X";
+const char APP_CMD_PackBL[] = "BLZ%02X:%04X:%04X";
+const char APP_CMD_AckFmt[] = "OK:%x";
+const char APP_CMD_InfoFmt[] = "OK:%x:%x:%15s";
+const char APP_CMD_HashBL[] = "BLH%02X:%04X";
+const char APP_CMD_HashFmt[] = "OK:%x";
+const char APP_CMD_ReadBL[] = "BLD%02X:%04X";
+const char APP_CMD_ReadFmt[] = "OK:%x";
+const char APP_CMD_Ping[] = "PNG";
 const char APP_CMD_NL[] = "\n";
 const char APP_CMD_ESC[] = "\x1B";
 const char APP_CMD_OK[] = "OK";
 
-#define POWER_OFF_PAUSE_MS    500
-#define POWER_ON_PAUSE_MS     50
+#define APP_REPLY_LEN         64
+
+
+#define APP_SCAN_TIMEOUT_MS   30
+#define APP_SCAN_WINDOW       8
+
+#define APP_LATENCY_PROBES    4
+
+#define APP_CHECK_WINDOW      8
 
-#define APP_RETRIES           4
+#define APP_MAX_UNIT          (1024U * 4)
+#define APP_UNIT_GROW         16
 
-void APP_Send(char *data)
+#define APP_REPLY_FACTOR      4     /**< learned reply timeout is this many reply times */
+
+/** \brief Append command to the transmit buffer, nothing is sent until APP_Transmit()
+ *
+ * \param [in] s Session
+ * \param [in] fmt Command format without escape and line end
+ * \return true if the command fits into the buffer
+ *
+ */
+bool APP_Queue(tSession *s, const char *fmt, ...)
 {
-  PHY_Send((uint8_t*)data, strlen(data));
+  va_list args;
+  char *cmd = &s->tx.header[s->tx.len + 1];
+  int len;
+
+  if (s->tx.len + 2 >= APP_TX_LEN)
+    return false;
+  va_start(args, fmt);
+  len = vsnprintf(cmd, APP_TX_LEN - s->tx.len - 1, fmt, args);
+  va_end(args);
+  if ((len < 0) || (s->tx.len + len + 2 > APP_TX_LEN))
+    return false;
+  LOG_Print(LOG_LEVEL_DEBUG, "TX %s", cmd);
+  s->tx.header[s->tx.len] = APP_CMD_ESC[0];
+  s->tx.len += len + 1;
+  s->tx.header[s->tx.len++] = APP_CMD_NL[0];
+
+  return true;
 }
 
-void APP_SendData(uint8_t *data, uint16_t len)
+/** \brief Send queued commands followed by payload in one write and empty the buffer
+ *
+ * \param [in] s Session
+ * \param [in] data Payload sent right after the commands, may be NULL
+ * \param [in] len Length of payload
+ * \return true if succeed
+ *
+ */
+bool APP_Transmit(tSession *s, uint8_t *data, uint16_t len)
 {
-  PHY_Send(data, len);
+  tChunk chunks[2];
+  uint8_t cnt = 0;
+
+  if (s->tx.len > 0)
+  {
+    chunks[cnt].data = (uint8_t*)s->tx.header;
+    chunks[cnt++].len = s->tx.len;
+  }
+  if (len > 0)
+  {
+    chunks[cnt].data = data;
+    chunks[cnt++].len = len;
+  }
+  s->tx.len = 0;
+
+  return PHY_SendFrame(&s->phy, chunks, cnt);
 }
 
-bool APP_GetReply(void)
+/** \brief Read reply line and check it for OK
+ *
+ * \param [in] s Session
+ * \param [out] reply Buffer for the reply line (APP_REPLY_LEN bytes)
+ * \param [in] timeout Time to wait in ms, 0 for the default port timeout
+ * \return true if OK was received
+ *
+ */
+bool APP_ReadReply(tSession *s, char *reply, uint32_t timeout)
 {
-  char reply[32];
-
-  if (PHY_ReceiveLine(reply, APP_CMD_NL[0]) == false)
+  if (PHY_ReceiveLine(&s->phy, reply, APP_REPLY_LEN, APP_CMD_NL[0], timeout) == false)
+  {
+    LOG_Print(LOG_LEVEL_DEBUG, "RX timeout");
+    s->fault = STATS_CAUSE_TIMEOUT;
+    s->run.timeouts++;
     return false;
+  }
+  LOG_Print(LOG_LEVEL_DEBUG, "RX %s", reply);
   if (strncmp(reply, APP_CMD_OK, strlen(APP_CMD_OK)) != 0)
+  {
+    s->fault = STATS_CAUSE_REJECTED;
     return false;
+  }
 
   return true;
 }
 
-bool APP_SendCmd(char *cmd, bool wait_reply)
+bool APP_GetReply(tSession *s)
 {
-  char str[32];
-  char reply[32];
+  char reply[APP_REPLY_LEN];
 
-  strcpy(str, APP_CMD_ESC);
-  strcat(str, cmd);
-  strcat(str, APP_CMD_NL);
-  PHY_Send((uint8_t*)str, strlen(str));
+  return APP_ReadReply(s, reply, 0);
+}
+
+bool APP_SendCmd(tSession *s, char *cmd, bool wait_reply)
+{
+  APP_Queue(s, "%s", cmd);
+  APP_Transmit(s, NULL, 0);
   if (wait_reply == false)
     return true;
-  if (PHY_ReceiveLine(reply, APP_CMD_NL[0]) == false)
+
+  return APP_GetReply(s);
+}
+
+bool APP_Power(tSession *s, bool on)
+{
+  APP_Queue(s, APP_CMD_Power, on);
+  APP_Transmit(s, NULL, 0);
+
+  return APP_GetReply(s);
+}
+
+bool APP_SetInterface(tSession *s, uint8_t iface)
+{
+  APP_Queue(s, APP_CMD_SetIface, iface);
+  APP_Transmit(s, NULL, 0);
+
+  return APP_GetReply(s);
+}
+
+bool APP_SetBaudrate(tSession *s, uint32_t baudrate)
+{
+  APP_Queue(s, APP_CMD_SetBaudrate, baudrate);
+  APP_Transmit(s, NULL, 0);
+
+  return APP_GetReply(s);
+}
+
+bool APP_SetId(tSession *s, uint8_t id)
+{
+  APP_Queue(s, APP_CMD_SetId, id);
+  APP_Transmit(s, NULL, 0);
+
+  return APP_GetReply(s);
+}
+
+/** \brief Read reply to a write command and learn how long the bootloader takes to answer
+ *
+ * \param [in] s Session
+ * \param [out] reply Buffer for the reply line (APP_REPLY_LEN bytes)
+ * \param [in] len Length of the transmitted payload
+ * \param [in] pages Number of written pages
+ * \return true if OK was received
+ *
+ */
+static bool APP_ReadWriteReply(tSession *s, char *reply, uint16_t len, uint16_t pages)
+{
+  uint32_t trans = 0;
+  uint32_t timeout;
+  uint32_t per_page;
+  uint64_t start;
+  uint64_t full;
+  uint64_t us;
+  bool res;
+
+  /**< if the end of transmission is known, the reply timeout starts from there */
+  if (PHY_Drain(&s->phy) == false)
+    trans = PHY_GetTransTime(&s->phy, len);
+  if (s->timing.reply_us > 0)
+  {
+    /**< the average leaves no room for a slow page or an erase, the slowest reply seen does */
+    per_page = s->timing.reply_us * APP_REPLY_FACTOR;
+    if (per_page < s->timing.reply_max_us)
+      per_page = s->timing.reply_max_us;
+    timeout = (uint32_t)((uint64_t)per_page * pages / 1000) + APP_REPLY_MIN_MS;
+    if (timeout > APP_REPLY_TIMEOUT_MS)
+      timeout = APP_REPLY_TIMEOUT_MS;
+    timeout += trans;
+  } else
+  {
+    timeout = (trans > 0) ? trans + APP_REPLY_TIMEOUT_MS : 0;
+  }
+  /**< the link waits as long as the reply timeout, not its own default */
+  if (timeout > 0)
+    PHY_SetTimeout(&s->phy, (uint16_t)timeout);
+  start = usclock();
+  res = APP_ReadReply(s, reply, timeout);
+  /**< a late reply would be taken for the one to the retransmission, it is waited out with the profile timeout */
+  if ((res == false) && (s->fault == STATS_CAUSE_TIMEOUT) && (timeout > 0))
+  {
+    full = start + (uint64_t)(trans + APP_REPLY_TIMEOUT_MS) * 1000;
+    us = usclock();
+    if (us < full)
+    {
+      PHY_SetTimeout(&s->phy, (uint16_t)((full - us + 999) / 1000));
+      if (PHY_ReceiveLine(&s->phy, reply, APP_REPLY_LEN, APP_CMD_NL[0], (uint32_t)((full - us + 999) / 1000)) == true)
+      {
+        LOG_Print(LOG_LEVEL_DEBUG, "RX %s (late, discarded)", reply);
+        /**< the next timeout covers this reply */
+        us = usclock() - start;
+        us = (us > (uint64_t)trans * 1000) ? us - (uint64_t)trans * 1000 : 0;
+        TIMING_Reply(&s->timing, (uint32_t)(us / pages) + 1);
+      }
+    }
+  }
+  if (timeout > 0)
+    PHY_SetTimeout(&s->phy, 0);
+  if (res == false)
+  {
+    PHY_Flush(&s->phy);
     return false;
-  if (strncmp(reply, APP_CMD_OK, strlen(APP_CMD_OK)) != 0)
+  }
+  us = usclock() - start;
+  us = (us > (uint64_t)trans * 1000) ? us - (uint64_t)trans * 1000 : 0;
+  /**< zero means unknown, a reply faster than the clock is counted as 1 us */
+  TIMING_Reply(&s->timing, (uint32_t)(us / pages) + 1);
+
+  return true;
+}
+
+bool APP_WriteFlash(tSession *s, uint16_t page, uint8_t *data)
+{
+  char reply[APP_REPLY_LEN];
+  uint8_t *payload;
+  uint16_t len;
+
+  len = APP_QueueWrite(s, page, data, s->profile->page_size, &payload);
+  APP_Transmit(s, payload, len);
+  if (APP_ReadWriteReply(s, reply, len, 1) == false)
     return false;
 
+  return APP_CheckAck(s, reply, data, s->profile->page_size);
+}
+
+/** \brief Check if write replies carry the checksum of the programmed data
+ *
+ * \param [in] s Session
+ * \return true if every confirmed write is verified as well
+ *
+ */
+bool APP_AckHasCrc(tSession *s)
+{
+  return (s->info.features & s->profile->features & PROFILE_FEATURE_ACK_CRC) != 0;
+}
+
+/** \brief Compare checksum in the write reply with the written data
+ *
+ * \param [in] s Session
+ * \param [in] reply Reply line starting with OK
+ * \param [in] data Written data
+ * \param [in] len Length of data
+ * \return true if the checksum is the same or the bootloader doesn't send it
+ *
+ */
+bool APP_CheckAck(tSession *s, char *reply, uint8_t *data, uint16_t len)
+{
+  unsigned int crc;
+
+  if (APP_AckHasCrc(s) == false)
+    return true;
+  if ((sscanf(reply, APP_CMD_AckFmt, &crc) != 1) || (crc != CRC16_CalcData(data, len)))
+  {
+    LOG_Print(LOG_LEVEL_DEBUG, "Programmed data differs");
+    s->fault = STATS_CAUSE_MISMATCH;
+    return false;
+  }
+
   return true;
 }
 
-bool APP_Power(bool on)
+/** \brief Queue write command of a transfer, compressed if the bootloader can unpack it and it saves bytes
+ *
+ * \param [in] s Session
+ * \param [in] page First page number
+ * \param [in] data Page data
+ * \param [in] len Length of data, multiple of the page size
+ * \param [out] payload Data to send after the command
+ * \return length of the payload
+ *
+ */
+uint16_t APP_QueueWrite(tSession *s, uint16_t page, uint8_t *data, uint16_t len, uint8_t **payload)
 {
-  char str[32];
+  uint16_t start = s->tx.len;
+  uint16_t packed = 0;
+  int header;
+  int extra;
 
-  sprintf(str, APP_CMD_Power, on);
+  header = (len == s->profile->page_size) ? snprintf(NULL, 0, APP_CMD_WriteBL, page) :
+                                            snprintf(NULL, 0, APP_CMD_BulkBL, page, len);
+  /**< the compressed command is longer, the payload has to save more than the difference */
+  extra = snprintf(NULL, 0, APP_CMD_PackBL, page, len, len) - header;
+  if (((s->info.features & s->profile->features & PROFILE_FEATURE_PACK) != 0) &&
+      (s->parameters.no_pack == false) && (len <= APP_PACK_LEN) && (len > extra + 1))
+    packed = PACK_Compress(data, len, s->pack, (uint16_t)(len - extra - 1));
+  /**< both counters include the command with its framing, the ratio is the one of the wire */
+  s->run.sent_bytes += (uint32_t)header + 2 + len;
+  if (packed > 0)
+  {
+    APP_Queue(s, APP_CMD_PackBL, page, len, packed);
+    *payload = s->pack;
+    len = packed;
+  } else
+  {
+    if (len == s->profile->page_size)
+      APP_Queue(s, APP_CMD_WriteBL, page);
+    else
+      APP_Queue(s, APP_CMD_BulkBL, page, len);
+    *payload = data;
+  }
+  s->run.wire_bytes += (uint32_t)(s->tx.len - start) + len;
 
-  return APP_SendCmd(str, true);
+  return len;
 }
 
-bool APP_SetInterface(uint8_t iface)
+/** \brief Write several consecutive pages with one command and one acknowledgement
+ *
+ * \param [in] s Session
+ * \param [in] page First page number
+ * \param [in] data Page data
+ * \param [in] len Length of data, multiple of the page size
+ * \return true if succeed
+ *
+ */
+bool APP_WriteBulk(tSession *s, uint16_t page, uint8_t *data, uint16_t len)
 {
-  char str[32];
+  char reply[APP_REPLY_LEN];
+  uint8_t *payload;
+  uint16_t n;
+
+  if (len == s->profile->page_size)
+    return APP_WriteFlash(s, page, data);
 
-  sprintf(str, APP_CMD_SetIface, iface);
+  n = APP_QueueWrite(s, page, data, len, &payload);
+  APP_Transmit(s, payload, n);
+  if (APP_ReadWriteReply(s, reply, n, len / s->profile->page_size) == false)
+    return false;
 
-  return APP_SendCmd(str, true);
+  return APP_CheckAck(s, reply, data, len);
 }
 
-bool APP_SetBaudrate(uint32_t baudrate)
+/** \brief Ask bootloader for its transfer unit, features and device name
+ *
+ * \param [in] s Session
+ * \param [out] info Bootloader information, zero for older bootloaders
+ * \return true if the bootloader answered with information
+ *
+ */
+bool APP_GetInfo(tSession *s, tBootInfo *info)
 {
-  char str[32];
+  char reply[APP_REPLY_LEN];
 
-  sprintf(str, APP_CMD_SetBaudrate, baudrate);
+  memset(info, 0, sizeof(tBootInfo));
+  /**< older bootloaders don't know BLI, so a missing or short reply means no features */
+  APP_SendCmd(s, (char*)APP_CMD_InfoBL, false);
+  if (APP_ReadReply(s, reply, 0) == false)
+    return false;
 
-  return APP_SendCmd(str, true);
+  return APP_ParseInfo(reply, info);
 }
 
-bool APP_SetId(uint8_t id)
+/** \brief Parse reply to the information request
+ *
+ * \param [in] reply Reply line
+ * \param [out] info Bootloader information, must be zeroed before
+ * \return true if the reply has information
+ *
+ */
+bool APP_ParseInfo(char *reply, tBootInfo *info)
 {
-  char str[32];
+  unsigned int unit = 0;
+  unsigned int features = 0;
 
-  sprintf(str, APP_CMD_SetId, id);
+  if (sscanf(reply, APP_CMD_InfoFmt, &unit, &features, info->name) < 2)
+    return false;
+  info->max_unit = (unit > UINT16_MAX) ? UINT16_MAX : (uint16_t)unit;
+  info->features = (uint16_t)features;
 
-  return APP_SendCmd(str, true);
+  return true;
 }
 
-bool APP_WriteFlash(uint16_t page, uint8_t *data)
+/** \brief Select the largest transfer unit supported by bootloader, profile and user
+ *
+ * \param [in] s Session
+ * \param [out] transfer Transfer state to initialize
+ * \param [in] info Bootloader information
+ * \param [in] limit Maximal unit allowed by the user, 0 for no limit
+ * \return Nothing
+ *
+ */
+void APP_NegotiateUnit(tSession *s, tTransfer *transfer, tBootInfo *info, uint16_t limit)
 {
-  char str[32];
+  uint16_t unit = s->profile->page_size;
 
-  sprintf(str, APP_CMD_WriteBL, page);
-  APP_SendCmd(str, false);
-  msleep(1);
-  APP_SendData(data, FLASH_PAGE_SIZE);
-  return APP_GetReply();
+  memset(transfer, 0, sizeof(tTransfer));
+  if (info->features & s->profile->features & PROFILE_FEATURE_BULK)
+  {
+    unit = info->max_unit;
+    if (unit > s->profile->max_unit)
+      unit = s->profile->max_unit;
+    if (unit > APP_MAX_UNIT)
+      unit = APP_MAX_UNIT;
+    if ((limit > 0) && (unit > limit))
+      unit = limit;
+    unit -= unit % s->profile->page_size;
+    if (unit < s->profile->page_size)
+      unit = s->profile->page_size;
+  }
+  transfer->max_unit = unit;
+  transfer->unit = unit;
+  /**< the unit the link carried in the last run is a better start than the largest one */
+  if ((s->timing.unit > 0) && (s->timing.unit < unit) && ((s->timing.unit % s->profile->page_size) == 0))
+    transfer->unit = s->timing.unit;
+  LOG_Print(LOG_LEVEL_INFO, "Transfer unit: %u bytes", transfer->unit);
 }
 
-bool APP_CheckFlash(uint16_t page, uint8_t *data, uint16_t len)
+/** \brief Adapt transfer unit to the result of the last transfer
+ *
+ * \param [in] s Session
+ * \param [in,out] transfer Transfer state
+ * \param [in] success Result of the last transfer
+ * \return true if the unit was reduced, the failure isn't counted as a retry then
+ *
+ */
+bool APP_AdaptUnit(tSession *s, tTransfer *transfer, bool success)
 {
-  char str[32];
-  uint16_t crc;
+  bool reduced = false;
+
+  if (success == false)
+  {
+    /**< errors on a long transfer are expensive, fall back quickly */
+    transfer->successes = 0;
+    if (transfer->unit > s->profile->page_size)
+    {
+      transfer->unit /= 2;
+      transfer->unit -= transfer->unit % s->profile->page_size;
+      if (transfer->unit < s->profile->page_size)
+        transfer->unit = s->profile->page_size;
+      LOG_Print(LOG_LEVEL_INFO, "Transfer unit reduced to %u bytes", transfer->unit);
+      reduced = true;
+    }
+    s->timing.unit = transfer->unit;
+    return reduced;
+  }
+  if ((transfer->unit < transfer->max_unit) && (++transfer->successes >= APP_UNIT_GROW))
+  {
+    transfer->successes = 0;
+    transfer->unit *= 2;
+    if (transfer->unit > transfer->max_unit)
+      transfer->unit = transfer->max_unit;
+  }
+  s->timing.unit = transfer->unit;
 
-  crc = CRC16_CalcData(data, len);
-  sprintf(str, APP_CMD_CheckBL, page, crc);
-  return APP_SendCmd(str, true);
+  return reduced;
 }
 
-bool APP_OpenFile(char *filename, uint8_t *fdata, uint32_t *len)
+/** \brief Adapt pause after programming to the result of the last write
+ *
+ * The pause is shortened step by step while writes succeed and lengthened again
+ * after an error, it never exceeds the profile value and isn't shortened after an error.
+ *
+ * \param [in] s Session
+ * \param [in] success Result of the last write
+ * \return Nothing
+ *
+ */
+void APP_AdaptPace(tSession *s, bool success)
 {
-  uint8_t errCode;
-  FILE *fp;
-  bool res = true;
-  uint32_t max_addr;
+  tTiming *t = &s->timing;
 
-  if ((fp = fopen(filename, "rt")) == NULL)
+  if (success == false)
   {
-    LOG_Print(LOG_LEVEL_ERROR, "Unable to open file: %s", filename);
+    t->successes = 0;
+    if (t->page_ms < s->profile->page_ms)
+    {
+      t->page_ms++;
+      t->settled = true;
+      LOG_Print(LOG_LEVEL_INFO, "Page pause increased to %u ms", t->page_ms);
+    }
+    return;
+  }
+  if ((t->settled == false) && (t->page_ms > 0) && (++t->successes >= APP_UNIT_GROW))
+  {
+    t->successes = 0;
+    t->page_ms--;
+  }
+}
+
+/** \brief Power-cycle the target and poll until the bootloader answers
+ *
+ * \param [in] s Session
+ * \param [in] limit_ms Latest end of probing from now, 0 for the profile deadline only
+ * \param [out] ready_ms Time from power on to the first bootloader reply
+ * \return true if the bootloader was started before the deadline
+ *
+ */
+bool APP_EnterBootloader(tSession *s, uint32_t limit_ms, uint32_t *ready_ms)
+{
+  uint64_t start = usclock();
+  uint64_t power_on;
+  uint64_t deadline;
+  uint64_t now;
+  uint32_t delay = APP_PROBE_DELAY_MS;
+  uint16_t probes = 0;
+  bool res = false;
+
+  *ready_ms = 0;
+  if (s->power == APP_POWER_UNKNOWN)
+  {
+    /**< the full reply timeout would be lost on every adapter without power control */
+    PHY_SetTimeout(&s->phy, APP_POWER_TIMEOUT_MS);
+    s->power = (APP_Power(s, false) == true) ? APP_POWER_YES : APP_POWER_NO;
+    PHY_SetTimeout(&s->phy, 0);
+  } else if ((s->power == APP_POWER_YES) && (APP_Power(s, false) == false))
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "Unable to switch target power off");
     return false;
   }
-  memset(fdata, 0, FLASH_MAX_SIZE);
-  max_addr = 0;
-  errCode = IHEX_ReadFile(fp, fdata, FLASH_MAX_SIZE, &max_addr);
-  switch (errCode)
+  if (s->power == APP_POWER_YES)
   {
-    case IHEX_ERROR_FILE:
-    case IHEX_ERROR_SIZE:
-    case IHEX_ERROR_FMT:
-    case IHEX_ERROR_CRC:
-      LOG_Print(LOG_LEVEL_ERROR, "Problem reading Hex file");
-      res = false;
+    TIMER_Sleep(&s->timer, s->profile->power_off_ms * 1000);
+    if (APP_Power(s, true) == false)
+    {
+      LOG_Print(LOG_LEVEL_ERROR, "Unable to switch target power on");
+      return false;
+    }
+  } else
+  {
+    LOG_Print(LOG_LEVEL_WARNING, "Adapter doesn't support power control, waiting %u ms", s->profile->boot_ms);
+    TIMER_Sleep(&s->timer, s->profile->boot_ms * 1000);
+    /**< a late answer to the power command must not be taken for a probe reply */
+    PHY_Flush(&s->phy);
+  }
+  power_on = usclock();
+  deadline = power_on + (uint64_t)(s->profile->boot_ms + APP_BOOT_DEADLINE_MS) * 1000;
+  if ((limit_ms > 0) && (deadline > start + (uint64_t)limit_ms * 1000))
+    deadline = start + (uint64_t)limit_ms * 1000;
+  /**< the bootloader won't answer before its learned boot time, probing starts just before it */
+  if ((s->timing.known == true) && (s->timing.boot_ms > APP_BOOT_MARGIN_MS))
+  {
+    TIMER_Start(&s->timer, power_on);
+    TIMER_Add(&s->timer, (s->timing.boot_ms - APP_BOOT_MARGIN_MS) * 1000);
+    TIMER_Wait(&s->timer);
+  }
+
+  /**< short probes with growing pauses instead of one fixed worst-case pause */
+  PHY_SetTimeout(&s->phy, APP_PROBE_TIMEOUT_MS);
+  while (1)
+  {
+    probes++;
+    if (APP_SendCmd(s, (char*)APP_CMD_StartBL, true) == true)
+    {
+      res = true;
       break;
-    case IHEX_ERROR_NONE:
-      *len = max_addr;
+    }
+    if ((now = usclock()) >= deadline)
       break;
+    TIMER_Sleep(&s->timer, (now + delay * 1000 < deadline) ? delay * 1000 : (uint32_t)(deadline - now));
+    delay *= 2;
+    if (delay > APP_PROBE_MAX_DELAY)
+      delay = APP_PROBE_MAX_DELAY;
   }
-  fclose(fp);
+  *ready_ms = (uint32_t)((usclock() - power_on) / 1000);
+  if (res == true)
+  {
+    /**< late replies to the earlier probes must not be taken for the next commands */
+    TIMER_Sleep(&s->timer, APP_PROBE_TIMEOUT_MS * 1000);
+    PHY_Flush(&s->phy);
+    LOG_Print(LOG_LEVEL_INFO, "Bootloader ready after %u ms (%u probes)", *ready_ms, probes);
+  }
+  PHY_SetTimeout(&s->phy, 0);
 
   return res;
 }
 
-bool APP_Execute(tParam *parameters)
+/** \brief Quit bootloader and start the application
+ *
+ * \param [in] s Session
+ * \return true if the bootloader confirmed
+ *
+ */
+bool APP_LeaveBootloader(tSession *s)
 {
-  uint8_t *fdata;
-  bool res = true;
-  uint32_t i, len;
-  uint8_t errors;
-  uint16_t pages;
+  uint8_t i = 0;
 
-  fdata = malloc(FLASH_MAX_SIZE);
-  if (!fdata)
+  while (i++ < s->profile->retries)
   {
-    LOG_Print(LOG_LEVEL_ERROR, "Unable to allocate %d bytes\n", (int)FLASH_MAX_SIZE);
-    return false;
+    if (APP_SendCmd(s, (char*)APP_CMD_StopBL, true) == true)
+      return true;
   }
 
-  while (1)
+  return false;
+}
+
+/** \brief Compare checksum of the flash page with the expected one
+ *
+ * \param [in] s Session
+ * \param [in] page Page number
+ * \param [in] crc Expected CRC16 of the page
+ * \return true if the page is the same
+ *
+ */
+bool APP_CheckPage(tSession *s, uint16_t page, uint16_t crc)
+{
+  APP_Queue(s, APP_CMD_CheckBL, page, crc);
+  APP_Transmit(s, NULL, 0);
+
+  return APP_GetReply(s);
+}
+
+bool APP_CheckFlash(tSession *s, uint16_t page, uint8_t *data, uint16_t len)
+{
+  return APP_CheckPage(s, page, CRC16_CalcData(data, len));
+}
+
+/** \brief Ask bootloader for CRC32 of a range of pages
+ *
+ * \param [in] s Session
+ * \param [in] first First page
+ * \param [in] pages Number of pages
+ * \param [out] crc CRC32 of the range
+ * \return true if the bootloader answered with a checksum
+ *
+ */
+bool APP_GetHash(tSession *s, uint16_t first, uint16_t pages, uint32_t *crc)
+{
+  char reply[APP_REPLY_LEN];
+  unsigned int value;
+
+  if ((s->info.features & s->profile->features & PROFILE_FEATURE_HASH) == 0)
+    return false;
+  APP_Queue(s, APP_CMD_HashBL, first, pages);
+  APP_Transmit(s, NULL, 0);
+  if ((APP_ReadReply(s, reply, 0) == false) || (sscanf(reply, APP_CMD_HashFmt, &value) != 1))
+    return false;
+  *crc = (uint32_t)value;
+
+  return true;
+}
+
+/** \brief Read flash contents, the data follows the reply line with its CRC16
+ *
+ * \param [in] s Session
+ * \param [in] page First page
+ * \param [out] data Buffer for the data
+ * \param [in] len Number of bytes, multiple of the page size
+ * \return true if the data was received and its checksum is right
+ *
+ */
+bool APP_ReadFlash(tSession *s, uint16_t page, uint8_t *data, uint16_t len)
+{
+  char reply[APP_REPLY_LEN];
+  unsigned int crc;
+
+  APP_Queue(s, APP_CMD_ReadBL, page, len);
+  APP_Transmit(s, NULL, 0);
+  if ((APP_ReadReply(s, reply, 0) == false) || (sscanf(reply, APP_CMD_ReadFmt, &crc) != 1))
+    return false;
+  if (PHY_Receive(&s->phy, data, len) == false)
   {
-    if (PHY_Init(parameters->port, 115200, false) == false)
-      break;
+    LOG_Print(LOG_LEVEL_DEBUG, "RX timeout");
+    s->fault = STATS_CAUSE_TIMEOUT;
+    s->run.timeouts++;
+    return false;
+  }
+  if (CRC16_CalcData(data, len) != (uint16_t)crc)
+  {
+    LOG_Print(LOG_LEVEL_DEBUG, "RX data checksum is wrong");
+    s->fault = STATS_CAUSE_MISMATCH;
+    return false;
+  }
 
-    if (APP_OpenFile(parameters->file, fdata, &len) == false)
-      break;
-    pages = (len - 1) / FLASH_PAGE_SIZE + 1;
+  return true;
+}
 
-    if (parameters->iface >= 0)
-    {
-      if (APP_SetInterface((uint8_t)parameters->iface) == false)
-      {
-        LOG_Print(LOG_LEVEL_ERROR, "Unable to set interface: %d\n", parameters->iface);
-        break;
-      }
-    }
+/** \brief Compare pages with the firmware, checksums are sent in windows without waiting for replies
+ *
+ * \param [in] s Session
+ * \param [in] first First page
+ * \param [in] pages Number of pages
+ * \param [in] fdata Firmware image
+ * \return number of pages from the first one which are the same
+ *
+ */
+uint16_t APP_CheckPages(tSession *s, uint16_t first, uint16_t pages, uint8_t *fdata)
+{
+  char reply[APP_REPLY_LEN];
+  uint16_t page = first;
+  uint16_t same = pages;
+  uint8_t cnt, i;
 
-    if (parameters->baudrate != 0)
+  while ((same == pages) && (page < first + pages))
+  {
+    cnt = APP_CHECK_WINDOW;
+    if (page + cnt > first + pages)
+      cnt = (uint8_t)(first + pages - page);
+    for (i = 0; i < cnt; i++)
+      APP_Queue(s, APP_CMD_CheckBL, page + i, CRC16_CalcData(&fdata[(uint32_t)(page + i) * s->profile->page_size], s->profile->page_size));
+    APP_Transmit(s, NULL, 0);
+    /**< the rest of the window is read after a mismatch, so no reply is left on the line */
+    for (i = 0; i < cnt; i++)
     {
-      if (APP_SetBaudrate(parameters->baudrate) == false)
+      if (PHY_ReceiveLine(&s->phy, reply, APP_REPLY_LEN, APP_CMD_NL[0], 0) == false)
       {
-        LOG_Print(LOG_LEVEL_ERROR, "Unable to set baudrate: %d\n", parameters->baudrate);
+        LOG_Print(LOG_LEVEL_DEBUG, "RX timeout");
+        s->run.timeouts++;
+        TIMER_Sleep(&s->timer, s->profile->gap_ms * 1000);
+        PHY_Flush(&s->phy);
+        if (same == pages)
+          same = page + i - first;
         break;
       }
+      LOG_Print(LOG_LEVEL_DEBUG, "RX %s", reply);
+      if ((same == pages) && (strncmp(reply, APP_CMD_OK, strlen(APP_CMD_OK)) != 0))
+        same = page + i - first;
     }
+    page += cnt;
+  }
 
-    if (parameters->bus_id >= 0)
+  return same;
+}
+
+/** \brief Find the first page to continue writing from after an interrupted session
+ *
+ * \param [in] s Session
+ * \param [in] journal Initialized journal for the current target and image
+ * \param [in] fdata Firmware image
+ * \param [in] mode RESUME_QUICK to check only the last checkpoint, RESUME_FULL to check all confirmed pages
+ * \return number of pages which are already confirmed on the device
+ *
+ */
+uint16_t APP_Resume(tSession *s, tJournal *journal, uint8_t *fdata, uint8_t mode)
+{
+  uint16_t page;
+  uint16_t first;
+  uint8_t errors;
+
+  if (JOURNAL_Load(journal) == false)
+    return 0;
+  if (journal->confirmed == 0)
+    return 0;
+
+  first = 0;
+  if ((mode == RESUME_QUICK) && (journal->confirmed > JOURNAL_CHECKPOINT_PAGES))
+    first = journal->confirmed - JOURNAL_CHECKPOINT_PAGES;
+  PROGRESS_Start(&s->progress, "Resuming FW: ", "resume", 0, journal->confirmed - first, s->profile->page_size);
+  for (page = first; page < journal->confirmed; page++)
+  {
+    errors = 0;
+    while (APP_CheckFlash(s, page, &fdata[(uint32_t)page * s->profile->page_size], s->profile->page_size) == false)
     {
-      if (APP_SetId(parameters->bus_id) == false)
-      {
-        LOG_Print(LOG_LEVEL_ERROR, "Unable to set bus ID: %d\n", parameters->bus_id);
+      if (++errors >= s->profile->retries)
         break;
-      }
+      PROGRESS_Retry(&s->progress);
+      TIMER_Sleep(&s->timer, s->profile->gap_ms * 1000);
     }
-
-    msleep(POWER_ON_PAUSE_MS);
-    if (APP_SendCmd((char*)APP_CMD_StartBL, true) == false)
+    if (errors >= s->profile->retries)
     {
-      LOG_Print(LOG_LEVEL_ERROR, "Unable to start bootloader\n");
+      PROGRESS_Break(&s->progress);
       break;
     }
+    PROGRESS_Update(&s->progress, page + 1 - first);
+  }
+  journal->confirmed = page;
+  LOG_Print(LOG_LEVEL_LAST, "Resuming from page %u of %u", page, journal->pages);
+
+  return page;
+}
+
+/** \brief Measure average time from ping to any reply of the adapter
+ *
+ * \param [in] s Session
+ * \return latency in us, 0 if the adapter didn't answer
+ *
+ */
+static uint32_t APP_MeasureLatency(tSession *s)
+{
+  char reply[APP_REPLY_LEN];
+  uint64_t start;
+  uint64_t total = 0;
+  uint8_t i;
+
+  PHY_SetTimeout(&s->phy, APP_SCAN_TIMEOUT_MS);
+  for (i = 0; i < APP_LATENCY_PROBES; i++)
+  {
+    APP_Queue(s, APP_CMD_Ping);
+    start = usclock();
+    APP_Transmit(s, NULL, 0);
+    if (PHY_ReceiveLine(&s->phy, reply, APP_REPLY_LEN, APP_CMD_NL[0], 0) == false)
+      break;
+    total += usclock() - start;
+  }
+  PHY_SetTimeout(&s->phy, 0);
+  if (i < APP_LATENCY_PROBES)
+  {
+    TIMER_Sleep(&s->timer, APP_SCAN_TIMEOUT_MS * 1000);
+    PHY_Flush(&s->phy);
+    return 0;
+  }
+
+  return (uint32_t)(total / APP_LATENCY_PROBES);
+}
+
+/** \brief Lower reply latency of USB serial adapters and report the effect
+ *
+ * \param [in] s Session
+ * \return Nothing
+ *
+ */
+void APP_TuneLink(tSession *s)
+{
+  uint32_t before;
+  uint32_t after;
 
-    if (parameters->write)
+  if (PHY_IsTunable(&s->phy) == false)
+    return;
+  before = APP_MeasureLatency(s);
+  if (PHY_Tune(&s->phy) == false)
+    return;
+  after = APP_MeasureLatency(s);
+  if ((before > 0) && (after > 0))
+    LOG_Print(LOG_LEVEL_INFO, "Reply latency %u.%03u ms -> %u.%03u ms", before / 1000, before % 1000, after / 1000, after % 1000);
+}
+
+/** \brief Set interface and baudrate of the adapter
+ *
+ * \param [in] s Session
+ * \return true if succeed
+ *
+ */
+bool APP_SetupAdapter(tSession *s)
+{
+  tParam *parameters = &s->parameters;
+
+  if (parameters->iface >= 0)
+  {
+    if (APP_SetInterface(s, (uint8_t)parameters->iface) == false)
     {
-      PROGRESS_Print(0, pages, "Writing  FW: ", '#');
-      errors = 0;
-      i = 0;
-      while ((i < len) & (errors < APP_RETRIES))
-      {
-        msleep(1);
-        if (APP_WriteFlash(i / FLASH_PAGE_SIZE, &fdata[i]) == false)
-        {
-          errors++;
-          continue;
-        }
-        errors = 0;
-        i += FLASH_PAGE_SIZE;
-        PROGRESS_Print(i / FLASH_PAGE_SIZE, pages, "Writing  FW: ", '#');
-        msleep(5);
-      }
-      if (errors >= APP_RETRIES)
-      {
-        PROGRESS_Break();
-        LOG_Print(LOG_LEVEL_ERROR, "Problem flashing Hex file");
-        res = false;
-        break;
-      }
+      LOG_Print(LOG_LEVEL_ERROR, "Unable to set interface: %d\n", parameters->iface);
+      return false;
     }
+  }
 
-    if (parameters->check)
+  if (parameters->baudrate != 0)
+  {
+    if (APP_SetBaudrate(s, parameters->baudrate) == false)
     {
-      PROGRESS_Print(0, pages, "Checking FW: ", '#');
-      errors = 0;
-      i = 0;
-      while ((i < len) & (errors < APP_RETRIES))
-      {
-        if (APP_CheckFlash(i / FLASH_PAGE_SIZE, &fdata[i], FLASH_PAGE_SIZE) == false)
-        {
-          errors++;
-          msleep(1);
-          continue;
-        }
-        errors = 0;
-        i += FLASH_PAGE_SIZE;
-        PROGRESS_Print(i / FLASH_PAGE_SIZE, pages, "Checking FW: ", '#');
-      }
-      if (errors >= APP_RETRIES)
-      {
-        PROGRESS_Break();
-        LOG_Print(LOG_LEVEL_ERROR, "Hex file differs from the firmware");
-        res = false;
-        break;
-      }
+      LOG_Print(LOG_LEVEL_ERROR, "Unable to set baudrate: %d\n", parameters->baudrate);
+      return false;
     }
+  }
+
+  return true;
+}
 
-    LOG_Print(LOG_LEVEL_LAST, "Successfully executed");
+/** \brief Probe bus IDs one by one, used when the adapter lost replies of a window
+ *
+ * \param [in] s Session
+ * \param [in] first First ID to probe
+ * \param [in] cnt Number of IDs
+ * \param [out] result Scan results, latency in us or 0 if no reply
+ * \return Nothing
+ *
+ */
+static void APP_ScanSingle(tSession *s, uint8_t first, uint8_t cnt, uint32_t *result)
+{
+  uint8_t i;
+  uint64_t start;
 
-    break;
+  for (i = 0; i < cnt; i++)
+  {
+    result[i] = 0;
+    if (APP_SetId(s, first + i) == false)
+      continue;
+    start = usclock();
+    if (APP_SendCmd(s, (char*)APP_CMD_Ping, true) == true)
+      result[i] = (uint32_t)(usclock() - start) + 1;
   }
+}
+
+/** \brief Probe a window of bus IDs without waiting for replies
+ *
+ * The adapter answers every SID, a device only its PNG, so the number of replies tells
+ * how many devices answered. A window with some of them silent is split in halves
+ * until the replies can be matched.
+ *
+ * \param [in] s Session
+ * \param [in] first First ID to probe
+ * \param [in] cnt Number of IDs
+ * \param [out] result Scan results, latency in us or 0 if no reply
+ * \return Nothing
+ *
+ */
+static void APP_ScanWindow(tSession *s, uint8_t first, uint8_t cnt, uint32_t *result)
+{
+  char reply[APP_REPLY_LEN];
+  uint64_t prev;
+  uint8_t i, lines;
 
-  i = 0;
-  while (i++ < APP_RETRIES)
+  /**< every ID gets SID + PNG, the adapter answers each command in order */
+  for (i = 0; i < cnt; i++)
+  {
+    APP_Queue(s, APP_CMD_SetId, first + i);
+    APP_Queue(s, APP_CMD_Ping);
+  }
+  prev = usclock();
+  APP_Transmit(s, NULL, 0);
+  for (lines = 0; lines < cnt * 2; lines++)
   {
-    if (APP_SendCmd((char*)APP_CMD_StopBL, true) == true)
+    if (PHY_ReceiveLine(&s->phy, reply, APP_REPLY_LEN, APP_CMD_NL[0], 0) == false)
       break;
+    if (lines % 2 == 0)
+      continue;
+    /**< replies arrive one after another, so the gap is the probe latency */
+    result[lines / 2] = (strncmp(reply, APP_CMD_OK, strlen(APP_CMD_OK)) == 0) ? (uint32_t)(usclock() - prev) + 1 : 0;
+    prev = usclock();
+  }
+  if (lines == cnt * 2)
+    return;
+  memset(result, 0, cnt * sizeof(uint32_t));
+  if (lines == cnt)
+    return;
+  if (lines < cnt)
+  {
+    LOG_Print(LOG_LEVEL_DEBUG, "Only %u of %u replies, probing IDs %u..%u one by one", lines, cnt * 2, first, first + cnt - 1);
+    TIMER_Sleep(&s->timer, APP_SCAN_TIMEOUT_MS * 1000);
+    PHY_Flush(&s->phy);
+    APP_ScanSingle(s, first, cnt, result);
+    return;
   }
+  APP_ScanWindow(s, first, cnt / 2, result);
+  APP_ScanWindow(s, first + cnt / 2, cnt - cnt / 2, &result[cnt / 2]);
+}
 
-  free(fdata);
+/** \brief Find devices on the bus, probes are sent in windows without waiting for replies
+ *
+ * \param [in] s Session
+ * \param [out] ids List of IDs which answered (APP_SCAN_MAX_IDS entries)
+ * \return number of found devices
+ *
+ */
+uint8_t APP_Scan(tSession *s, uint8_t *ids)
+{
+  tParam *parameters = &s->parameters;
+  uint32_t latency[APP_SCAN_WINDOW];
+  uint16_t id;
+  uint8_t cnt, i;
+  uint8_t found = 0;
 
-  return res;
+  PHY_SetTimeout(&s->phy, APP_SCAN_TIMEOUT_MS);
+  for (id = parameters->scan_first; id <= parameters->scan_last; id += cnt)
+  {
+    cnt = APP_SCAN_WINDOW;
+    if (id + cnt > parameters->scan_last + 1)
+      cnt = parameters->scan_last + 1 - id;
+    APP_ScanWindow(s, (uint8_t)id, cnt, latency);
+    for (i = 0; i < cnt; i++)
+    {
+      if (latency[i] == 0)
+        continue;
+      LOG_Print(LOG_LEVEL_LAST, "  ID %3u answered in %u.%03u ms", id + i, (latency[i] - 1) / 1000, (latency[i] - 1) % 1000);
+      ids[found++] = (uint8_t)(id + i);
+    }
+  }
+  PHY_SetTimeout(&s->phy, 0);
+  LOG_Print(LOG_LEVEL_LAST, "Found %u device(s) on IDs %u..%u", found, parameters->scan_first, parameters->scan_last);
+
+  return found;
 }
 
+bool APP_OpenFile(char *filename, uint8_t *fdata, uint32_t maxlen, uint32_t *len)
+{
+  uint8_t errCode;
+  FILE *fp;
+  bool res = true;
+  uint32_t max_addr;
 
+  if ((fp = fopen(filename, "rt")) == NULL)
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "Unable to open file: %s", filename);
+    return false;
+  }
+  memset(fdata, 0, maxlen);
+  max_addr = 0;
+  errCode = IHEX_ReadFile(fp, fdata, maxlen, &max_addr);
+  switch (errCode)
+  {
+    case IHEX_ERROR_FILE:
+    case IHEX_ERROR_SIZE:
+    case IHEX_ERROR_FMT:
+    case IHEX_ERROR_CRC:
+      LOG_Print(LOG_LEVEL_ERROR, "Problem reading Hex file");
+      res = false;
+      break;
+    case IHEX_ERROR_NONE:
+      *len = max_addr;
+      break;
+  }
+  fclose(fp);
+
+  return res;
+}
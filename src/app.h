@@ -2,7 +2,130 @@
 #define APP_H
 
 #include "defines.h"
+#include "journal.h"
+#include "msprog.h"
+#include "pack.h"
+#include "phy.h"
+#include "profile.h"
+#include "progress.h"
+#include "stats.h"
+#include "timer.h"
+#include "timing.h"
 
-bool APP_Execute(tParam *parameters);
+#define APP_SCAN_MAX_IDS    MSPROG_SCAN_MAX_IDS
+#define APP_TX_LEN          (160)
+#define APP_PACK_LEN        (1024U * 4)  /**< largest transfer sent compressed */
+
+#define APP_REPLY_TIMEOUT_MS  500
+#define APP_PROBE_TIMEOUT_MS  20
+#define APP_PROBE_DELAY_MS    2
+#define APP_PROBE_MAX_DELAY   64
+#define APP_BOOT_DEADLINE_MS  2000
+#define APP_BOOT_MARGIN_MS    10    /**< learned boot time is waited without probes up to this margin */
+#define APP_REPLY_MIN_MS      50    /**< learned reply timeout is at least this long */
+#define APP_POWER_TIMEOUT_MS  50    /**< adapters without power control don't answer, they are detected quickly */
+
+/**< power control support of the adapter, probed once per session */
+enum
+{
+  APP_POWER_UNKNOWN = 0,
+  APP_POWER_YES,
+  APP_POWER_NO
+};
+
+typedef struct
+{
+  uint16_t  max_unit;
+  uint16_t  features;
+  char      name[DEVICE_LEN];
+} tBootInfo;
+
+typedef struct
+{
+  uint16_t  unit;
+  uint16_t  max_unit;
+  uint8_t   successes;
+} tTransfer;
+
+/**< commands are assembled here and leave together with the page data */
+typedef struct
+{
+  char      header[APP_TX_LEN];
+  uint16_t  len;
+} tTxBuffer;
+
+/**< everything one programming session needs, sessions don't share any state */
+struct tSession
+{
+  tParam    parameters;     /**< own copy, the caller may reuse its structure */
+  uint32_t  id;
+  tPhy      phy;
+  tTxBuffer tx;
+  uint8_t   pack[APP_PACK_LEN]; /**< compressed payload of the current transfer */
+  tProfile  *device;        /**< profile selected by the user, NULL to detect */
+  tProfile  *profile;       /**< profile in use */
+  tBootInfo info;
+  tProgress progress;
+  tTimer    timer;          /**< deadlines of all protocol delays */
+  bool      started;        /**< bootloader is running */
+  uint8_t   power;          /**< adapter power control, APP_POWER_xxx */
+  uint8_t   *fdata;
+  uint32_t  maxlen;
+  uint32_t  len;            /**< image length, 0 if not loaded */
+  uint16_t  pages;
+  char      stream[FILENAME_LEN]; /**< image is decoded while writing, empty if loaded */
+  uint16_t  *crc;           /**< page checksums of the written stream, NULL if not written */
+  tStatsRun run;            /**< counters for the stats file */
+  uint8_t   fault;          /**< cause of the last failed reply (STATS_CAUSE_xxx) */
+  uint64_t  recover_us;     /**< time spent on power-cycle recovery */
+  bool      acked;          /**< every page of the last write was confirmed with its checksum */
+  tTiming   timing;         /**< learned in earlier runs and refined in this one */
+};
+
+extern const char APP_CMD_Power[];
+extern const char APP_CMD_SetIface[];
+extern const char APP_CMD_SetBaudrate[];
+extern const char APP_CMD_SetId[];
+extern const char APP_CMD_StartBL[];
+extern const char APP_CMD_StopBL[];
+extern const char APP_CMD_WriteBL[];
+extern const char APP_CMD_CheckBL[];
+extern const char APP_CMD_InfoBL[];
+extern const char APP_CMD_BulkBL[];
+extern const char APP_CMD_PackBL[];
+extern const char APP_CMD_NL[];
+extern const char APP_CMD_OK[];
+
+bool APP_Queue(tSession *s, const char *fmt, ...);
+bool APP_Transmit(tSession *s, uint8_t *data, uint16_t len);
+bool APP_ReadReply(tSession *s, char *reply, uint32_t timeout);
+bool APP_GetReply(tSession *s);
+bool APP_SendCmd(tSession *s, char *cmd, bool wait_reply);
+bool APP_Power(tSession *s, bool on);
+bool APP_SetInterface(tSession *s, uint8_t iface);
+bool APP_SetBaudrate(tSession *s, uint32_t baudrate);
+bool APP_SetId(tSession *s, uint8_t id);
+bool APP_WriteFlash(tSession *s, uint16_t page, uint8_t *data);
+bool APP_AckHasCrc(tSession *s);
+bool APP_CheckAck(tSession *s, char *reply, uint8_t *data, uint16_t len);
+uint16_t APP_QueueWrite(tSession *s, uint16_t page, uint8_t *data, uint16_t len, uint8_t **payload);
+bool APP_WriteBulk(tSession *s, uint16_t page, uint8_t *data, uint16_t len);
+bool APP_GetInfo(tSession *s, tBootInfo *info);
+bool APP_ParseInfo(char *reply, tBootInfo *info);
+void APP_NegotiateUnit(tSession *s, tTransfer *transfer, tBootInfo *info, uint16_t limit);
+bool APP_AdaptUnit(tSession *s, tTransfer *transfer, bool success);
+void APP_AdaptPace(tSession *s, bool success);
+bool APP_EnterBootloader(tSession *s, uint32_t limit_ms, uint32_t *ready_ms);
+bool APP_LeaveBootloader(tSession *s);
+bool APP_CheckPage(tSession *s, uint16_t page, uint16_t crc);
+bool APP_CheckFlash(tSession *s, uint16_t page, uint8_t *data, uint16_t len);
+bool APP_GetHash(tSession *s, uint16_t first, uint16_t pages, uint32_t *crc);
+bool APP_ReadFlash(tSession *s, uint16_t page, uint8_t *data, uint16_t len);
+uint16_t APP_CheckPages(tSession *s, uint16_t first, uint16_t pages, uint8_t *fdata);
+uint16_t APP_Resume(tSession *s, tJournal *journal, uint8_t *fdata, uint8_t mode);
+void APP_TuneLink(tSession *s);
+bool APP_SetupAdapter(tSession *s);
+uint8_t APP_Scan(tSession *s, uint8_t *ids);
+bool APP_OpenFile(char *filename, uint8_t *fdata, uint32_t maxlen, uint32_t *len);
 
 #endif
@@ -0,0 +1,424 @@
+#ifdef __linux
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include "app.h"
+#include "bench.h"
+#include "crc16.h"
+#include "engine.h"
+#include "log.h"
+#include "pack.h"
+
+#define BENCH_LINE_LEN      (32)
+#define BENCH_IMAGE_LEN     (1024UL * 32)
+#define BENCH_POLL_MS       (20)
+#define BENCH_MAX_ROUNDS    (16)
+
+/**< emulated bootloader on the device side of a pseudo-terminal */
+typedef struct
+{
+  int       fd;
+  uint8_t   *flash;
+  uint32_t  size;
+  char      line[BENCH_LINE_LEN];
+  uint8_t   line_len;
+  uint32_t  start;          /**< where the transfer started */
+  uint32_t  addr;           /**< where the payload goes */
+  uint16_t  need;           /**< payload bytes still expected */
+  uint16_t  unpack;         /**< unpacked length of a compressed payload, 0 if plain */
+  uint16_t  packed;         /**< compressed bytes received */
+  uint8_t   pack[APP_PACK_LEN];
+} tBenchDevice;
+
+/**< all emulated devices of one round, served by one thread */
+typedef struct
+{
+  tBenchDevice  *devices;
+  uint16_t      cnt;
+  tProfile      *profile;
+  atomic_bool   stop;
+} tBenchRack;
+
+/** \brief Send reply line of the emulated bootloader
+ *
+ * \param [in] dev Device
+ * \param [in] text Reply without line end
+ * \return Nothing
+ *
+ */
+static void BENCH_Reply(tBenchDevice *dev, char *text)
+{
+  char str[BENCH_LINE_LEN];
+  int len = snprintf(str, sizeof(str), "%s%s", text, APP_CMD_NL);
+
+  if (write(dev->fd, str, len) != len)
+    LOG_Print(LOG_LEVEL_WARNING, "Emulator reply lost");
+}
+
+/** \brief Acknowledge programmed transfer with its checksum
+ *
+ * \param [in] dev Device
+ * \return Nothing
+ *
+ */
+static void BENCH_Ack(tBenchDevice *dev)
+{
+  char str[BENCH_LINE_LEN];
+
+  if (dev->addr > dev->size)
+  {
+    BENCH_Reply(dev, "ER");
+    return;
+  }
+  snprintf(str, sizeof(str), "OK:%X", CRC16_CalcData(&dev->flash[dev->start], (uint16_t)(dev->addr - dev->start)));
+  BENCH_Reply(dev, str);
+}
+
+/** \brief Execute one command received by the emulated bootloader
+ *
+ * \param [in] rack Rack with the profile to emulate
+ * \param [in,out] dev Device
+ * \return Nothing
+ *
+ */
+static void BENCH_Command(tBenchRack *rack, tBenchDevice *dev)
+{
+  char str[BENCH_LINE_LEN];
+  unsigned int page, val, packed;
+  uint16_t page_size = rack->profile->page_size;
+
+  dev->line[dev->line_len] = 0;
+  if ((sscanf(dev->line, "BLZ%x:%x:%x", &page, &val, &packed) == 3) && (packed <= APP_PACK_LEN))
+  {
+    dev->start = page * page_size;
+    dev->addr = dev->start;
+    dev->unpack = (uint16_t)val;
+    dev->packed = 0;
+    dev->need = (uint16_t)packed;
+  } else if (sscanf(dev->line, "BLW%x:%x", &page, &val) == 2)
+  {
+    dev->start = page * page_size;
+    dev->addr = dev->start;
+    dev->need = (uint16_t)val;
+  } else if (sscanf(dev->line, "BLF%x", &page) == 1)
+  {
+    dev->start = page * page_size;
+    dev->addr = dev->start;
+    dev->need = page_size;
+  } else if (sscanf(dev->line, "BLC%x:%x", &page, &val) == 2)
+  {
+    if (((page + 1) * page_size <= dev->size) && (CRC16_CalcData(&dev->flash[page * page_size], page_size) == val))
+      BENCH_Reply(dev, "OK");
+    else
+      BENCH_Reply(dev, "ER");
+  } else if (strcmp(dev->line, APP_CMD_InfoBL) == 0)
+  {
+    snprintf(str, sizeof(str), "OK:%X:%X:%s", rack->profile->max_unit, PROFILE_FEATURE_BULK | PROFILE_FEATURE_PACK |
+             PROFILE_FEATURE_ACK_CRC, rack->profile->name);
+    BENCH_Reply(dev, str);
+  } else
+  {
+    /**< adapter commands, bootloader start and stop */
+    BENCH_Reply(dev, "OK");
+  }
+}
+
+/** \brief Handle data received by the emulated bootloader
+ *
+ * \param [in] rack Rack with the profile to emulate
+ * \param [in,out] dev Device
+ * \param [in] data Received data
+ * \param [in] len Length of data
+ * \return Nothing
+ *
+ */
+static void BENCH_Input(tBenchRack *rack, tBenchDevice *dev, uint8_t *data, int len)
+{
+  int i;
+
+  for (i = 0; i < len; i++)
+  {
+    if ((dev->need > 0) && (dev->unpack > 0))
+    {
+      dev->pack[dev->packed++] = data[i];
+      if (--dev->need > 0)
+        continue;
+      if ((dev->addr + dev->unpack <= dev->size) &&
+          (PACK_Decompress(dev->pack, dev->packed, &dev->flash[dev->addr], dev->unpack) == dev->unpack))
+      {
+        dev->addr += dev->unpack;
+        BENCH_Ack(dev);
+      } else
+      {
+        BENCH_Reply(dev, "ER");
+      }
+      dev->unpack = 0;
+    } else if (dev->need > 0)
+    {
+      if (dev->addr < dev->size)
+        dev->flash[dev->addr] = data[i];
+      dev->addr++;
+      if (--dev->need == 0)
+        BENCH_Ack(dev);
+    } else if (data[i] == 0x1B)
+    {
+      dev->line_len = 0;
+    } else if (data[i] == APP_CMD_NL[0])
+    {
+      BENCH_Command(rack, dev);
+      dev->line_len = 0;
+    } else if (dev->line_len < BENCH_LINE_LEN - 1)
+    {
+      dev->line[dev->line_len++] = (char)data[i];
+    }
+  }
+}
+
+/** \brief Thread serving all emulated devices of the rack
+ *
+ * \param [in] arg Rack
+ * \return NULL
+ *
+ */
+static void *BENCH_Emulator(void *arg)
+{
+  tBenchRack *rack = arg;
+  struct epoll_event ev;
+  struct epoll_event events[ENGINE_EVENTS];
+  uint8_t buf[TRANSPORT_RX_LEN * 4];
+  tBenchDevice *dev;
+  int epfd;
+  int n, i, len;
+  uint16_t k;
+
+  if ((epfd = epoll_create1(0)) < 0)
+    return NULL;
+  for (k = 0; k < rack->cnt; k++)
+  {
+    ev.events = EPOLLIN;
+    ev.data.ptr = &rack->devices[k];
+    epoll_ctl(epfd, EPOLL_CTL_ADD, rack->devices[k].fd, &ev);
+  }
+  while (atomic_load(&rack->stop) == false)
+  {
+    n = epoll_wait(epfd, events, ENGINE_EVENTS, BENCH_POLL_MS);
+    for (i = 0; i < n; i++)
+    {
+      dev = events[i].data.ptr;
+      len = (int)read(dev->fd, buf, sizeof(buf));
+      if (len > 0)
+        BENCH_Input(rack, dev, buf, len);
+    }
+  }
+  close(epfd);
+
+  return NULL;
+}
+
+/** \brief Run one round: the image is written and verified on emulated devices
+ *
+ * \param [in] parameters Parameters of all sessions
+ * \param [in] profile Profile of the emulated devices
+ * \param [in] fdata Firmware image
+ * \param [in] len Image length
+ * \param [in] cnt Number of sessions
+ * \param [in] port Port of every session, "pty://" or the address the listener accepts
+ * \param [in] listener Listening socket the devices are accepted from, -1 for pseudo-terminals
+ * \param [out] stats Results of the round
+ * \return true if all sessions succeeded
+ *
+ */
+static bool BENCH_Round(tParam *parameters, tProfile *profile, uint8_t *fdata, uint32_t len, uint16_t cnt,
+                        char *port, int listener, tEngineStats *stats)
+{
+  tBenchRack rack;
+  tEngine *e;
+  pthread_t thread;
+  uint32_t size = (len + profile->page_size - 1) / profile->page_size * profile->page_size;
+  uint16_t k;
+  bool res = false;
+
+  memset(&rack, 0, sizeof(rack));
+  rack.profile = profile;
+  if ((e = ENGINE_Create(parameters, fdata, len)) == NULL)
+    return false;
+  rack.devices = calloc(cnt, sizeof(tBenchDevice));
+  for (k = 0; (rack.devices != NULL) && (k < cnt); k++)
+  {
+    /**< the last page is written in full */
+    if ((ENGINE_Add(e, port) == false) || ((rack.devices[k].flash = malloc(size)) == NULL))
+      break;
+    /**< the connection is already queued by the listener, accept() doesn't block */
+    rack.devices[k].fd = (listener < 0) ? ENGINE_GetPeer(e, k) : accept(listener, NULL, NULL);
+    if (rack.devices[k].fd < 0)
+    {
+      free(rack.devices[k].flash);
+      break;
+    }
+    rack.devices[k].size = size;
+    rack.cnt++;
+  }
+  if ((rack.cnt == cnt) && (pthread_create(&thread, NULL, BENCH_Emulator, &rack) == 0))
+  {
+    res = ENGINE_Run(e, stats);
+    atomic_store(&rack.stop, true);
+    pthread_join(thread, NULL);
+  }
+  ENGINE_Free(e);
+  for (k = 0; k < rack.cnt; k++)
+  {
+    if (listener >= 0)
+      close(rack.devices[k].fd);
+    free(rack.devices[k].flash);
+  }
+  free(rack.devices);
+
+  return res;
+}
+
+/** \brief Prepare parameters and image of the emulated sessions
+ *
+ * \param [in] parameters Parameters, the image is taken from the file if set
+ * \param [out] param Parameters of the sessions
+ * \param [out] len Image length
+ * \return image, NULL if failed
+ *
+ */
+static uint8_t *BENCH_Prepare(tParam *parameters, tParam *param, uint32_t *len)
+{
+  uint8_t *fdata;
+  uint32_t seed = 1;
+  uint32_t i;
+
+  memcpy(param, parameters, sizeof(tParam));
+  param->write = true;
+  param->check = true;
+  param->bus_id = -1;
+  if ((fdata = malloc(PROFILE_GetMaxFlash())) == NULL)
+    return NULL;
+  if (param->file[0] != 0)
+  {
+    if (APP_OpenFile(param->file, fdata, PROFILE_GetMaxFlash(), len) == false)
+    {
+      free(fdata);
+      return NULL;
+    }
+  } else
+  {
+    *len = BENCH_IMAGE_LEN;
+    for (i = 0; i < *len; i++)
+    {
+      seed = seed * 1103515245UL + 12345;
+      fdata[i] = (uint8_t)(seed >> 16);
+    }
+  }
+
+  return fdata;
+}
+
+/** \brief Measure how the engine scales: rounds with 1, 2, 4 ... up to the given number of sessions
+ *
+ * \param [in] parameters Parameters, the image is taken from the file if set
+ * \param [in] max_sessions Number of sessions in the last round
+ * \return true if all sessions of all rounds succeeded
+ *
+ */
+bool BENCH_Run(tParam *parameters, uint16_t max_sessions)
+{
+  tEngineStats stats[BENCH_MAX_ROUNDS];
+  struct rlimit limit;
+  struct rusage usage;
+  tProfile *profile;
+  tParam param;
+  uint8_t *fdata;
+  uint32_t len;
+  uint32_t i;
+  uint16_t cnt;
+  uint8_t rounds = 0;
+  bool res = true;
+
+  profile = (parameters->device[0] != 0) ? PROFILE_Find(parameters->device) : PROFILE_GetDefault();
+  if ((fdata = BENCH_Prepare(parameters, &param, &len)) == NULL)
+    return false;
+  /**< every session needs both sides of a pseudo-terminal */
+  if (getrlimit(RLIMIT_NOFILE, &limit) == 0)
+  {
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+  }
+
+  for (cnt = 1; (rounds < BENCH_MAX_ROUNDS) && (res == true); cnt = (cnt * 2 < max_sessions) ? cnt * 2 : max_sessions)
+  {
+    res = BENCH_Round(&param, profile, fdata, len, cnt, "pty://", -1, &stats[rounds++]);
+    if (cnt == max_sessions)
+      break;
+  }
+  free(fdata);
+
+  LOG_Print(LOG_LEVEL_LAST, "Engine benchmark, %s, %u bytes per session:", profile->name, len);
+  LOG_Print(LOG_LEVEL_LAST, "  sessions  ok      time     total     per session  wakeups");
+  for (i = 0; i < rounds; i++)
+  {
+    LOG_Print(LOG_LEVEL_LAST, "  %8u  %4u  %4u.%03u s  %6u kB/s  %6u kB/s  %7u", stats[i].sessions, stats[i].done,
+              (uint32_t)(stats[i].elapsed_us / 1000000), (uint32_t)(stats[i].elapsed_us / 1000 % 1000),
+              (uint32_t)(stats[i].bytes * 1000 / (stats[i].elapsed_us + 1)),
+              (uint32_t)(stats[i].bytes * 1000 / (stats[i].elapsed_us + 1) / stats[i].sessions), stats[i].wakeups);
+  }
+  if (getrusage(RUSAGE_SELF, &usage) == 0)
+    LOG_Print(LOG_LEVEL_LAST, "  peak memory: %ld kB", usage.ru_maxrss);
+
+  return res;
+}
+
+/** \brief Write and verify an emulated device over the network transport, the device listens on the loopback
+ *
+ * \param [in] parameters Parameters, the image is taken from the file if set
+ * \return true if the image was written and verified
+ *
+ */
+bool BENCH_Loopback(tParam *parameters)
+{
+  struct sockaddr_in addr;
+  socklen_t addr_len = sizeof(addr);
+  tEngineStats stats;
+  tProfile *profile;
+  tParam param;
+  char port[COMPORT_LEN];
+  uint8_t *fdata;
+  uint32_t len;
+  int listener;
+  bool res = false;
+
+  profile = (parameters->device[0] != 0) ? PROFILE_Find(parameters->device) : PROFILE_GetDefault();
+  if ((fdata = BENCH_Prepare(parameters, &param, &len)) == NULL)
+    return false;
+  memset(&stats, 0, sizeof(stats));
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  /**< any free port, the system picks it */
+  addr.sin_port = 0;
+  listener = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if ((listener < 0) || (bind(listener, (struct sockaddr *)&addr, sizeof(addr)) != 0) || (listen(listener, 1) != 0) ||
+      (getsockname(listener, (struct sockaddr *)&addr, &addr_len) != 0))
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "Unable to listen on the loopback interface");
+  } else
+  {
+    snprintf(port, sizeof(port), "tcp://127.0.0.1:%u", ntohs(addr.sin_port));
+    res = BENCH_Round(&param, profile, fdata, len, 1, port, listener, &stats);
+    LOG_Print(LOG_LEVEL_LAST, "Loopback test over %s, %s, %u bytes: %s in %u ms", port, profile->name, len,
+              (res == true) ? "passed" : "FAILED", (uint32_t)(stats.elapsed_us / 1000));
+  }
+  if (listener >= 0)
+    close(listener);
+  free(fdata);
+
+  return res;
+}
+#endif
@@ -0,0 +1,11 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include "defines.h"
+
+#ifdef __linux
+bool BENCH_Run(tParam *parameters, uint16_t max_sessions);
+bool BENCH_Loopback(tParam *parameters);
+#endif
+
+#endif
@@ -3,25 +3,62 @@
 #include <winbase.h>
 #endif
 #ifdef __linux
+#include <sys/ioctl.h>
 #include <sys/types.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdlib.h>
 #include <termios.h>
 #include <unistd.h>
+#include <linux/serial.h>
 #endif
 #include <math.h>
 #include "defines.h"
+#include "com.h"
+#include "log.h"
 
-#ifdef __MINGW32__
-static HANDLE hSerial;
-#endif
 #ifdef __linux
-static int fd;
-#endif
+#define COM_SYSFS_TTY     "/sys/class/tty/%s/device/%s"
+#define COM_LATENCY_MS    (1)
+
+/** \brief Find kernel name of the port and check if it belongs to an USB serial adapter
+ *
+ * \param [in] link Link to fill in
+ * \param [in] port Port name as string, symbolic links are followed
+ * \return true if the port is an USB serial adapter
+ *
+ */
+static bool COM_DetectUsb(tLink *link, char *port)
+{
+  char path[PATH_MAX];
+  char target[PATH_MAX];
+  char *name;
+  ssize_t len;
+
+  if (realpath(port, target) == NULL)
+    return false;
+  name = strrchr(target, '/');
+  snprintf(link->name, sizeof(link->name), "%.15s", (name != NULL) ? name + 1 : target);
+  snprintf(path, sizeof(path), COM_SYSFS_TTY, link->name, "driver");
+  len = readlink(path, target, sizeof(target) - 1);
+  if (len <= 0)
+    return false;
+  target[len] = 0;
+  /**< usb-serial drivers (ftdi_sio, cp210x, ch341...) and cdc_acm are both on the usb bus */
+  if (strstr(target, "/usb") == NULL)
+    return false;
+  name = strrchr(target, '/');
+  LOG_Print(LOG_LEVEL_INFO, "%s is an USB serial adapter (%s)", link->name, (name != NULL) ? name + 1 : target);
 
-static uint32_t COM_Baudrate = 115200;
+  return true;
+}
+#endif
 
 /** \brief Open COM port with settings
  *
+ * \param [in] link Link to open
  * \param [in] port Port name as string
  * \param [in] baudrate Port baudrate
  * \param [in] have_parity true if parity should be switched on
@@ -29,21 +66,22 @@ static uint32_t COM_Baudrate = 115200;
  * \return true if succeed
  *
  */
-bool COM_Open(char *port, uint32_t baudrate, bool have_parity, bool two_stopbits)
+bool COM_Open(tLink *link, char *port, uint32_t baudrate, bool have_parity, bool two_stopbits)
 {
-  COM_Baudrate = baudrate;
+  link->baudrate = baudrate;
+  link->default_timeout = TRANSPORT_TIMEOUT_MS;
   #ifdef __MINGW32__
   char str[64];
   uint8_t multiplier;
 
   sprintf(str, "\\\\.\\%s", port);
-  hSerial = CreateFile(str, GENERIC_READ | GENERIC_WRITE, 0,
+  link->handle = CreateFile(str, GENERIC_READ | GENERIC_WRITE, 0,
                               NULL, OPEN_EXISTING, 0, NULL);
-  if (hSerial == INVALID_HANDLE_VALUE)
+  if (link->handle == INVALID_HANDLE_VALUE)
     return false;
   DCB dcbSerialParams = { 0 }; // Initializing DCB structure
   dcbSerialParams.DCBlength = sizeof(dcbSerialParams);
-  GetCommState(hSerial, &dcbSerialParams);
+  GetCommState(link->handle, &dcbSerialParams);
   dcbSerialParams.BaudRate = baudrate;  // Setting BaudRate
   dcbSerialParams.ByteSize = 8;         // Setting ByteSize = 8
   if (two_stopbits == true)
@@ -60,7 +98,7 @@ bool COM_Open(char *port, uint32_t baudrate, bool have_parity, bool two_stopbits
   dcbSerialParams.fParity = FALSE;
   dcbSerialParams.fOutxCtsFlow = FALSE;
   dcbSerialParams.fOutxDsrFlow = FALSE;
-  SetCommState(hSerial, &dcbSerialParams);
+  SetCommState(link->handle, &dcbSerialParams);
   COMMTIMEOUTS timeouts;
   multiplier = (uint8_t)ceil((float)100000 / baudrate);
   timeouts.ReadIntervalTimeout = 40 * multiplier;
@@ -68,11 +106,12 @@ bool COM_Open(char *port, uint32_t baudrate, bool have_parity, bool two_stopbits
   timeouts.ReadTotalTimeoutConstant = 100 * multiplier;
   timeouts.WriteTotalTimeoutMultiplier = 1;
   timeouts.WriteTotalTimeoutConstant = 1;
-  SetCommTimeouts(hSerial, &timeouts);
+  SetCommTimeouts(link->handle, &timeouts);
+  link->default_timeout = timeouts.ReadTotalTimeoutConstant;
   #endif
 
   #ifdef __linux
-  fd = open(port, O_RDWR | O_NOCTTY );
+  int fd = open(port, O_RDWR | O_NOCTTY );
   if (fd <0)
     return false;
   struct termios SerialPortSettings;
@@ -113,31 +152,53 @@ bool COM_Open(char *port, uint32_t baudrate, bool have_parity, bool two_stopbits
     SerialPortSettings.c_cflag &= ~CSTOPB;  /* CSTOPB = 2 Stop bits,here it is cleared so 1 Stop bit */
   SerialPortSettings.c_cflag |= (CREAD | CLOCAL); /* Enable receiver,Ignore Modem Control lines       */
   SerialPortSettings.c_cc[VMIN]  = 0;            // read doesn't block
-  SerialPortSettings.c_cc[VTIME] = 5;            // 0.1 seconds read timeout
+  SerialPortSettings.c_cc[VTIME] = 0;            // timeout is handled with poll()
   tcsetattr(fd, TCSANOW, &SerialPortSettings);  /* Set the attributes to the termios structure*/
   tcflush(fd, TCIFLUSH);
+  link->fd = fd;
+  link->usb = COM_DetectUsb(link, port);
   #endif
+  link->timeout = link->default_timeout;
 
   return true;
 }
 
-/** \brief Write data to COM port
+/** \brief Open COM port with default settings (8N1)
  *
- * \param [in] data Data buffer for writing
- * \param [in] len Length of data buffer
+ * \param [in] link Link to open
+ * \param [in] address Port name as string
+ * \param [in] baudrate Port baudrate
+ * \return true if succeed
+ *
+ */
+static bool COM_OpenLink(tLink *link, char *address, uint32_t baudrate)
+{
+  return COM_Open(link, address, baudrate, false, false);
+}
+
+/** \brief Write frame to COM port
+ *
+ * \param [in] link Opened link
+ * \param [in] chunks Parts of the frame
+ * \param [in] cnt Number of parts
  * \return 0 if everything Ok
  *
  */
-int COM_Write(uint8_t *data, uint16_t len)
+int COM_Write(tLink *link, const tChunk *chunks, uint8_t cnt)
 {
   #ifdef __MINGW32__
   DWORD dwBytesWritten = 0;
-  if (!WriteFile(hSerial, data, len, &dwBytesWritten, NULL))
-    return -1;
+  uint8_t i;
+
+  /**< WriteFileGather needs overlapped I/O and page aligned buffers, so parts are written one by one */
+  for (i = 0; i < cnt; i++)
+  {
+    if (!WriteFile(link->handle, chunks[i].data, chunks[i].len, &dwBytesWritten, NULL))
+      return -1;
+  }
   #endif
   #ifdef __linux
-  int iOut = write(fd, data, len);
-  if (iOut < 0)
+  if (TRANSPORT_WriteFd(link, chunks, cnt, -1) < 0)
     return -1;
   #endif
 
@@ -146,19 +207,23 @@ int COM_Write(uint8_t *data, uint16_t len)
 
 /** \brief Read data from COM port
  *
+ * \param [in] link Opened link
  * \param [out] data Data buffer to read data in
  * \param [in] len Length of data to read
  * \return number of received bytes as int
  *
  */
-int COM_Read(uint8_t *data, uint16_t len)
+int COM_Read(tLink *link, uint8_t *data, uint16_t len)
 {
   #ifdef __MINGW32__
   DWORD dwBytesRead = 0;
-  ReadFile(hSerial, data, len, &dwBytesRead, NULL);
+  ReadFile(link->handle, data, len, &dwBytesRead, NULL);
   #endif
   #ifdef __linux
-  int dwBytesRead = read(fd, data, len);
+  struct pollfd pfd = {link->fd, POLLIN, 0};
+  if (poll(&pfd, 1, link->timeout) <= 0)
+    return 0;
+  int dwBytesRead = read(link->fd, data, len);
   if (dwBytesRead < 0)
     return -1;
   #endif
@@ -166,40 +231,179 @@ int COM_Read(uint8_t *data, uint16_t len)
   return dwBytesRead;
 }
 
-/** \brief Calculate time for transmission with current baudrate
+/** \brief Set read timeout
  *
- * \param [in] len Length of transmitted data
- * \return time in milliseconds as uint16_t
+ * \param [in] link Opened link
+ * \param [in] ms Time to wait for the first byte in milliseconds
+ * \return Nothing
  *
  */
-uint16_t COM_GetTransTime(uint16_t len)
+void COM_SetTimeout(tLink *link, uint16_t ms)
 {
-  return (uint16_t)(len * 1000 * 11 / COM_Baudrate + 1);
+  link->timeout = ms;
+  #ifdef __MINGW32__
+  COMMTIMEOUTS timeouts;
+  GetCommTimeouts(link->handle, &timeouts);
+  timeouts.ReadTotalTimeoutConstant = ms;
+  SetCommTimeouts(link->handle, &timeouts);
+  #endif
 }
 
-#ifdef __MINGW32__
-void COM_WaitForTransmit(void)
+/** \brief Discard all received and not yet read data
+ *
+ * \param [in] link Opened link
+ * \return Nothing
+ *
+ */
+void COM_Flush(tLink *link)
 {
-  COMSTAT rStat;
-  DWORD nErr;
-  do {
-    ClearCommError(hSerial, &nErr, &rStat);
-  } while (rStat.cbOutQue > 0);
+  #ifdef __MINGW32__
+  PurgeComm(link->handle, PURGE_RXCLEAR);
+  #endif
+  #ifdef __linux
+  tcflush(link->fd, TCIFLUSH);
+  #endif
 }
-#endif // __MINGW32__
 
-/** \brief Close current COM port
+/** \brief Wait until all written data has left the port, without polling
  *
+ * \param [in] link Opened link
  * \return Nothing
  *
  */
-void COM_Close(void)
+void COM_WaitForTransmit(tLink *link)
 {
-  printf("Closing COM port\n");
   #ifdef __MINGW32__
-  CloseHandle(hSerial);
+  FlushFileBuffers(link->handle);
   #endif
   #ifdef __linux
+  while ((tcdrain(link->fd) < 0) && (errno == EINTR));
+  #endif
+}
+
+#ifdef __linux
+/** \brief Switch USB serial adapter to the lowest reply latency
+ *
+ * Sets ASYNC_LOW_LATENCY and lowers the latency timer of FTDI-like adapters
+ * (16 ms by default), the timer in sysfs is usually writable by root only
+ *
+ * \param [in] link Opened link
+ * \return true if any setting was changed
+ *
+ */
+static bool COM_Tune(tLink *link)
+{
+  struct serial_struct serial;
+  char path[PATH_MAX];
+  char str[8];
+  unsigned int timer;
+  bool res = false;
+  int fd;
+  ssize_t len;
+
+  if (link->usb == false)
+    return false;
+
+  if ((ioctl(link->fd, TIOCGSERIAL, &serial) == 0) && ((serial.flags & ASYNC_LOW_LATENCY) == 0))
+  {
+    serial.flags |= ASYNC_LOW_LATENCY;
+    if (ioctl(link->fd, TIOCSSERIAL, &serial) == 0)
+    {
+      LOG_Print(LOG_LEVEL_INFO, "%s: low latency mode switched on", link->name);
+      link->low_latency = true;
+      res = true;
+    } else
+    {
+      LOG_Print(LOG_LEVEL_INFO, "%s: low latency mode not supported: %s", link->name, strerror(errno));
+    }
+  }
+
+  snprintf(path, sizeof(path), COM_SYSFS_TTY, link->name, "latency_timer");
+  if ((fd = open(path, O_RDONLY)) < 0)
+    return res;
+  len = read(fd, str, sizeof(str) - 1);
   close(fd);
+  if ((len <= 0) || (sscanf(str, "%u", &timer) != 1) || (timer <= COM_LATENCY_MS))
+    return res;
+  len = snprintf(str, sizeof(str), "%u", COM_LATENCY_MS);
+  if (((fd = open(path, O_WRONLY)) < 0) || (write(fd, str, len) != len))
+  {
+    LOG_Print(LOG_LEVEL_WARNING, "%s: latency timer is %u ms, unable to change it (%s)", link->name, timer, strerror(errno));
+    if (fd >= 0)
+      close(fd);
+    return res;
+  }
+  close(fd);
+  LOG_Print(LOG_LEVEL_INFO, "%s: latency timer %u -> %u ms", link->name, timer, COM_LATENCY_MS);
+  link->latency_timer = (uint16_t)timer;
+
+  return true;
+}
+
+/** \brief Give the adapter back with the settings changed by COM_Tune() restored
+ *
+ * \param [in] link Opened link
+ * \return Nothing
+ *
+ */
+static void COM_Untune(tLink *link)
+{
+  struct serial_struct serial;
+  char path[PATH_MAX];
+  char str[8];
+  int fd;
+  int len;
+
+  if ((link->low_latency == true) && (ioctl(link->fd, TIOCGSERIAL, &serial) == 0))
+  {
+    serial.flags &= ~ASYNC_LOW_LATENCY;
+    ioctl(link->fd, TIOCSSERIAL, &serial);
+  }
+  link->low_latency = false;
+  if (link->latency_timer == 0)
+    return;
+  snprintf(path, sizeof(path), COM_SYSFS_TTY, link->name, "latency_timer");
+  len = snprintf(str, sizeof(str), "%u", link->latency_timer);
+  if (((fd = open(path, O_WRONLY)) < 0) || (write(fd, str, len) != len))
+    LOG_Print(LOG_LEVEL_WARNING, "%s: unable to restore latency timer %u ms", link->name, link->latency_timer);
+  if (fd >= 0)
+    close(fd);
+  link->latency_timer = 0;
+}
+#endif
+
+/** \brief Close COM port
+ *
+ * \param [in] link Opened link
+ * \return Nothing
+ *
+ */
+void COM_Close(tLink *link)
+{
+  LOG_Print(LOG_LEVEL_INFO, "Closing COM port");
+  #ifdef __MINGW32__
+  CloseHandle(link->handle);
+  #endif
+  #ifdef __linux
+  COM_Untune(link);
+  close(link->fd);
   #endif
 }
+
+const tTransport COM_Transport =
+{
+  "tty",
+  NULL,
+  COM_OpenLink,
+  COM_Write,
+  COM_Read,
+  COM_SetTimeout,
+  COM_Flush,
+  COM_WaitForTransmit,
+  #ifdef __linux
+  COM_Tune,
+  #else
+  NULL,
+  #endif
+  COM_Close
+};
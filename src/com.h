@@ -3,12 +3,14 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include "transport.h"
 
-bool COM_Open(char *port, uint32_t baudrate, bool have_parity, bool two_stopbits);
-int COM_Write(uint8_t *data, uint16_t len);
-int COM_Read(uint8_t *data, uint16_t len);
-uint16_t COM_GetTransTime(uint16_t len);
-void COM_WaitForTransmit(void);
-void COM_Close(void);
+bool COM_Open(tLink *link, char *port, uint32_t baudrate, bool have_parity, bool two_stopbits);
+int COM_Write(tLink *link, const tChunk *chunks, uint8_t cnt);
+int COM_Read(tLink *link, uint8_t *data, uint16_t len);
+void COM_SetTimeout(tLink *link, uint16_t ms);
+void COM_Flush(tLink *link);
+void COM_WaitForTransmit(tLink *link);
+void COM_Close(tLink *link);
 
 #endif
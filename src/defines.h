@@ -10,8 +10,15 @@
 #include <stdarg.h>
 #include <unistd.h>
 
-#define FILENAME_LEN    (64)
-#define COMPORT_LEN     (32)
+#define FILENAME_LEN    (256)
+#define COMPORT_LEN     (FILENAME_LEN + 16)  /**< network addresses and recordings are given as ports too */
+#define DEVICE_LEN      (16)
+
+enum {
+  RESUME_NONE,
+  RESUME_QUICK,
+  RESUME_FULL
+};
 
 typedef struct
 {
@@ -21,8 +28,37 @@ typedef struct
   uint32_t  baudrate;
   int8_t    iface;
   int8_t    bus_id;
+  bool      scan;
+  uint8_t   scan_first;
+  uint8_t   scan_last;
+  uint8_t   resume;
+  bool      stream;
+  bool      if_changed;
+  bool      no_pack;        /**< don't compress transfers */
+  uint16_t  bench;          /**< sessions in the last benchmark round */
+  bool      selftest;       /**< write and verify an emulated device over the loopback network */
+  uint16_t  max_unit;
+  uint8_t   progress_rate;
+  uint16_t  timer_spin;
+  uint32_t  recover_ms;     /**< time budget for power-cycle recovery, 0 if off */
+  bool      rt;             /**< low-jitter mode of the I/O thread */
+  int16_t   rt_cpu;         /**< CPU for the I/O thread, -1 to keep the affinity */
+  int       progress_fd;
+  uint8_t   log_format;
+  char      log_file[FILENAME_LEN];
   char      port[COMPORT_LEN];
   char      file[FILENAME_LEN];
+  char      device[DEVICE_LEN];
+  char      profiles[FILENAME_LEN];
+  char      record[FILENAME_LEN];
+  char      read[FILENAME_LEN];
+  char      ports[FILENAME_LEN];
+  char      watch[FILENAME_LEN];    /**< pattern of port nodes flashed as they appear */
+  char      stats[FILENAME_LEN];
+  char      stats_export[FILENAME_LEN];
+  char      plan[FILENAME_LEN];     /**< delta plan, written with diff or applied with write */
+  char      diff[FILENAME_LEN];     /**< base firmware to make the delta plan from */
+  char      timing[FILENAME_LEN];   /**< database of timing learned per target */
 } tParam;
 
 #endif
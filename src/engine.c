@@ -0,0 +1,1017 @@
+#ifdef __linux
+#include <signal.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include "app.h"
+#include "crc16.h"
+#include "engine.h"
+#include "log.h"
+#include "sleep.h"
+#include "stream.h"
+#include "watch.h"
+
+#define ENGINE_LINE_LEN   (64)
+#define ENGINE_WATCH_ID   UINT32_MAX  /**< epoll data of the watch descriptor */
+#define ENGINE_PENDING    (64)        /**< new ports waiting until they settled */
+#define ENGINE_UNIT_MS    (20)        /**< longest transfer, writes are blocking and hold up all sessions */
+
+/**< steps of one session, every step sends one command and waits for its reply */
+enum {
+  ENGINE_STATE_IFACE,
+  ENGINE_STATE_BAUDRATE,
+  ENGINE_STATE_ID,
+  ENGINE_STATE_POWER_OFF,
+  ENGINE_STATE_POWER_ON,
+  ENGINE_STATE_PROBE,
+  ENGINE_STATE_SETTLE,
+  ENGINE_STATE_INFO,
+  ENGINE_STATE_WRITE,
+  ENGINE_STATE_CHECK,
+  ENGINE_STATE_QUIT,
+  ENGINE_STATE_DONE
+};
+
+/**< one session driven by the engine */
+typedef struct
+{
+  tSession  *s;
+  uint8_t   state;
+  uint8_t   errors;
+  bool      waiting;        /**< command is sent, the deadline is the reply timeout */
+  bool      started;        /**< bootloader answered */
+  bool      failed;
+  bool      polled;         /**< port is registered for events */
+  uint16_t  probes;
+  uint16_t  delay;          /**< pause between bootloader probes in ms */
+  uint64_t  power_on;
+  uint64_t  boot_deadline;
+  uint64_t  deadline;       /**< reply timeout or end of pause, 0 if none */
+  uint64_t  sent;           /**< time the last command left */
+  uint64_t  phase;          /**< start of the write step */
+  uint32_t  pos;            /**< image bytes done in the write or check step */
+  uint16_t  len;            /**< bytes of the transfer waiting for its reply */
+  tTransfer transfer;
+} tEngineSlot;
+
+struct tEngine
+{
+  tParam      parameters;
+  uint8_t     *fdata;
+  uint32_t    len;
+  uint16_t    cnt;
+  uint16_t    active;
+  tEngineSlot slots[ENGINE_MAX_SESSIONS];
+};
+
+static uint32_t ENGINE_Sessions;
+static volatile sig_atomic_t ENGINE_Stop;
+
+/** \brief Create engine for one image, sessions are added with ENGINE_Add()
+ *
+ * \param [in] parameters Parameters of all sessions, the port is set by ENGINE_Add()
+ * \param [in] fdata Firmware image, shared by all sessions
+ * \param [in] len Image length
+ * \return engine or NULL if failed
+ *
+ */
+tEngine *ENGINE_Create(tParam *parameters, uint8_t *fdata, uint32_t len)
+{
+  tEngine *e;
+
+  if ((e = calloc(1, sizeof(tEngine))) == NULL)
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "Unable to allocate engine");
+    return NULL;
+  }
+  memcpy(&e->parameters, parameters, sizeof(tParam));
+  e->fdata = fdata;
+  e->len = len;
+
+  return e;
+}
+
+/** \brief Open port and put a session for it into a free slot
+ *
+ * \param [in] engine Engine
+ * \param [in] port Port name
+ * \return slot number or -1 if failed
+ *
+ */
+static int ENGINE_Open(tEngine *engine, char *port)
+{
+  tEngineSlot *slot;
+  tSession *s;
+  uint16_t k;
+
+  /**< slots of released sessions are taken again */
+  for (k = 0; k < engine->cnt; k++)
+  {
+    if (engine->slots[k].s == NULL)
+      break;
+  }
+  if (k >= ENGINE_MAX_SESSIONS)
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "Too many sessions, the limit is %u", ENGINE_MAX_SESSIONS);
+    return -1;
+  }
+  if ((s = calloc(1, sizeof(tSession))) == NULL)
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "Unable to allocate session");
+    return -1;
+  }
+  memcpy(&s->parameters, &engine->parameters, sizeof(tParam));
+  strncpy(s->parameters.port, port, COMPORT_LEN);
+  s->parameters.port[COMPORT_LEN - 1] = 0;
+  s->id = ++ENGINE_Sessions;
+  LOG_SetContext(s->id, s->parameters.port, s->parameters.bus_id);
+  STATS_Begin(&s->run);
+  s->profile = PROFILE_GetDefault();
+  if (s->parameters.device[0] != 0)
+  {
+    s->device = PROFILE_Find(s->parameters.device);
+    s->profile = s->device;
+  }
+  if (PHY_Init(&s->phy, s->parameters.port, PHY_BAUDRATE, false) == false)
+  {
+    free(s);
+    return -1;
+  }
+  if (PHY_GetFd(&s->phy) < 0)
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "Port can't be waited for: %s", port);
+    PHY_Close(&s->phy);
+    free(s);
+    return -1;
+  }
+  if (k == engine->cnt)
+    engine->cnt++;
+  slot = &engine->slots[k];
+  memset(slot, 0, sizeof(tEngineSlot));
+  slot->s = s;
+
+  return k;
+}
+
+/** \brief Open port and add a session for it
+ *
+ * \param [in] engine Engine
+ * \param [in] port Port name
+ * \return true if succeed
+ *
+ */
+bool ENGINE_Add(tEngine *engine, char *port)
+{
+  return ENGINE_Open(engine, port) >= 0;
+}
+
+/** \brief Get device side of a pseudo-terminal session, used to attach emulators
+ *
+ * \param [in] engine Engine
+ * \param [in] n Session number in the order of adding
+ * \return descriptor or -1 if the port is not a pseudo-terminal
+ *
+ */
+int ENGINE_GetPeer(tEngine *engine, uint16_t n)
+{
+  if ((n >= engine->cnt) || (engine->slots[n].s == NULL))
+    return -1;
+
+  return engine->slots[n].s->phy.link.peer_fd;
+}
+
+/** \brief Send queued command with payload and wait for its reply
+ *
+ * \param [in,out] slot Session
+ * \param [in] data Payload, may be NULL
+ * \param [in] len Payload length
+ * \param [in] timeout Reply timeout in ms
+ * \return Nothing
+ *
+ */
+static void ENGINE_Send(tEngineSlot *slot, uint8_t *data, uint16_t len, uint32_t timeout)
+{
+  APP_Transmit(slot->s, data, len);
+  slot->waiting = true;
+  slot->sent = usclock();
+  slot->deadline = slot->sent + (uint64_t)timeout * 1000;
+}
+
+/** \brief Pause before the next step
+ *
+ * \param [in,out] slot Session
+ * \param [in] ms Pause in ms, 0 to continue with the next wakeup
+ * \return Nothing
+ *
+ */
+static void ENGINE_Pause(tEngineSlot *slot, uint32_t ms)
+{
+  slot->waiting = false;
+  slot->deadline = usclock() + (uint64_t)ms * 1000;
+}
+
+/** \brief Stop the session with an error, a started bootloader is quit first
+ *
+ * \param [in,out] slot Session
+ * \param [in] text Error description
+ * \return Nothing
+ *
+ */
+static void ENGINE_Fail(tEngineSlot *slot, char *text)
+{
+  LOG_Print(LOG_LEVEL_ERROR, "%s", text);
+  slot->failed = true;
+  slot->errors = 0;
+  slot->state = slot->started ? ENGINE_STATE_QUIT : ENGINE_STATE_DONE;
+  ENGINE_Pause(slot, 0);
+}
+
+/** \brief Send the command of the current step
+ *
+ * \param [in] e Engine
+ * \param [in,out] slot Session
+ * \return Nothing
+ *
+ */
+static void ENGINE_Step(tEngine *e, tEngineSlot *slot)
+{
+  tSession *s = slot->s;
+  uint16_t page_size = s->profile->page_size;
+  uint32_t size = (uint32_t)s->pages * page_size;
+  uint8_t *payload;
+  uint16_t n;
+
+  switch (slot->state)
+  {
+    case ENGINE_STATE_IFACE:
+      if (s->parameters.iface >= 0)
+      {
+        APP_Queue(s, APP_CMD_SetIface, s->parameters.iface);
+        ENGINE_Send(slot, NULL, 0, APP_REPLY_TIMEOUT_MS);
+        break;
+      }
+      slot->state = ENGINE_STATE_BAUDRATE;
+      /* fall through */
+    case ENGINE_STATE_BAUDRATE:
+      if (s->parameters.baudrate != 0)
+      {
+        APP_Queue(s, APP_CMD_SetBaudrate, s->parameters.baudrate);
+        ENGINE_Send(slot, NULL, 0, APP_REPLY_TIMEOUT_MS);
+        break;
+      }
+      slot->state = ENGINE_STATE_ID;
+      /* fall through */
+    case ENGINE_STATE_ID:
+      if (s->parameters.bus_id >= 0)
+      {
+        APP_Queue(s, APP_CMD_SetId, s->parameters.bus_id);
+        ENGINE_Send(slot, NULL, 0, APP_REPLY_TIMEOUT_MS);
+        break;
+      }
+      slot->state = ENGINE_STATE_POWER_OFF;
+      /* fall through */
+    case ENGINE_STATE_POWER_OFF:
+      APP_Queue(s, APP_CMD_Power, 0);
+      ENGINE_Send(slot, NULL, 0, APP_POWER_TIMEOUT_MS);
+      break;
+    case ENGINE_STATE_POWER_ON:
+      APP_Queue(s, APP_CMD_Power, 1);
+      ENGINE_Send(slot, NULL, 0, APP_REPLY_TIMEOUT_MS);
+      break;
+    case ENGINE_STATE_PROBE:
+      slot->probes++;
+      APP_Queue(s, APP_CMD_StartBL);
+      ENGINE_Send(slot, NULL, 0, APP_PROBE_TIMEOUT_MS);
+      break;
+    case ENGINE_STATE_SETTLE:
+      /**< late replies to the earlier probes are gone now */
+      PHY_Flush(&s->phy);
+      slot->state = ENGINE_STATE_INFO;
+      /* fall through */
+    case ENGINE_STATE_INFO:
+      APP_Queue(s, APP_CMD_InfoBL);
+      ENGINE_Send(slot, NULL, 0, APP_REPLY_TIMEOUT_MS);
+      break;
+    case ENGINE_STATE_WRITE:
+      if (slot->pos < size)
+      {
+        n = slot->transfer.unit;
+        if (n > size - slot->pos)
+          n = (uint16_t)(size - slot->pos);
+        slot->len = n;
+        n = APP_QueueWrite(s, slot->pos / page_size, &e->fdata[slot->pos], n, &payload);
+        ENGINE_Send(slot, payload, n, PHY_GetTransTime(&s->phy, n) + APP_REPLY_TIMEOUT_MS);
+        break;
+      }
+      s->run.write_us += usclock() - slot->phase;
+      slot->pos = 0;
+      /**< write replies carried the page checksums, the check pass has nothing to do */
+      if ((s->parameters.check == true) && (APP_AckHasCrc(s) == true))
+      {
+        s->run.pages_verified += s->pages;
+        slot->pos = size;
+      }
+      slot->state = ENGINE_STATE_CHECK;
+      /* fall through */
+    case ENGINE_STATE_CHECK:
+      if ((s->parameters.check == true) && (slot->pos < size))
+      {
+        APP_Queue(s, APP_CMD_CheckBL, slot->pos / page_size, CRC16_CalcData(&e->fdata[slot->pos], page_size));
+        ENGINE_Send(slot, NULL, 0, APP_REPLY_TIMEOUT_MS);
+        break;
+      }
+      slot->errors = 0;
+      slot->state = ENGINE_STATE_QUIT;
+      /* fall through */
+    case ENGINE_STATE_QUIT:
+      APP_Queue(s, APP_CMD_StopBL);
+      ENGINE_Send(slot, NULL, 0, APP_REPLY_TIMEOUT_MS);
+      break;
+  }
+}
+
+/** \brief Bootloader answered the information request or didn't know it
+ *
+ * \param [in] e Engine
+ * \param [in,out] slot Session
+ * \param [in] reply Reply line, NULL on timeout
+ * \return Nothing
+ *
+ */
+static void ENGINE_Info(tEngine *e, tEngineSlot *slot, char *reply)
+{
+  tSession *s = slot->s;
+  uint16_t limit;
+
+  memset(&s->info, 0, sizeof(tBootInfo));
+  if (reply != NULL)
+    APP_ParseInfo(reply, &s->info);
+  if ((s->device == NULL) && (s->info.name[0] != 0) && ((s->device = PROFILE_Find(s->info.name)) != NULL))
+    s->profile = s->device;
+  if (e->len > s->profile->flash_size)
+  {
+    ENGINE_Fail(slot, "Hex file is larger than flash");
+    return;
+  }
+  s->pages = (e->len - 1) / s->profile->page_size + 1;
+  /**< one long transfer on a slow link would stall every other session */
+  limit = (uint16_t)(s->phy.link.baudrate / 11 * ENGINE_UNIT_MS / 1000);
+  if ((s->parameters.max_unit > 0) && (s->parameters.max_unit < limit))
+    limit = s->parameters.max_unit;
+  APP_NegotiateUnit(s, &slot->transfer, &s->info, limit);
+  slot->pos = 0;
+  slot->errors = 0;
+  slot->state = s->parameters.write ? ENGINE_STATE_WRITE : ENGINE_STATE_CHECK;
+  slot->phase = usclock();
+  ENGINE_Pause(slot, s->profile->gap_ms);
+}
+
+/** \brief Handle reply of the current step
+ *
+ * \param [in] e Engine
+ * \param [in,out] slot Session
+ * \param [in] reply Reply line, NULL on timeout
+ * \return Nothing
+ *
+ */
+static void ENGINE_Reply(tEngine *e, tEngineSlot *slot, char *reply)
+{
+  tSession *s = slot->s;
+  bool ok = (reply != NULL) && (strncmp(reply, APP_CMD_OK, strlen(APP_CMD_OK)) == 0);
+
+  LOG_Print(LOG_LEVEL_DEBUG, (reply != NULL) ? "RX %s" : "RX timeout", reply);
+  if (ok == false)
+  {
+    s->fault = (reply == NULL) ? STATS_CAUSE_TIMEOUT : STATS_CAUSE_REJECTED;
+    /**< unanswered probes are expected while the device boots */
+    if ((reply == NULL) && (slot->state != ENGINE_STATE_PROBE))
+      s->run.timeouts++;
+  }
+  slot->waiting = false;
+  slot->deadline = 0;
+  switch (slot->state)
+  {
+    case ENGINE_STATE_IFACE:
+    case ENGINE_STATE_BAUDRATE:
+    case ENGINE_STATE_ID:
+      if (ok == false)
+      {
+        ENGINE_Fail(slot, "Unable to set up adapter");
+        break;
+      }
+      slot->state++;
+      ENGINE_Pause(slot, 0);
+      break;
+    case ENGINE_STATE_POWER_OFF:
+      if (ok == true)
+      {
+        slot->state = ENGINE_STATE_POWER_ON;
+        ENGINE_Pause(slot, s->profile->power_off_ms);
+        break;
+      }
+      LOG_Print(LOG_LEVEL_WARNING, "Adapter doesn't support power control, waiting %u ms", s->profile->boot_ms);
+      slot->power_on = usclock() + (uint64_t)s->profile->boot_ms * 1000;
+      slot->boot_deadline = slot->power_on + (uint64_t)(s->profile->boot_ms + APP_BOOT_DEADLINE_MS) * 1000;
+      slot->delay = APP_PROBE_DELAY_MS;
+      slot->state = ENGINE_STATE_PROBE;
+      ENGINE_Pause(slot, s->profile->boot_ms);
+      break;
+    case ENGINE_STATE_POWER_ON:
+      if (ok == false)
+      {
+        ENGINE_Fail(slot, "Unable to switch target power on");
+        break;
+      }
+      slot->power_on = usclock();
+      slot->boot_deadline = slot->power_on + (uint64_t)(s->profile->boot_ms + APP_BOOT_DEADLINE_MS) * 1000;
+      slot->delay = APP_PROBE_DELAY_MS;
+      slot->state = ENGINE_STATE_PROBE;
+      ENGINE_Pause(slot, 0);
+      break;
+    case ENGINE_STATE_PROBE:
+      if (ok == true)
+      {
+        slot->started = true;
+        LOG_Print(LOG_LEVEL_INFO, "Bootloader ready after %u ms (%u probes)",
+                  (uint32_t)((usclock() - slot->power_on) / 1000), slot->probes);
+        slot->state = ENGINE_STATE_SETTLE;
+        ENGINE_Pause(slot, APP_PROBE_TIMEOUT_MS);
+        break;
+      }
+      if (usclock() >= slot->boot_deadline)
+      {
+        ENGINE_Fail(slot, "Unable to start bootloader");
+        break;
+      }
+      ENGINE_Pause(slot, slot->delay);
+      slot->delay *= 2;
+      if (slot->delay > APP_PROBE_MAX_DELAY)
+        slot->delay = APP_PROBE_MAX_DELAY;
+      break;
+    case ENGINE_STATE_INFO:
+      ENGINE_Info(e, slot, ok ? reply : NULL);
+      break;
+    case ENGINE_STATE_WRITE:
+      if ((ok == true) && (APP_CheckAck(s, reply, &e->fdata[slot->pos], slot->len) == false))
+        ok = false;
+      if (ok == false)
+      {
+        s->run.retries[s->fault]++;
+        /**< the unit falls back to single pages before the session is failed */
+        if ((APP_AdaptUnit(s, &slot->transfer, false) == false) && (++slot->errors >= s->profile->retries))
+        {
+          ENGINE_Fail(slot, "Problem flashing Hex file");
+          break;
+        }
+        PHY_Flush(&s->phy);
+        ENGINE_Pause(slot, s->profile->gap_ms);
+        break;
+      }
+      APP_AdaptUnit(s, &slot->transfer, true);
+      STATS_Page(&s->run, (uint32_t)(usclock() - slot->sent), slot->len / s->profile->page_size, slot->len);
+      slot->errors = 0;
+      slot->pos += slot->len;
+      ENGINE_Pause(slot, s->profile->page_ms + s->profile->gap_ms);
+      break;
+    case ENGINE_STATE_CHECK:
+      if (ok == false)
+      {
+        s->run.retries[(s->fault == STATS_CAUSE_TIMEOUT) ? STATS_CAUSE_TIMEOUT : STATS_CAUSE_MISMATCH]++;
+        if (++slot->errors >= s->profile->retries)
+        {
+          ENGINE_Fail(slot, "Hex file differs from the firmware");
+          break;
+        }
+        PHY_Flush(&s->phy);
+        ENGINE_Pause(slot, s->profile->gap_ms);
+        break;
+      }
+      slot->errors = 0;
+      s->run.pages_verified++;
+      slot->pos += s->profile->page_size;
+      ENGINE_Pause(slot, 0);
+      break;
+    case ENGINE_STATE_QUIT:
+      if ((ok == false) && (++slot->errors < s->profile->retries))
+      {
+        ENGINE_Pause(slot, 0);
+        break;
+      }
+      slot->state = ENGINE_STATE_DONE;
+      break;
+  }
+}
+
+/** \brief Read everything the port has and handle complete reply lines
+ *
+ * \param [in] e Engine
+ * \param [in,out] slot Session
+ * \param [in] events Port events
+ * \return Nothing
+ *
+ */
+static void ENGINE_Input(tEngine *e, tEngineSlot *slot, uint32_t events)
+{
+  char line[ENGINE_LINE_LEN];
+  bool fill = true;
+  int res;
+
+  while ((res = PHY_PollLine(&slot->s->phy, line, sizeof(line), APP_CMD_NL[0], fill)) != 0)
+  {
+    fill = false;
+    if (res < 0)
+    {
+      ENGINE_Fail(slot, "Port read error");
+      slot->state = ENGINE_STATE_DONE;
+      return;
+    }
+    /**< replies after a timeout or a failure are not for the current step */
+    if ((slot->waiting == false) || (slot->state == ENGINE_STATE_DONE))
+    {
+      LOG_Print(LOG_LEVEL_DEBUG, "RX %s (ignored)", line);
+      continue;
+    }
+    ENGINE_Reply(e, slot, line);
+  }
+  /**< unplugged adapter or closed connection, the port would report it on every wait */
+  if ((events & (EPOLLHUP | EPOLLERR | EPOLLRDHUP)) && (slot->state != ENGINE_STATE_DONE))
+  {
+    ENGINE_Fail(slot, "Port is closed");
+    slot->state = ENGINE_STATE_DONE;
+  }
+}
+
+/** \brief Register the session of a slot for its port events and start it
+ *
+ * \param [in] e Engine
+ * \param [in] epfd Epoll instance
+ * \param [in] k Slot number
+ * \return Nothing
+ *
+ */
+static void ENGINE_Start(tEngine *e, int epfd, uint16_t k)
+{
+  struct epoll_event ev;
+  tEngineSlot *slot = &e->slots[k];
+
+  ev.events = EPOLLIN | EPOLLRDHUP;
+  ev.data.u32 = k;
+  epoll_ctl(epfd, EPOLL_CTL_ADD, PHY_GetFd(&slot->s->phy), &ev);
+  slot->polled = true;
+  slot->state = ENGINE_STATE_IFACE;
+  ENGINE_Pause(slot, 0);
+}
+
+/** \brief Wait for port events until the nearest deadline and handle the received replies
+ *
+ * \param [in] e Engine
+ * \param [in] epfd Epoll instance
+ * \param [in] limit Latest wakeup in us on the usclock() scale, UINT64_MAX for none
+ * \param [in,out] stats Results of the run
+ * \param [in] sigmask Signal mask during the wait, NULL to keep the current one
+ * \return true if the watch descriptor has events
+ *
+ */
+static bool ENGINE_Wait(tEngine *e, int epfd, uint64_t limit, tEngineStats *stats, const sigset_t *sigmask)
+{
+  struct epoll_event events[ENGINE_EVENTS];
+  tEngineSlot *slot;
+  uint64_t next = limit;
+  uint64_t now;
+  int timeout;
+  int n, i;
+  uint16_t k;
+  bool watch = false;
+
+  /**< the nearest deadline of all sessions is the wait limit */
+  for (k = 0; k < e->cnt; k++)
+  {
+    if ((e->slots[k].state != ENGINE_STATE_DONE) && (e->slots[k].deadline != 0) && (e->slots[k].deadline < next))
+      next = e->slots[k].deadline;
+  }
+  now = usclock();
+  timeout = -1;
+  if (next != UINT64_MAX)
+    timeout = (next > now) ? (int)((next - now + 999) / 1000) : 0;
+  n = epoll_pwait(epfd, events, ENGINE_EVENTS, timeout, sigmask);
+  stats->wakeups++;
+  for (i = 0; i < n; i++)
+  {
+    if (events[i].data.u32 == ENGINE_WATCH_ID)
+    {
+      watch = true;
+      continue;
+    }
+    slot = &e->slots[events[i].data.u32];
+    LOG_SetContext(slot->s->id, slot->s->parameters.port, slot->s->parameters.bus_id);
+    ENGINE_Input(e, slot, events[i].events);
+  }
+
+  return watch;
+}
+
+/** \brief Continue all sessions whose deadline has passed and count the active ones
+ *
+ * \param [in] e Engine
+ * \param [in] epfd Epoll instance, ports of finished sessions are removed from it
+ * \return Nothing
+ *
+ */
+static void ENGINE_Service(tEngine *e, int epfd)
+{
+  tEngineSlot *slot;
+  uint64_t now = usclock();
+  uint16_t k;
+
+  e->active = 0;
+  for (k = 0; k < e->cnt; k++)
+  {
+    slot = &e->slots[k];
+    if (slot->s == NULL)
+      continue;
+    if ((slot->state != ENGINE_STATE_DONE) && (slot->deadline != 0) && (slot->deadline <= now))
+    {
+      LOG_SetContext(slot->s->id, slot->s->parameters.port, slot->s->parameters.bus_id);
+      slot->deadline = 0;
+      if (slot->waiting)
+        ENGINE_Reply(e, slot, NULL);
+      else
+        ENGINE_Step(e, slot);
+    }
+    if (slot->state != ENGINE_STATE_DONE)
+    {
+      e->active++;
+    } else if (slot->polled)
+    {
+      epoll_ctl(epfd, EPOLL_CTL_DEL, PHY_GetFd(&slot->s->phy), NULL);
+      slot->polled = false;
+    }
+  }
+}
+
+/** \brief Take over the result of a finished session
+ *
+ * \param [in,out] slot Finished session
+ * \param [in,out] stats Results of the run
+ * \return Nothing
+ *
+ */
+static void ENGINE_Result(tEngineSlot *slot, tEngineStats *stats)
+{
+  slot->s->run.failed = slot->failed;
+  slot->s->run.done = !slot->failed;
+  if (slot->failed == false)
+  {
+    stats->done++;
+    if (slot->s->parameters.write)
+      stats->bytes += (uint64_t)slot->s->pages * slot->s->profile->page_size;
+  }
+}
+
+/** \brief Run all sessions in one thread until all of them are finished
+ *
+ * \param [in] engine Engine with added sessions
+ * \param [out] stats Results of the run
+ * \return true if all sessions succeeded
+ *
+ */
+bool ENGINE_Run(tEngine *engine, tEngineStats *stats)
+{
+  uint64_t start;
+  int epfd;
+  uint16_t k;
+
+  memset(stats, 0, sizeof(tEngineStats));
+  stats->sessions = engine->cnt;
+  if ((epfd = epoll_create1(0)) < 0)
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "Unable to create epoll instance");
+    return false;
+  }
+  start = usclock();
+  for (k = 0; k < engine->cnt; k++)
+    ENGINE_Start(engine, epfd, k);
+  engine->active = engine->cnt;
+
+  while (engine->active > 0)
+  {
+    ENGINE_Wait(engine, epfd, UINT64_MAX, stats, NULL);
+    ENGINE_Service(engine, epfd);
+  }
+  stats->elapsed_us = usclock() - start;
+  close(epfd);
+
+  for (k = 0; k < engine->cnt; k++)
+    ENGINE_Result(&engine->slots[k], stats);
+  LOG_SetContext(0, "", -1);
+
+  return stats->done == stats->sessions;
+}
+
+/** \brief Close all ports and free the engine
+ *
+ * \param [in] engine Engine, may be NULL
+ * \return Nothing
+ *
+ */
+void ENGINE_Free(tEngine *engine)
+{
+  uint16_t k;
+
+  if (engine == NULL)
+    return;
+  for (k = 0; k < engine->cnt; k++)
+  {
+    if (engine->slots[k].s == NULL)
+      continue;
+    PHY_Close(&engine->slots[k].s->phy);
+    STATS_Add(&engine->slots[k].s->run, engine->slots[k].s->parameters.iface);
+    free(engine->slots[k].s);
+  }
+  free(engine);
+}
+
+/** \brief Load the image shared by all sessions
+ *
+ * \param [in] parameters Parameters with the image file name
+ * \param [out] len Image length
+ * \return image or NULL if failed
+ *
+ */
+static uint8_t *ENGINE_LoadImage(tParam *parameters, uint32_t *len)
+{
+  uint32_t maxlen = PROFILE_GetMaxFlash();
+  uint8_t *fdata;
+
+  if (STREAM_IsStream(parameters->file) || parameters->stream)
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "Streamed image can't be shared by several ports");
+    return NULL;
+  }
+  *len = 0;
+  if (((fdata = malloc(maxlen)) == NULL) || (APP_OpenFile(parameters->file, fdata, maxlen, len) == false))
+  {
+    free(fdata);
+    return NULL;
+  }
+
+  return fdata;
+}
+
+/** \brief Write and/or verify the image on all ports listed in a file
+ *
+ * \param [in] parameters Parameters, the same for all ports
+ * \param [in] filename Text file with one port name per line, '#' starts a comment
+ * \return true if all sessions succeeded
+ *
+ */
+bool ENGINE_RunFile(tParam *parameters, char *filename)
+{
+  tEngineStats stats;
+  tEngine *e = NULL;
+  uint8_t *fdata;
+  uint32_t len = 0;
+  char str[COMPORT_LEN * 2];
+  char *port;
+  FILE *fp;
+  bool res = false;
+
+  if ((fp = fopen(filename, "rt")) == NULL)
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "Unable to open file: %s", filename);
+    return false;
+  }
+  if (((fdata = ENGINE_LoadImage(parameters, &len)) == NULL) ||
+      ((e = ENGINE_Create(parameters, fdata, len)) == NULL))
+  {
+    fclose(fp);
+    free(fdata);
+    return false;
+  }
+  while (fgets(str, sizeof(str), fp) != NULL)
+  {
+    port = strtok(str, " \t\r\n");
+    if ((port == NULL) || (port[0] == '#'))
+      continue;
+    if (strlen(port) >= COMPORT_LEN)
+    {
+      LOG_Print(LOG_LEVEL_ERROR, "Port name is too long: %s", port);
+      break;
+    }
+    if (ENGINE_Add(e, port) == false)
+      break;
+  }
+  if (feof(fp) && (e->cnt > 0))
+  {
+    res = ENGINE_Run(e, &stats);
+    LOG_Print(LOG_LEVEL_LAST, "%u of %u sessions succeeded in %u.%03u s", stats.done, stats.sessions,
+              (uint32_t)(stats.elapsed_us / 1000000), (uint32_t)(stats.elapsed_us / 1000 % 1000));
+  }
+  fclose(fp);
+  ENGINE_Free(e);
+  free(fdata);
+
+  return res;
+}
+
+/** \brief Stop watching for new ports, the running sessions are finished
+ *
+ * \param [in] sig Signal number
+ * \return Nothing
+ *
+ */
+static void ENGINE_OnSignal(int sig)
+{
+  (void)sig;
+  ENGINE_Stop = 1;
+}
+
+/** \brief Check if a port has a running session
+ *
+ * \param [in] e Engine
+ * \param [in] port Port name
+ * \return true if the port is busy
+ *
+ */
+static bool ENGINE_IsBusy(tEngine *e, char *port)
+{
+  uint16_t k;
+
+  for (k = 0; k < e->cnt; k++)
+  {
+    if ((e->slots[k].s != NULL) && (strcmp(e->slots[k].s->parameters.port, port) == 0))
+      return true;
+  }
+
+  return false;
+}
+
+/** \brief Report a finished session in one line and free its slot
+ *
+ * \param [in] e Engine
+ * \param [in] epfd Epoll instance
+ * \param [in] k Slot number
+ * \param [in,out] stats Results of the run
+ * \return Nothing
+ *
+ */
+static void ENGINE_Release(tEngine *e, int epfd, uint16_t k, tEngineStats *stats)
+{
+  tEngineSlot *slot = &e->slots[k];
+  tSession *s = slot->s;
+  uint64_t us = usclock() - s->run.start_us;
+
+  ENGINE_Result(slot, stats);
+  LOG_SetContext(0, "", -1);
+  LOG_Print(LOG_LEVEL_LAST, "%s: %s in %u.%03u s (%u of %u boards succeeded)", s->parameters.port,
+            slot->failed ? "FAILED" : "done", (uint32_t)(us / 1000000), (uint32_t)(us / 1000 % 1000),
+            stats->done, stats->sessions);
+  if (slot->polled)
+    epoll_ctl(epfd, EPOLL_CTL_DEL, PHY_GetFd(&s->phy), NULL);
+  PHY_Close(&s->phy);
+  STATS_Add(&s->run, s->parameters.iface);
+  free(s);
+  memset(slot, 0, sizeof(tEngineSlot));
+  slot->state = ENGINE_STATE_DONE;
+}
+
+/** \brief Write and/or verify the image on every new port matching a pattern until interrupted
+ *
+ * The image is loaded once, a session is started as soon as a new node settled and
+ * runs concurrently with the others. SIGINT or SIGTERM stops watching, the running
+ * sessions are finished.
+ *
+ * \param [in] parameters Parameters, the same for all ports
+ * \param [in] pattern Shell pattern of the port nodes, e.g. /dev/ttyUSB*
+ * \return true if all sessions succeeded
+ *
+ */
+bool ENGINE_Watch(tParam *parameters, char *pattern)
+{
+  char pending[ENGINE_PENDING][COMPORT_LEN];
+  uint64_t due[ENGINE_PENDING];
+  uint16_t waiting = 0;
+  tEngineStats stats;
+  struct sigaction sa;
+  sigset_t stop_mask;
+  sigset_t wait_mask;
+  struct epoll_event ev;
+  tWatch w;
+  tEngine *e = NULL;
+  uint8_t *fdata;
+  uint32_t len = 0;
+  char port[COMPORT_LEN];
+  uint64_t limit;
+  int epfd;
+  int k;
+  uint16_t i;
+
+  memset(&stats, 0, sizeof(tEngineStats));
+  if ((fdata = ENGINE_LoadImage(parameters, &len)) == NULL)
+    return false;
+  if (((e = ENGINE_Create(parameters, fdata, len)) == NULL) || (WATCH_Open(&w, pattern) == false))
+  {
+    ENGINE_Free(e);
+    free(fdata);
+    return false;
+  }
+  if ((epfd = epoll_create1(0)) < 0)
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "Unable to create epoll instance");
+    WATCH_Close(&w);
+    ENGINE_Free(e);
+    free(fdata);
+    return false;
+  }
+  ev.events = EPOLLIN;
+  ev.data.u32 = ENGINE_WATCH_ID;
+  epoll_ctl(epfd, EPOLL_CTL_ADD, WATCH_GetFd(&w), &ev);
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = ENGINE_OnSignal;
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+  /**< the stop signals are taken only inside the wait, a signal can't slip in after the flag is checked */
+  sigemptyset(&stop_mask);
+  sigaddset(&stop_mask, SIGINT);
+  sigaddset(&stop_mask, SIGTERM);
+  sigprocmask(SIG_BLOCK, &stop_mask, &wait_mask);
+  sigdelset(&wait_mask, SIGINT);
+  sigdelset(&wait_mask, SIGTERM);
+  LOG_Print(LOG_LEVEL_LAST, "Waiting for new devices %s/%s, Ctrl+C to stop", w.dir, w.pattern);
+
+  while ((ENGINE_Stop == 0) || (e->active > 0))
+  {
+    limit = UINT64_MAX;
+    for (i = 0; i < waiting; i++)
+    {
+      if (due[i] < limit)
+        limit = due[i];
+    }
+    if (ENGINE_Wait(e, epfd, limit, &stats, &wait_mask) == true)
+    {
+      while (WATCH_Next(&w, port) == true)
+      {
+        for (i = 0; i < waiting; i++)
+        {
+          if (strcmp(pending[i], port) == 0)
+            break;
+        }
+        if ((i < waiting) || (ENGINE_IsBusy(e, port) == true))
+          continue;
+        if (waiting >= ENGINE_PENDING)
+        {
+          LOG_Print(LOG_LEVEL_WARNING, "Too many new devices at once, %s is ignored", port);
+          continue;
+        }
+        LOG_Print(LOG_LEVEL_INFO, "New device: %s", port);
+        strcpy(pending[waiting], port);
+        due[waiting++] = usclock() + (uint64_t)WATCH_SETTLE_MS * 1000;
+      }
+    }
+    /**< devices not started yet are left alone after the stop */
+    if (ENGINE_Stop != 0)
+      waiting = 0;
+    for (i = 0; i < waiting;)
+    {
+      if (due[i] > usclock())
+      {
+        i++;
+        continue;
+      }
+      stats.sessions++;
+      if ((k = ENGINE_Open(e, pending[i])) >= 0)
+      {
+        ENGINE_Start(e, epfd, (uint16_t)k);
+      } else
+      {
+        LOG_SetContext(0, "", -1);
+        LOG_Print(LOG_LEVEL_LAST, "%s: FAILED, port can't be opened (%u of %u boards succeeded)", pending[i],
+                  stats.done, stats.sessions);
+      }
+      if (i < --waiting)
+      {
+        strcpy(pending[i], pending[waiting]);
+        due[i] = due[waiting];
+      }
+    }
+    ENGINE_Service(e, epfd);
+    for (k = 0; k < e->cnt; k++)
+    {
+      if ((e->slots[k].s != NULL) && (e->slots[k].state == ENGINE_STATE_DONE))
+        ENGINE_Release(e, epfd, (uint16_t)k, &stats);
+    }
+  }
+
+  /**< a stop signal still pending is taken by the handler, not by the default action */
+  sigprocmask(SIG_UNBLOCK, &stop_mask, NULL);
+  sa.sa_handler = SIG_DFL;
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+  close(epfd);
+  WATCH_Close(&w);
+  ENGINE_Free(e);
+  free(fdata);
+  LOG_Print(LOG_LEVEL_LAST, "%u of %u boards succeeded", stats.done, stats.sessions);
+
+  return stats.done == stats.sessions;
+}
+#endif
@@ -0,0 +1,31 @@
+#ifndef ENGINE_H
+#define ENGINE_H
+
+#include "defines.h"
+
+#define ENGINE_MAX_SESSIONS   (1024)
+#define ENGINE_EVENTS         (64)
+
+/**< results of one run of the engine */
+typedef struct
+{
+  uint16_t  sessions;
+  uint16_t  done;           /**< sessions finished successfully */
+  uint64_t  elapsed_us;
+  uint64_t  bytes;          /**< image bytes written by all sessions */
+  uint32_t  wakeups;        /**< returns from epoll_wait() */
+} tEngineStats;
+
+typedef struct tEngine tEngine;
+
+#ifdef __linux
+tEngine *ENGINE_Create(tParam *parameters, uint8_t *fdata, uint32_t len);
+bool ENGINE_Add(tEngine *engine, char *port);
+int ENGINE_GetPeer(tEngine *engine, uint16_t n);
+bool ENGINE_Run(tEngine *engine, tEngineStats *stats);
+void ENGINE_Free(tEngine *engine);
+bool ENGINE_RunFile(tParam *parameters, char *filename);
+bool ENGINE_Watch(tParam *parameters, char *pattern);
+#endif
+
+#endif
@@ -7,8 +7,6 @@ tInterface IFACES_List[] =
   {"CAN",   2},
 };
 
-static int8_t IFACE_Id = IFACE_UNKNOWN_ID;
-
 /** \brief Get device ID from name string
  *
  * \param [in] name Name to find as string
@@ -22,14 +20,10 @@ int8_t IFACES_GetId(char *name)
   for (i = 0; i < sizeof(IFACES_List) / sizeof(tInterface); i++)
   {
     if (strcmp(name, IFACES_List[i].name) == 0)
-    {
-      IFACE_Id = i;
       return i;
-    }
   }
 
-  IFACE_Id = IFACE_UNKNOWN_ID;
-  return -1;
+  return IFACE_UNKNOWN_ID;
 }
 
 /** \brief Get number of devices in the list
@@ -3,82 +3,102 @@
 #include <string.h>
 #include "ihex.h"
 
-static uint8_t crc;
+/**< hex digits of a nibble */
+static const char IHEX_Digits[16] = {'0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'A', 'B', 'C', 'D', 'E', 'F'};
 
-/** \brief Convert byte to string with HEX representation
+/** \brief Put HEX representation of byte to the buffer
  *
+ * \param [out] p Position in the buffer
  * \param [in] byte One byte of data
- * \return HEX representation as string
+ * \param [in,out] crc Checksum of the record
+ * \return position after the byte
  *
  */
-static char* IHEX_AddByte(uint8_t byte)
+static char *IHEX_PutByte(char *p, uint8_t byte, uint8_t *crc)
 {
-  static char res[3];
+  *crc = (uint8_t)(*crc + byte);
+  p[0] = IHEX_Digits[byte >> 4];
+  p[1] = IHEX_Digits[byte & 0x0FU];
 
-  crc += byte;
-  uint8_t n = (byte & 0xF0U) >> 4; // high nybble
-  res[0] = IHEX_DIGIT(n);
-  n = byte & 0x0FU; // low nybble
-  res[1] = IHEX_DIGIT(n);
-  res[2] = 0;
-
-  return res;
+  return p + 2;
 }
 
-/** \brief Write Intel HEX ending to a file
+/** \brief Put complete record with checksum and line end to the buffer
  *
- * \param [in] fp File handle
- * \return true if succeed
+ * \param [out] p Position in the buffer, IHEX_MAX_STRING bytes must be free
+ * \param [in] type Record type
+ * \param [in] addr 16-bit record address
+ * \param [in] data Record data
+ * \param [in] len Length of data
+ * \return position after the record
  *
  */
-bool IHEX_WriteEnd(FILE *fp)
+static char *IHEX_PutRecord(char *p, uint8_t type, uint16_t addr, uint8_t *data, uint8_t len)
 {
-  fwrite(IHEX_ENDFILE, strlen(IHEX_ENDFILE), 1, fp);
-  fwrite(IHEX_NEWLINE, strlen(IHEX_NEWLINE), 1, fp);
-  return true;
+  uint8_t crc = 0;
+  uint8_t i;
+
+  *p++ = IHEX_START[0];
+  p = IHEX_PutByte(p, len, &crc);
+  p = IHEX_PutByte(p, (uint8_t)(addr >> 8), &crc);
+  p = IHEX_PutByte(p, (uint8_t)addr, &crc);
+  p = IHEX_PutByte(p, type, &crc);
+  for (i = 0; i < len; i++)
+    p = IHEX_PutByte(p, data[i], &crc);
+  p = IHEX_PutByte(p, (uint8_t)(0x100 - crc), &crc);
+  *p++ = IHEX_NEWLINE[0];
+
+  return p;
 }
 
-/** \brief Write data buffer to HEX file
+/** \brief Write data buffer to HEX file, extended linear address records are added
+ * when the upper 16 bits of the address change
  *
  * \param [in] fp File handle
  * \param [in] data Data buffer to write
  * \param [in] len Length of data buffer
+ * \param [in] base Address of the first byte
  * \return error code as uint8_t
  *
  */
-uint8_t IHEX_WriteFile(FILE *fp, uint8_t *data, uint16_t len)
+uint8_t IHEX_WriteFile(FILE *fp, uint8_t *data, uint32_t len, uint32_t base)
 {
-  uint16_t i;
-  uint8_t x;
+  char buf[IHEX_WRITE_BUF];
+  char *p = buf;
+  uint8_t upper[2];
+  uint32_t segment = 0;
+  uint32_t addr;
+  uint32_t i;
   uint8_t width;
-  char str[128];
 
-  crc = 0;
-  for (i = 0; i < len; i += IHEX_LINE_LENGTH)
+  for (i = 0; i < len; i += width)
   {
-    strcpy(str, IHEX_START);
-    // write length
-    if (len - i >= IHEX_LINE_LENGTH)
-      width = IHEX_LINE_LENGTH;
-    else
+    addr = base + i;
+    width = IHEX_LINE_LENGTH;
+    if (len - i < width)
       width = (uint8_t)(len - i);
-    strcat(str, IHEX_AddByte(width));
-    // write address
-    strcat(str, IHEX_AddByte((uint8_t)(i >> 8)));
-    strcat(str, IHEX_AddByte((uint8_t)i));
-    // write type (data)
-    strcat(str, IHEX_AddByte(IHEX_DATA_RECORD));
-    for (x = 0; x < width; x++)
+    /**< a line never crosses a 64 KB boundary */
+    if ((addr & 0xFFFFU) + width > 0x10000UL)
+      width = (uint8_t)(0x10000UL - (addr & 0xFFFFU));
+    if ((addr >> 16) != segment)
+    {
+      segment = addr >> 16;
+      upper[0] = (uint8_t)(segment >> 8);
+      upper[1] = (uint8_t)segment;
+      p = IHEX_PutRecord(p, IHEX_EXTENDED_LINEAR_ADDRESS_RECORD, 0, upper, sizeof(upper));
+    }
+    p = IHEX_PutRecord(p, IHEX_DATA_RECORD, (uint16_t)addr, &data[i], width);
+    /**< the buffer always has room for two more lines */
+    if (p - buf > IHEX_WRITE_BUF - 2 * IHEX_MAX_STRING)
     {
-      strcat(str, IHEX_AddByte(*data++));
+      if (fwrite(buf, p - buf, 1, fp) != 1)
+        return IHEX_ERROR_FILE;
+      p = buf;
     }
-    crc = (uint8_t)(0x100 - crc);
-    strcat(str, IHEX_AddByte(crc));
-    strcat(str, IHEX_NEWLINE);
-    fwrite(str, strlen(str), 1, fp);
-    crc = 0;
   }
-  IHEX_WriteEnd(fp);
+  p = IHEX_PutRecord(p, IHEX_END_OF_FILE_RECORD, 0, NULL, 0);
+  if (fwrite(buf, p - buf, 1, fp) != 1)
+    return IHEX_ERROR_FILE;
 
   return IHEX_ERROR_NONE;
 }
@@ -114,6 +134,63 @@ uint8_t IHEX_GetByte(char *data)
   return res;
 }
 
+/** \brief Decode one line of Hex file
+ *
+ * \param [in,out] str Line of Hex file, whitespace on the right is removed
+ * \param [out] rec Decoded record
+ * \return error code as uint8_t
+ *
+ */
+uint8_t IHEX_ParseRecord(char *str, tIhexRecord *rec)
+{
+  uint8_t i;
+  char *end;
+
+  // trim whitespace on the right
+  end = str + strlen(str) - 1;
+  while (end > str && isspace((unsigned char) *end)) end--;
+  end[1] = '\0';
+  if (strlen(str) < IHEX_MIN_STRING)
+    return IHEX_ERROR_FMT;
+  rec->len = IHEX_GetByte(&str[IHEX_OFFS_LEN]);
+  rec->addr = (uint16_t)((IHEX_GetByte(&str[IHEX_OFFS_ADDR]) << 8) + IHEX_GetByte(&str[IHEX_OFFS_ADDR + 2]));
+  rec->type = IHEX_GetByte(&str[IHEX_OFFS_TYPE]);
+  if (rec->len * 2 + IHEX_MIN_STRING != strlen(str))
+    return IHEX_ERROR_FMT;
+  for (i = 0; i < rec->len; i++)
+    rec->data[i] = IHEX_GetByte(&str[IHEX_OFFS_DATA + i * 2]);
+
+  return IHEX_ERROR_NONE;
+}
+
+/** \brief Take upper address bits from extended linear address record
+ *
+ * A linear address before the first data record is the start of the image, so
+ * images linked for flash at a high address (e.g. 0x08000000) are loaded from 0.
+ *
+ * \param [in] rec Extended linear address record
+ * \param [in] origin true if no data record was read yet
+ * \param [in,out] base Upper address bits of the image start
+ * \param [out] segment Offset of the following records from the image start
+ * \return error code as uint8_t
+ *
+ */
+uint8_t IHEX_GetLinear(tIhexRecord *rec, bool origin, uint32_t *base, uint32_t *segment)
+{
+  uint32_t upper;
+
+  if (rec->len != 2)
+    return IHEX_ERROR_FMT;
+  upper = (uint32_t)((rec->data[0] << 8) + rec->data[1]) << 16;
+  if (origin)
+    *base = upper;
+  if (upper < *base)
+    return IHEX_ERROR_SIZE;
+  *segment = upper - *base;
+
+  return IHEX_ERROR_NONE;
+}
+
 /** \brief Read Intel HEX file to a binary memory buffer
  *
  * \param [in] fp File handler
@@ -125,58 +202,54 @@ uint8_t IHEX_GetByte(char *data)
  */
 uint8_t IHEX_ReadFile(FILE *fp, uint8_t *data, uint32_t maxlen, uint32_t *max_addr)
 {
+  tIhexRecord rec;
   uint32_t addr;
   uint32_t first_addr;
-  uint8_t len;
-  uint8_t type;
-  uint16_t segment;
+  uint32_t segment;
+  uint32_t base = 0;
+  bool origin = true;
+  uint8_t res;
   uint8_t i;
-  uint8_t byte;
-  char str[128];
-  char *end;
+  char str[IHEX_MAX_STRING];
 
-  addr = 0;
   segment = 0;
-  first_addr = 0;
   first_addr = UINT32_MAX;
   while (!feof(fp))
   {
     if (fgets(str, sizeof(str), fp) == NULL)
       return IHEX_ERROR_FILE;
-    // trim whitespace on the right
-    end = str + strlen(str) - 1;
-    while (end > str && isspace((unsigned char) *end)) end--;
-    end[1] = '\0';
-    if (strlen(str) < IHEX_MIN_STRING)
-      return IHEX_ERROR_FMT;
-    len = IHEX_GetByte(&str[IHEX_OFFS_LEN]);
-    addr = (IHEX_GetByte(&str[IHEX_OFFS_ADDR]) << 8) + IHEX_GetByte(&str[IHEX_OFFS_ADDR + 2]);
-    if (addr + segment >= maxlen)
+    if ((res = IHEX_ParseRecord(str, &rec)) != IHEX_ERROR_NONE)
+      return res;
+    if (rec.addr + segment >= maxlen)
       return IHEX_ERROR_SIZE;
     if (first_addr == UINT32_MAX)
-      first_addr = addr;
-    type = IHEX_GetByte(&str[IHEX_OFFS_TYPE]);
-    if (len * 2 + IHEX_MIN_STRING != strlen(str))
-      return IHEX_ERROR_FMT;
-    switch (type)
+      first_addr = rec.addr;
+    switch (rec.type)
     {
       case IHEX_DATA_RECORD:
-        for (i = 0; i < len; i++)
+        origin = false;
+        addr = rec.addr + segment - first_addr;
+        if (addr + rec.len > maxlen)
+          return IHEX_ERROR_SIZE;
+        for (i = 0; i < rec.len; i++)
         {
-          byte = IHEX_GetByte(&str[IHEX_OFFS_DATA + i * 2]);
-          if (byte != 0xFF)
-            *max_addr = addr + segment + i + 1 - first_addr;
-          data[addr + segment + i - first_addr] = byte;
+          if ((rec.data[i] != 0xFF) && (addr + i + 1 > *max_addr))
+            *max_addr = addr + i + 1;
+          data[addr + i] = rec.data[i];
         }
         break;
       case IHEX_END_OF_FILE_RECORD:
         return IHEX_ERROR_NONE;
       case IHEX_EXTENDED_SEGMENT_ADDRESS_RECORD:
-        segment = ((IHEX_GetByte(&str[IHEX_OFFS_DATA]) << 8) + IHEX_GetByte(&str[IHEX_OFFS_DATA + 2])) << 4;
+        if (rec.len != 2)
+          return IHEX_ERROR_FMT;
+        segment = (uint32_t)((rec.data[0] << 8) + rec.data[1]) << 4;
         break;
       case IHEX_START_SEGMENT_ADDRESS_RECORD:
         break;
       case IHEX_EXTENDED_LINEAR_ADDRESS_RECORD:
+        if ((res = IHEX_GetLinear(&rec, origin, &base, &segment)) != IHEX_ERROR_NONE)
+          return res;
         break;
       case IHEX_START_LINEAR_ADDRESS_RECORD:
         break;
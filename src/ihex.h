@@ -7,6 +7,9 @@
 
 #define IHEX_LINE_LENGTH    16
 #define IHEX_MIN_STRING     11
+#define IHEX_MAX_DATA       255
+#define IHEX_MAX_STRING     (IHEX_MIN_STRING + IHEX_MAX_DATA * 2 + 3)
+#define IHEX_WRITE_BUF      (8192)
 
 #define IHEX_OFFS_LEN       1
 #define IHEX_OFFS_ADDR      3
@@ -34,9 +37,18 @@ enum {
   IHEX_ERROR_CRC
 };
 
-#define IHEX_DIGIT(n) ((char)((n) + (((n) < 10) ? '0' : ('A' - 10))))
-
-uint8_t IHEX_WriteFile(FILE *fp, uint8_t *data, uint16_t len);
+/**< one decoded line of the Hex file */
+typedef struct
+{
+  uint8_t   len;
+  uint16_t  addr;
+  uint8_t   type;
+  uint8_t   data[IHEX_MAX_DATA];
+} tIhexRecord;
+
+uint8_t IHEX_WriteFile(FILE *fp, uint8_t *data, uint32_t len, uint32_t base);
+uint8_t IHEX_ParseRecord(char *str, tIhexRecord *rec);
+uint8_t IHEX_GetLinear(tIhexRecord *rec, bool origin, uint32_t *base, uint32_t *segment);
 uint8_t IHEX_ReadFile(FILE *fp, uint8_t *data, uint32_t maxlen, uint32_t *max_addr);
 
 #endif
@@ -0,0 +1,165 @@
+#include <stdlib.h>
+#include "ifaces.h"
+#include "journal.h"
+#include "log.h"
+
+#define JOURNAL_PATH_LEN    (FILENAME_LEN + JOURNAL_TARGET_LEN)
+
+/** \brief Build journal file name for the target
+ *
+ * \param [in] jrn Journal
+ * \param [out] path Buffer for the file name (JOURNAL_PATH_LEN bytes)
+ * \return Nothing
+ *
+ */
+static void JOURNAL_GetPath(tJournal *jrn, char *path)
+{
+  char name[JOURNAL_TARGET_LEN];
+  char *dir;
+  uint16_t i;
+
+  /**< port names like /dev/ttyUSB0 or \\.\COM25 are not valid file names */
+  for (i = 0; jrn->target[i] != 0; i++)
+  {
+    if (isalnum((unsigned char)jrn->target[i]) || jrn->target[i] == '-')
+      name[i] = jrn->target[i];
+    else
+      name[i] = '_';
+  }
+  name[i] = 0;
+
+  dir = getenv("MSPROG_JOURNAL_DIR");
+  if (dir == NULL || dir[0] == 0)
+    dir = ".";
+  snprintf(path, JOURNAL_PATH_LEN, "%s/msprog-%s.jrn", dir, name);
+}
+
+/** \brief Initialize journal for the current target and image
+ *
+ * \param [out] jrn Journal to initialize
+ * \param [in] parameters Application parameters (port, interface, bus ID)
+ * \param [in] hash CRC32 of the firmware image
+ * \param [in] pages Number of pages in the image
+ * \return Nothing
+ *
+ */
+void JOURNAL_Init(tJournal *jrn, tParam *parameters, uint32_t hash, uint16_t pages)
+{
+  memset(jrn, 0, sizeof(tJournal));
+  snprintf(jrn->target, JOURNAL_TARGET_LEN, "%s-%s-%d", parameters->port,
+           IFACES_GetNameByNumber((uint8_t)parameters->iface), parameters->bus_id);
+  jrn->hash = hash;
+  jrn->pages = pages;
+}
+
+/** \brief Load journal from disk, it is accepted only if target and image are the same
+ *
+ * \param [in,out] jrn Initialized journal, confirmed page counter is loaded
+ * \return true if a matching journal was found
+ *
+ */
+bool JOURNAL_Load(tJournal *jrn)
+{
+  char path[JOURNAL_PATH_LEN];
+  char str[JOURNAL_TARGET_LEN + 16];
+  char target[JOURNAL_TARGET_LEN];
+  unsigned int hash = 0;
+  unsigned int pages = 0;
+  unsigned int confirmed = 0;
+  FILE *fp;
+
+  JOURNAL_GetPath(jrn, path);
+  if ((fp = fopen(path, "rt")) == NULL)
+    return false;
+
+  target[0] = 0;
+  if ((fgets(str, sizeof(str), fp) == NULL) || (strncmp(str, JOURNAL_HEADER, strlen(JOURNAL_HEADER)) != 0))
+  {
+    fclose(fp);
+    LOG_Print(LOG_LEVEL_WARNING, "Journal %s has wrong format, ignoring", path);
+    return false;
+  }
+  while (fgets(str, sizeof(str), fp) != NULL)
+  {
+    if (strncmp(str, "target ", 7) == 0)
+    {
+      strncpy(target, &str[7], JOURNAL_TARGET_LEN);
+      target[JOURNAL_TARGET_LEN - 1] = 0;
+      target[strcspn(target, "\r\n")] = 0;
+    }
+    sscanf(str, "hash %x", &hash);
+    sscanf(str, "pages %u", &pages);
+    sscanf(str, "confirmed %u", &confirmed);
+  }
+  fclose(fp);
+
+  if (strcmp(target, jrn->target) != 0)
+    return false;
+  if ((hash != jrn->hash) || (pages != jrn->pages))
+  {
+    LOG_Print(LOG_LEVEL_INFO, "Journal belongs to another image, starting from scratch");
+    return false;
+  }
+  if (confirmed > pages)
+    confirmed = pages;
+  jrn->confirmed = (uint16_t)confirmed;
+  jrn->saved = jrn->confirmed;
+
+  return true;
+}
+
+/** \brief Write journal to disk
+ *
+ * \param [in] jrn Journal
+ * \return true if succeed
+ *
+ */
+bool JOURNAL_Save(tJournal *jrn)
+{
+  char path[JOURNAL_PATH_LEN];
+  FILE *fp;
+
+  JOURNAL_GetPath(jrn, path);
+  if ((fp = fopen(path, "wt")) == NULL)
+  {
+    LOG_Print(LOG_LEVEL_WARNING, "Unable to write journal: %s", path);
+    return false;
+  }
+  fprintf(fp, "%s\n", JOURNAL_HEADER);
+  fprintf(fp, "target %s\n", jrn->target);
+  fprintf(fp, "hash %08X\n", jrn->hash);
+  fprintf(fp, "pages %u\n", jrn->pages);
+  fprintf(fp, "confirmed %u\n", jrn->confirmed);
+  fclose(fp);
+  jrn->saved = jrn->confirmed;
+
+  return true;
+}
+
+/** \brief Update number of confirmed pages, checkpoint is written every JOURNAL_CHECKPOINT_PAGES
+ *
+ * \param [in] jrn Journal
+ * \param [in] confirmed Number of pages confirmed from the beginning of the image
+ * \return Nothing
+ *
+ */
+void JOURNAL_Confirm(tJournal *jrn, uint16_t confirmed)
+{
+  jrn->confirmed = confirmed;
+  if (jrn->confirmed - jrn->saved >= JOURNAL_CHECKPOINT_PAGES)
+    JOURNAL_Save(jrn);
+}
+
+/** \brief Remove journal after the image was completely written
+ *
+ * \param [in] jrn Journal
+ * \return Nothing
+ *
+ */
+void JOURNAL_Remove(tJournal *jrn)
+{
+  char path[JOURNAL_PATH_LEN];
+
+  JOURNAL_GetPath(jrn, path);
+  remove(path);
+}
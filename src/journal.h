@@ -0,0 +1,26 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include "defines.h"
+
+#define JOURNAL_TARGET_LEN        (COMPORT_LEN + 16)
+#define JOURNAL_CHECKPOINT_PAGES  (8)
+
+#define JOURNAL_HEADER            "MSPROG-JOURNAL 1"
+
+typedef struct
+{
+  char      target[JOURNAL_TARGET_LEN];
+  uint32_t  hash;
+  uint16_t  pages;
+  uint16_t  confirmed;
+  uint16_t  saved;
+} tJournal;
+
+void JOURNAL_Init(tJournal *jrn, tParam *parameters, uint32_t hash, uint16_t pages);
+bool JOURNAL_Load(tJournal *jrn);
+bool JOURNAL_Save(tJournal *jrn);
+void JOURNAL_Confirm(tJournal *jrn, uint16_t confirmed);
+void JOURNAL_Remove(tJournal *jrn);
+
+#endif
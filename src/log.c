@@ -1,8 +1,176 @@
 #include <stdio.h>
 #include <stdarg.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#ifdef __linux
+#include <signal.h>
+#endif
 #include "log.h"
+#include "sleep.h"
 
-static uint8_t LOG_Level = LOG_LEVEL_ERROR;
+typedef struct
+{
+  atomic_uint  seq;
+  uint8_t      level;
+  int8_t       bus_id;
+  uint32_t     session;
+  uint64_t     time_us;
+  char         port[LOG_PORT_LEN];
+  char         msg[LOG_MSG_LEN];
+} tLogRecord;
+
+typedef struct
+{
+  uint32_t     session;
+  int8_t       bus_id;
+  char         port[LOG_PORT_LEN];
+} tLogContext;
+
+static volatile uint8_t LOG_Level = LOG_LEVEL_ERROR;
+
+/**< bounded MPSC ring: producers claim slots with CAS, the writer thread drains them */
+static tLogRecord LOG_Ring[LOG_RING_SIZE];
+static atomic_uint LOG_Head;
+static unsigned int LOG_Tail;
+static atomic_uint LOG_Dropped;
+static atomic_bool LOG_Running;
+static pthread_t LOG_Thread;
+static pthread_mutex_t LOG_Mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t LOG_Cond = PTHREAD_COND_INITIALIZER;
+static atomic_bool LOG_Idle;      /**< writer waits for the ring to get a record */
+static FILE *LOG_File;
+static uint8_t LOG_Format = LOG_FORMAT_CONSOLE;
+static uint64_t LOG_StartUs;
+
+static __thread tLogContext LOG_Context = {0, -1, ""};
+
+static const char *LOG_LevelNames[] = {"DEBUG", "INFO", "WARNING", "ERROR", ""};
+
+/** \brief Write one record in the selected format
+ *
+ * \param [in] fp Output stream
+ * \param [in] rec Log record
+ * \return Nothing
+ *
+ */
+static void LOG_Write(FILE *fp, tLogRecord *rec)
+{
+  uint64_t t = rec->time_us - LOG_StartUs;
+  char *ch;
+
+  switch (LOG_Format)
+  {
+    case LOG_FORMAT_CONSOLE:
+      if (rec->level < LOG_LEVEL_LAST)
+        fprintf(fp, "%s: ", LOG_LevelNames[rec->level]);
+      fprintf(fp, "%s\n", rec->msg);
+      break;
+    case LOG_FORMAT_TEXT:
+      fprintf(fp, "[%6u.%06u] %-7s s=%u port=%s id=%d: %s\n", (uint32_t)(t / 1000000), (uint32_t)(t % 1000000),
+              LOG_LevelNames[rec->level], rec->session, rec->port, rec->bus_id, rec->msg);
+      break;
+    case LOG_FORMAT_JSON:
+      fprintf(fp, "{\"t_us\":%llu,\"level\":\"%s\",\"session\":%u,\"port\":\"", (unsigned long long)t,
+              (rec->level < LOG_LEVEL_LAST) ? LOG_LevelNames[rec->level] : "NOTICE", rec->session);
+      for (ch = rec->port; *ch; ch++)
+        fprintf(fp, (*ch == '"' || *ch == '\\') ? "\\%c" : "%c", *ch);
+      fprintf(fp, "\",\"bus_id\":%d,\"msg\":\"", rec->bus_id);
+      for (ch = rec->msg; *ch; ch++)
+      {
+        if (*ch == '"' || *ch == '\\')
+          fprintf(fp, "\\%c", *ch);
+        else if ((unsigned char)*ch < 0x20)
+          fprintf(fp, "\\u%04x", (unsigned char)*ch);
+        else
+          fputc(*ch, fp);
+      }
+      fprintf(fp, "\"}\n");
+      break;
+  }
+}
+
+/** \brief Write all records available in the ring
+ *
+ * \return number of written records
+ *
+ */
+static uint32_t LOG_Drain(void)
+{
+  tLogRecord *rec;
+  tLogRecord local;
+  uint32_t cnt = 0;
+  unsigned int dropped;
+
+  while (1)
+  {
+    rec = &LOG_Ring[LOG_Tail & (LOG_RING_SIZE - 1)];
+    if (atomic_load_explicit(&rec->seq, memory_order_acquire) != LOG_Tail + 1)
+      break;
+    LOG_Write(LOG_File, rec);
+    atomic_store_explicit(&rec->seq, LOG_Tail + LOG_RING_SIZE, memory_order_release);
+    LOG_Tail++;
+    cnt++;
+  }
+  dropped = atomic_exchange(&LOG_Dropped, 0);
+  if (dropped > 0)
+  {
+    memset(&local, 0, sizeof(local));
+    local.level = LOG_LEVEL_WARNING;
+    local.bus_id = -1;
+    local.time_us = usclock();
+    snprintf(local.msg, LOG_MSG_LEN, "%u log records dropped", dropped);
+    LOG_Write(LOG_File, &local);
+    cnt++;
+  }
+  if (cnt > 0)
+    fflush(LOG_File);
+
+  return cnt;
+}
+
+/** \brief Background writer thread
+ *
+ * \param [in] arg Not used
+ * \return NULL
+ *
+ */
+static void *LOG_Writer(void *arg)
+{
+  tLogRecord *rec;
+
+  (void)arg;
+  while (atomic_load(&LOG_Running))
+  {
+    if (LOG_Drain() > 0)
+      continue;
+    /**< the ring is checked again after the idle flag is visible, a record published before is not missed */
+    pthread_mutex_lock(&LOG_Mutex);
+    atomic_store(&LOG_Idle, true);
+    rec = &LOG_Ring[LOG_Tail & (LOG_RING_SIZE - 1)];
+    if ((atomic_load(&rec->seq) != LOG_Tail + 1) && (atomic_load(&LOG_Dropped) == 0) && atomic_load(&LOG_Running))
+      pthread_cond_wait(&LOG_Cond, &LOG_Mutex);
+    atomic_store(&LOG_Idle, false);
+    pthread_mutex_unlock(&LOG_Mutex);
+  }
+  LOG_Drain();
+
+  return NULL;
+}
+
+/** \brief Wake the writer thread if it waits for records
+ *
+ * \return Nothing
+ *
+ */
+static void LOG_Wake(void)
+{
+  if (atomic_load(&LOG_Idle) == false)
+    return;
+  pthread_mutex_lock(&LOG_Mutex);
+  pthread_cond_signal(&LOG_Cond);
+  pthread_mutex_unlock(&LOG_Mutex);
+}
 
 /** \brief Print log message according level settings
  *
@@ -15,31 +183,63 @@ static uint8_t LOG_Level = LOG_LEVEL_ERROR;
 void LOG_Print(uint8_t level, char *msg, ...)
 {
   va_list args;
+  tLogRecord *rec;
+  tLogRecord local;
+  unsigned int pos = 0;
+  int diff;
+  size_t len;
 
   if (level < LOG_Level)
     return;
 
-  switch (level)
+  rec = &local;
+  if (atomic_load_explicit(&LOG_Running, memory_order_relaxed))
   {
-    case LOG_LEVEL_INFO:
-      printf("INFO: ");
-      break;
-    case LOG_LEVEL_WARNING:
-      printf("WARNING: ");
-      break;
-    case LOG_LEVEL_ERROR:
-      printf("ERROR: ");
-      break;
-    case LOG_LEVEL_LAST:
-      break;
+    pos = atomic_load_explicit(&LOG_Head, memory_order_relaxed);
+    while (1)
+    {
+      rec = &LOG_Ring[pos & (LOG_RING_SIZE - 1)];
+      diff = (int)(atomic_load_explicit(&rec->seq, memory_order_acquire) - pos);
+      if (diff == 0)
+      {
+        if (atomic_compare_exchange_weak_explicit(&LOG_Head, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed))
+          break;
+      } else if (diff < 0)
+      {
+        /**< ring is full, never block the caller */
+        atomic_fetch_add(&LOG_Dropped, 1);
+        LOG_Wake();
+        return;
+      } else
+      {
+        pos = atomic_load_explicit(&LOG_Head, memory_order_relaxed);
+      }
+    }
   }
+
+  rec->level = level;
+  rec->time_us = usclock();
+  rec->session = LOG_Context.session;
+  rec->bus_id = LOG_Context.bus_id;
+  memcpy(rec->port, LOG_Context.port, LOG_PORT_LEN);
   va_start(args, msg);
-  vprintf(msg, args);
+  vsnprintf(rec->msg, LOG_MSG_LEN, msg, args);
   va_end(args);
-  printf("\n");
+  len = strlen(rec->msg);
+  while (len > 0 && rec->msg[len - 1] == '\n')
+    rec->msg[--len] = 0;
+
+  if (rec == &local)
+  {
+    LOG_Write(stdout, rec);
+  } else
+  {
+    atomic_store(&rec->seq, pos + 1);
+    LOG_Wake();
+  }
 }
 
-/** \brief Set log level (INFO/WARNING/ERROR)
+/** \brief Set log level (DEBUG/INFO/WARNING/ERROR)
  *
  * \param [in] level New level for the log
  * \return Nothing
@@ -51,3 +251,110 @@ void LOG_SetLevel(uint8_t level)
     return;
   LOG_Level = level;
 }
+
+/** \brief Set context of the calling thread which is added to every record
+ *
+ * \param [in] session Session number
+ * \param [in] port Port name
+ * \param [in] bus_id Bus ID of the device or -1
+ * \return Nothing
+ *
+ */
+void LOG_SetContext(uint32_t session, char *port, int8_t bus_id)
+{
+  LOG_Context.session = session;
+  LOG_Context.bus_id = bus_id;
+  strncpy(LOG_Context.port, port, LOG_PORT_LEN);
+  LOG_Context.port[LOG_PORT_LEN - 1] = 0;
+}
+
+/** \brief Start background writer
+ *
+ * \param [in] file Log file name or NULL for stdout
+ * \param [in] format Output format (LOG_FORMAT_xxx)
+ * \return true if succeed
+ *
+ */
+bool LOG_Start(char *file, uint8_t format)
+{
+  unsigned int i;
+  int res;
+  #ifdef __linux
+  sigset_t all;
+  sigset_t old;
+  #endif
+
+  LOG_File = stdout;
+  if ((file != NULL) && (file[0] != 0))
+  {
+    if ((LOG_File = fopen(file, "at")) == NULL)
+    {
+      LOG_File = stdout;
+      LOG_Print(LOG_LEVEL_ERROR, "Unable to open log file: %s", file);
+      return false;
+    }
+  }
+  LOG_Format = format;
+  LOG_StartUs = usclock();
+  for (i = 0; i < LOG_RING_SIZE; i++)
+    atomic_init(&LOG_Ring[i].seq, i);
+  atomic_store(&LOG_Head, 0);
+  LOG_Tail = 0;
+  atomic_store(&LOG_Running, true);
+  #ifdef __linux
+  /**< signals are handled by the main thread only, the writer inherits a mask blocking them all */
+  sigfillset(&all);
+  pthread_sigmask(SIG_BLOCK, &all, &old);
+  #endif
+  res = pthread_create(&LOG_Thread, NULL, LOG_Writer, NULL);
+  #ifdef __linux
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+  #endif
+  if (res != 0)
+  {
+    atomic_store(&LOG_Running, false);
+    return false;
+  }
+
+  return true;
+}
+
+/** \brief Wait until all queued records are written
+ *
+ * \return Nothing
+ *
+ */
+void LOG_Flush(void)
+{
+  unsigned int head;
+
+  if (atomic_load_explicit(&LOG_Running, memory_order_relaxed) == false)
+    return;
+  head = atomic_load(&LOG_Head);
+  /**< last claimed slot is written when its sequence moves to the next lap */
+  while ((int)(atomic_load_explicit(&LOG_Ring[(head - 1) & (LOG_RING_SIZE - 1)].seq, memory_order_acquire) -
+               (head - 1 + LOG_RING_SIZE)) < 0)
+  {
+    if (atomic_load_explicit(&LOG_Running, memory_order_relaxed) == false)
+      break;
+    msleep(1);
+  }
+}
+
+/** \brief Stop background writer, queued records are written before return
+ *
+ * \return Nothing
+ *
+ */
+void LOG_Stop(void)
+{
+  if (atomic_exchange(&LOG_Running, false) == false)
+    return;
+  pthread_mutex_lock(&LOG_Mutex);
+  pthread_cond_signal(&LOG_Cond);
+  pthread_mutex_unlock(&LOG_Mutex);
+  pthread_join(LOG_Thread, NULL);
+  if (LOG_File != stdout)
+    fclose(LOG_File);
+  LOG_File = stdout;
+}
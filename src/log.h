@@ -2,15 +2,31 @@
 #define LOG_H
 
 #include <stdint.h>
+#include <stdbool.h>
+
+#define LOG_RING_SIZE     (1024)
+#define LOG_MSG_LEN       (160)
+#define LOG_PORT_LEN      (32)
 
 enum {
+  LOG_LEVEL_DEBUG,
   LOG_LEVEL_INFO,
   LOG_LEVEL_WARNING,
   LOG_LEVEL_ERROR,
   LOG_LEVEL_LAST
 };
 
+enum {
+  LOG_FORMAT_CONSOLE,
+  LOG_FORMAT_TEXT,
+  LOG_FORMAT_JSON
+};
+
 void LOG_Print(uint8_t level, char *msg, ...);
 void LOG_SetLevel(uint8_t level);
+void LOG_SetContext(uint32_t session, char *port, int8_t bus_id);
+bool LOG_Start(char *file, uint8_t format);
+void LOG_Flush(void);
+void LOG_Stop(void);
 
 #endif
@@ -1,12 +1,84 @@
+#include <stdlib.h>
+#include "bench.h"
 #include "defines.h"
+#include "engine.h"
 #include "ifaces.h"
-#include "app.h"
 #include "log.h"
+#include "msprog.h"
+#include "plan.h"
+#include "profile.h"
+#include "progress.h"
+#include "rt.h"
+#include "stats.h"
+#include "timer.h"
+#include "timing.h"
 
 #define SW_VER_NUMBER   "0.1"
 #define SW_VER_DATE     "29.03.2021"
 
-tParam parameters;
+/**< exit status */
+enum {
+  EXIT_OK,
+  EXIT_FAILED,
+  EXIT_SKIPPED
+};
+
+/** \brief Program one device: read firmware back, load image, write and/or verify it
+ *
+ * \param [in] parameters Application parameters
+ * \return exit status
+ *
+ */
+static uint8_t execute(tParam *parameters)
+{
+  tSession *session;
+  uint8_t res = EXIT_FAILED;
+
+  if ((session = MSPROG_Open(parameters)) == NULL)
+    return EXIT_FAILED;
+  /**< the old firmware is saved before it is overwritten */
+  if ((parameters->read[0] != 0) && (MSPROG_Read(session, parameters->read) == false))
+  {
+    MSPROG_Close(session);
+    return EXIT_FAILED;
+  }
+  if (!parameters->write && !parameters->check)
+  {
+    LOG_Print(LOG_LEVEL_LAST, "Successfully executed");
+    res = EXIT_OK;
+  } else if (MSPROG_LoadImage(session, parameters->file) == true)
+  {
+    if (parameters->write && parameters->if_changed && (MSPROG_IsSame(session) == true))
+    {
+      LOG_Print(LOG_LEVEL_LAST, "Firmware is already up to date, writing skipped");
+      res = EXIT_SKIPPED;
+    } else if (((parameters->write == false) || (MSPROG_Write(session) == true)) &&
+               ((parameters->check == false) || (MSPROG_Verify(session) == true)))
+    {
+      LOG_Print(LOG_LEVEL_LAST, "Successfully executed");
+      res = EXIT_OK;
+    }
+  }
+  MSPROG_Close(session);
+
+  return res;
+}
+
+/** \brief Render the stats file after the run if requested
+ *
+ * \param [in] parameters Application parameters
+ * \param [in] status Exit status of the run
+ * \return exit status
+ *
+ */
+static int finish(tParam *parameters, int status)
+{
+  RT_Report();
+  if ((parameters->stats_export[0] != 0) && (STATS_Export(parameters->stats_export) == false) && (status == EXIT_OK))
+    return EXIT_FAILED;
+
+  return status;
+}
 
 /** \brief Print help screen with list of commands
  *
@@ -19,12 +91,57 @@ void help(void)
 
   printf("  -b BAUDRATE  - set COM baudrate (default=115200)\n");
   printf("  -c COM_PORT  - COM port to use (Win: COMx | *nix: /dev/ttyX)\n");
-  printf("  -f FILE.HEX  - name of Hex-file with firmware\n");
+  #ifdef __linux
+  printf("                 tcp://host:port for network gateways, pty://[link] for device emulators\n");
+  #endif
+  printf("  -d DEVICE    - device profile (default=detected by bootloader)\n");
+  printf("  -f FILE.HEX  - name of Hex-file with firmware, \"-\" for standard input,\n");
+  printf("                 standard input and FILE.HEX.gz are written while they are decoded\n");
   printf("  -h           - show this help screen\n");
   printf("  -i INTERFACE - target interface\n");
   printf("  -lX          - set logging level (0-all/1-warnings/2-errors)\n");
+  printf("  -n BUS_ID    - set device ID for bus protocols\n");
   printf("  -t           - test firmware with checksums\n");
   printf("  -w           - write firmware to device\n");
+  printf("  --read FILE  - read firmware back and save it to Hex-file FILE (before -w)\n");
+  printf("  --scan [A-B] - list devices answering on bus IDs A..B (default=0-127),\n");
+  printf("                 with -w/-t the found devices are flashed one after another\n");
+  printf("  --resume[=full] - continue interrupted writing from the last checkpoint\n");
+  printf("                  (quick: check pages since checkpoint, full: check all)\n");
+  printf("  --plan FILE       - write only the pages of delta plan FILE if the device runs its\n");
+  printf("                      base firmware (checked by one CRC32), otherwise the whole image\n");
+  printf("  --diff OLD.HEX    - save pages differing between OLD.HEX and -f FILE.HEX as delta\n");
+  printf("                      plan --plan FILE, no device is needed (page size from -d)\n");
+  printf("  --if-changed      - compare firmware first, skip writing if it is the same\n");
+  printf("                      (exit status 2, 1 if failed)\n");
+  printf("  --stream          - decode any Hex-file while writing (e.g. named pipe)\n");
+  printf("  --no-pack         - don't compress transfers even if the bootloader can unpack them\n");
+  printf("  --max-unit BYTES  - limit multi-page transfer unit (default=negotiated)\n");
+  printf("  --profiles FILE   - load additional device profiles from FILE\n");
+  printf("  --timing FILE     - start with boot time, reply time, page pause and transfer unit\n");
+  printf("                      learned for the target in earlier runs, keep them in FILE\n");
+  printf("  --progress-rate N - redraw progress bar at most N times/s (0-off, default=%d)\n", PROGRESS_RATE_DEFAULT);
+  printf("  --progress-fd FD  - write progress as JSON lines to file descriptor FD\n");
+  printf("  --recover MS      - power-cycle a hanging target and continue, at most MS ms\n");
+  printf("                      in total (default=0-off)\n");
+  printf("  --rt [CPU]        - low-jitter I/O: pin to CPU, SCHED_FIFO and locked memory\n");
+  printf("                      if permitted\n");
+  printf("  --timer-spin US    - finish every protocol delay by polling the clock for\n");
+  printf("                      the last US microseconds (0-%d, default=0-sleep only)\n", TIMER_SPIN_MAX_US);
+  printf("  --stats FILE      - add counters of every session to the shared stats FILE\n");
+  printf("  --stats-export FILE - render the stats as Prometheus textfile (also without -w/-t)\n");
+  printf("  --log-file FILE   - append log records to FILE instead of stdout\n");
+  printf("  --log-format FMT  - log format: console/text/json (timestamps and context)\n");
+  printf("  --trace           - log every protocol command and reply\n");
+  #ifdef __linux
+  printf("  --ports FILE      - write/test all ports listed in FILE at once (one per line)\n");
+  printf("  --watch PATTERN   - write/test every new port matching PATTERN (e.g. /dev/ttyUSB*)\n");
+  printf("                      as it is plugged in, until Ctrl+C\n");
+  printf("  --bench N         - measure the engine with up to N emulated devices\n");
+  printf("  --selftest        - write and verify an emulated device over tcp://127.0.0.1\n");
+  #endif
+  printf("  --record FILE     - record all transfers with timestamps, play back with\n");
+  printf("                      -c replay://FILE[@SPEED] (SPEED: 0-no delays, N-N times faster)\n");
   printf("\n");
   printf("  List of supported interfaces:\n    ");
   for (i = 0; i < IFACES_GetNumber(); i++)
@@ -33,6 +150,36 @@ void help(void)
     if ((i + 1) % 4 == 0 ? printf("\n    "): printf(" "));
   }
   printf("\n");
+  printf("\n");
+  printf("  List of built-in devices:\n    ");
+  for (i = 0; i < PROFILE_GetNumber(); i++)
+  {
+    printf("%-14s", PROFILE_GetNameByNumber(i));
+    printf((i + 1) % 4 == 0 ? "\n    " : " ");
+  }
+  printf("\n");
+}
+
+/** \brief Get unsigned numeric value of the command line option
+ *
+ * \param [in] argc Number of command line arguments
+ * \param [in] argv Command line arguments
+ * \param [in,out] i Index of the option, moved to the value if found
+ * \param [in] max Maximal allowed value
+ * \param [out] val Parsed value
+ * \return true if succeed
+ *
+ */
+static bool get_uint(int argc, char* argv[], uint8_t *i, uint32_t max, uint32_t *val)
+{
+  if ((*i >= (argc - 1)) || (sscanf(argv[*i + 1], "%u", val) != 1) || (*val > max))
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "Parameter %s is wrong or missing", argv[*i]);
+    return false;
+  }
+  (*i)++;
+
+  return true;
 }
 
 /** \brief Main application function
@@ -46,8 +193,14 @@ int main(int argc, char* argv[])
 {
   uint8_t i;
   //uint8_t x;
-  bool error;
+  bool error = false;
   uint32_t tVal;
+  uint32_t tVal2;
+  uint8_t ids[MSPROG_SCAN_MAX_IDS];
+  tParam parameters;
+  uint8_t cnt;
+  uint8_t res;
+  uint8_t status;
   //char *pch;
   //uint16_t val;
 
@@ -64,6 +217,9 @@ int main(int argc, char* argv[])
 
   memset(&parameters, 0, sizeof(parameters));
   parameters.bus_id = -1;
+  parameters.progress_rate = PROGRESS_RATE_DEFAULT;
+  parameters.progress_fd = -1;
+  parameters.rt_cpu = -1;
 
   i = 1;
   while (i < argc)
@@ -86,6 +242,11 @@ int main(int argc, char* argv[])
           /**< set COM-port */
           if ((i < (argc - 1)) && (argv[i + 1][0] != '-'))
           {
+            if (strlen(argv[i + 1]) >= COMPORT_LEN)
+            {
+              LOG_Print(LOG_LEVEL_ERROR, "COM port name is too long: %s", argv[i + 1]);
+              error = true;
+            }
             strncpy(parameters.port, argv[i + 1], COMPORT_LEN);
             parameters.port[COMPORT_LEN - 1] = 0;
             i++;
@@ -94,9 +255,22 @@ int main(int argc, char* argv[])
             LOG_Print(LOG_LEVEL_ERROR, "COM port name is missing");
           }
           break;
-        case 'f':
-          /**< get file name */
+        case 'd':
+          /**< set device profile */
           if ((i < (argc - 1)) && (argv[i + 1][0] != '-'))
+          {
+            strncpy(parameters.device, argv[i + 1], DEVICE_LEN);
+            parameters.device[DEVICE_LEN - 1] = 0;
+            i++;
+          } else
+          {
+            LOG_Print(LOG_LEVEL_ERROR, "Device name is missing");
+            error = true;
+          }
+          break;
+        case 'f':
+          /**< get file name, "-" is standard input */
+          if ((i < (argc - 1)) && ((argv[i + 1][0] != '-') || (strcmp(argv[i + 1], "-") == 0)))
           {
             strncpy(parameters.file, argv[i + 1], FILENAME_LEN);
             parameters.file[FILENAME_LEN - 1] = 0;
@@ -127,7 +301,7 @@ int main(int argc, char* argv[])
         case 'l':
           /**< level of messaging */
           if (argv[i][2] >= '0' && argv[i][2] <= '2')
-            LOG_SetLevel(argv[i][2] - '0');
+            LOG_SetLevel(LOG_LEVEL_INFO + argv[i][2] - '0');
           else
             LOG_Print(LOG_LEVEL_ERROR, "Logging level %c is not supported", argv[i][2]);
           break;
@@ -153,6 +327,247 @@ int main(int argc, char* argv[])
           /**< write firmware */
           parameters.write = true;
           break;
+        case '-':
+          /**< long options */
+          if (strcmp(&argv[i][2], "resume") == 0)
+          {
+            parameters.resume = RESUME_QUICK;
+          } else if (strcmp(&argv[i][2], "resume=full") == 0)
+          {
+            parameters.resume = RESUME_FULL;
+          } else if (strcmp(&argv[i][2], "scan") == 0)
+          {
+            parameters.scan = true;
+            parameters.scan_first = 0;
+            parameters.scan_last = MSPROG_SCAN_MAX_IDS - 1;
+            if ((i < (argc - 1)) && (argv[i + 1][0] != '-'))
+            {
+              if ((sscanf(argv[i + 1], "%u-%u", &tVal, &tVal2) == 2) && (tVal <= tVal2) && (tVal2 < MSPROG_SCAN_MAX_IDS))
+              {
+                parameters.scan_first = (uint8_t)tVal;
+                parameters.scan_last = (uint8_t)tVal2;
+              } else
+              {
+                LOG_Print(LOG_LEVEL_ERROR, "Scan range is wrong: %s", argv[i + 1]);
+                error = true;
+              }
+              i++;
+            }
+          } else if (strcmp(&argv[i][2], "read") == 0)
+          {
+            if ((i < (argc - 1)) && (argv[i + 1][0] != '-'))
+            {
+              strncpy(parameters.read, argv[i + 1], FILENAME_LEN);
+              parameters.read[FILENAME_LEN - 1] = 0;
+              i++;
+            } else
+            {
+              LOG_Print(LOG_LEVEL_ERROR, "Readback file name is missing");
+              error = true;
+            }
+          } else if (strcmp(&argv[i][2], "plan") == 0)
+          {
+            if ((i < (argc - 1)) && (argv[i + 1][0] != '-'))
+            {
+              strncpy(parameters.plan, argv[i + 1], FILENAME_LEN);
+              parameters.plan[FILENAME_LEN - 1] = 0;
+              i++;
+            } else
+            {
+              LOG_Print(LOG_LEVEL_ERROR, "Delta plan file name is missing");
+              error = true;
+            }
+          } else if (strcmp(&argv[i][2], "diff") == 0)
+          {
+            if ((i < (argc - 1)) && (argv[i + 1][0] != '-'))
+            {
+              strncpy(parameters.diff, argv[i + 1], FILENAME_LEN);
+              parameters.diff[FILENAME_LEN - 1] = 0;
+              i++;
+            } else
+            {
+              LOG_Print(LOG_LEVEL_ERROR, "Base firmware file name is missing");
+              error = true;
+            }
+          } else if (strcmp(&argv[i][2], "if-changed") == 0)
+          {
+            parameters.if_changed = true;
+          } else if (strcmp(&argv[i][2], "no-pack") == 0)
+          {
+            parameters.no_pack = true;
+          } else if (strcmp(&argv[i][2], "stream") == 0)
+          {
+            parameters.stream = true;
+          } else if (strcmp(&argv[i][2], "profiles") == 0)
+          {
+            if ((i < (argc - 1)) && (argv[i + 1][0] != '-'))
+            {
+              strncpy(parameters.profiles, argv[i + 1], FILENAME_LEN);
+              parameters.profiles[FILENAME_LEN - 1] = 0;
+              i++;
+            } else
+            {
+              LOG_Print(LOG_LEVEL_ERROR, "Profiles file name is missing");
+              error = true;
+            }
+          } else if (strcmp(&argv[i][2], "timing") == 0)
+          {
+            if ((i < (argc - 1)) && (argv[i + 1][0] != '-'))
+            {
+              strncpy(parameters.timing, argv[i + 1], FILENAME_LEN);
+              parameters.timing[FILENAME_LEN - 1] = 0;
+              i++;
+            } else
+            {
+              LOG_Print(LOG_LEVEL_ERROR, "Timing database file name is missing");
+              error = true;
+            }
+          } else if (strcmp(&argv[i][2], "max-unit") == 0)
+          {
+            if (get_uint(argc, argv, &i, UINT16_MAX, &tVal) == true)
+              parameters.max_unit = (uint16_t)tVal;
+            else
+              error = true;
+          } else if (strcmp(&argv[i][2], "progress-rate") == 0)
+          {
+            if (get_uint(argc, argv, &i, UINT8_MAX, &tVal) == true)
+              parameters.progress_rate = (uint8_t)tVal;
+            else
+              error = true;
+          } else if (strcmp(&argv[i][2], "progress-fd") == 0)
+          {
+            if (get_uint(argc, argv, &i, INT_MAX, &tVal) == true)
+              parameters.progress_fd = (int)tVal;
+            else
+              error = true;
+          } else if (strcmp(&argv[i][2], "recover") == 0)
+          {
+            if (get_uint(argc, argv, &i, UINT32_MAX, &tVal) == true)
+              parameters.recover_ms = tVal;
+            else
+              error = true;
+          } else if (strcmp(&argv[i][2], "timer-spin") == 0)
+          {
+            if (get_uint(argc, argv, &i, TIMER_SPIN_MAX_US, &tVal) == true)
+              parameters.timer_spin = (uint16_t)tVal;
+            else
+              error = true;
+          } else if (strcmp(&argv[i][2], "rt") == 0)
+          {
+            parameters.rt = true;
+            if ((i < (argc - 1)) && (argv[i + 1][0] != '-'))
+            {
+              if ((sscanf(argv[i + 1], "%u", &tVal) == 1) && (tVal <= INT16_MAX))
+                parameters.rt_cpu = (int16_t)tVal;
+              else
+                error = true;
+              i++;
+            }
+          } else if (strcmp(&argv[i][2], "stats") == 0)
+          {
+            if ((i < (argc - 1)) && (argv[i + 1][0] != '-'))
+            {
+              strncpy(parameters.stats, argv[i + 1], FILENAME_LEN);
+              parameters.stats[FILENAME_LEN - 1] = 0;
+              i++;
+            } else
+            {
+              LOG_Print(LOG_LEVEL_ERROR, "Stats file name is missing");
+              error = true;
+            }
+          } else if (strcmp(&argv[i][2], "stats-export") == 0)
+          {
+            if ((i < (argc - 1)) && (argv[i + 1][0] != '-'))
+            {
+              strncpy(parameters.stats_export, argv[i + 1], FILENAME_LEN);
+              parameters.stats_export[FILENAME_LEN - 1] = 0;
+              i++;
+            } else
+            {
+              LOG_Print(LOG_LEVEL_ERROR, "Stats export file name is missing");
+              error = true;
+            }
+          } else if (strcmp(&argv[i][2], "log-file") == 0)
+          {
+            if ((i < (argc - 1)) && (argv[i + 1][0] != '-'))
+            {
+              strncpy(parameters.log_file, argv[i + 1], FILENAME_LEN);
+              parameters.log_file[FILENAME_LEN - 1] = 0;
+              i++;
+            } else
+            {
+              LOG_Print(LOG_LEVEL_ERROR, "Log file name is missing");
+              error = true;
+            }
+          } else if (strcmp(&argv[i][2], "log-format") == 0)
+          {
+            if ((i < (argc - 1)) && (strcmp(argv[i + 1], "console") == 0))
+              parameters.log_format = LOG_FORMAT_CONSOLE;
+            else if ((i < (argc - 1)) && (strcmp(argv[i + 1], "text") == 0))
+              parameters.log_format = LOG_FORMAT_TEXT;
+            else if ((i < (argc - 1)) && (strcmp(argv[i + 1], "json") == 0))
+              parameters.log_format = LOG_FORMAT_JSON;
+            else
+            {
+              LOG_Print(LOG_LEVEL_ERROR, "Log format is wrong or missing");
+              error = true;
+            }
+            i++;
+          } else if (strcmp(&argv[i][2], "record") == 0)
+          {
+            if ((i < (argc - 1)) && (argv[i + 1][0] != '-'))
+            {
+              strncpy(parameters.record, argv[i + 1], FILENAME_LEN);
+              parameters.record[FILENAME_LEN - 1] = 0;
+              i++;
+            } else
+            {
+              LOG_Print(LOG_LEVEL_ERROR, "Recording file name is missing");
+              error = true;
+            }
+          #ifdef __linux
+          } else if (strcmp(&argv[i][2], "ports") == 0)
+          {
+            if ((i < (argc - 1)) && (argv[i + 1][0] != '-'))
+            {
+              strncpy(parameters.ports, argv[i + 1], FILENAME_LEN);
+              parameters.ports[FILENAME_LEN - 1] = 0;
+              i++;
+            } else
+            {
+              LOG_Print(LOG_LEVEL_ERROR, "Ports file name is missing");
+              error = true;
+            }
+          } else if (strcmp(&argv[i][2], "watch") == 0)
+          {
+            if ((i < (argc - 1)) && (argv[i + 1][0] != '-'))
+            {
+              strncpy(parameters.watch, argv[i + 1], FILENAME_LEN);
+              parameters.watch[FILENAME_LEN - 1] = 0;
+              i++;
+            } else
+            {
+              LOG_Print(LOG_LEVEL_ERROR, "Port pattern is missing");
+              error = true;
+            }
+          } else if (strcmp(&argv[i][2], "bench") == 0)
+          {
+            if ((get_uint(argc, argv, &i, ENGINE_MAX_SESSIONS, &tVal) == true) && (tVal > 0))
+              parameters.bench = (uint16_t)tVal;
+            else
+              error = true;
+          } else if (strcmp(&argv[i][2], "selftest") == 0)
+          {
+            parameters.selftest = true;
+          #endif
+          } else if (strcmp(&argv[i][2], "trace") == 0)
+          {
+            LOG_SetLevel(LOG_LEVEL_DEBUG);
+          } else
+          {
+            LOG_Print(LOG_LEVEL_ERROR, "Unknown parameter: %s", argv[i]);
+          }
+          break;
         default:
           LOG_Print(LOG_LEVEL_ERROR, "Unknown parameter: %s", argv[i]);
           break;
@@ -163,28 +578,141 @@ int main(int argc, char* argv[])
     i++;
   }
 
+  if ((parameters.profiles[0] != 0) && (PROFILE_LoadFile(parameters.profiles) == false))
+    return -1;
+  TIMING_Setup(parameters.timing);
+  #ifdef __linux
+  if ((parameters.bench > 0) || parameters.selftest)
+  {
+    if ((parameters.device[0] != 0) && (PROFILE_Find(parameters.device) == NULL))
+    {
+      LOG_Print(LOG_LEVEL_ERROR, "Unknown device: %s", parameters.device);
+      return -1;
+    }
+    TIMER_Setup(parameters.timer_spin);
+    if (parameters.selftest)
+      return (BENCH_Loopback(&parameters) == true) ? EXIT_OK : EXIT_FAILED;
+    return (BENCH_Run(&parameters, parameters.bench) == true) ? EXIT_OK : EXIT_FAILED;
+  }
+  #endif
+  if (parameters.diff[0] != 0)
+  {
+    if ((parameters.plan[0] == 0) || (parameters.file[0] == 0))
+    {
+      LOG_Print(LOG_LEVEL_ERROR, "Delta plan needs the new image (-f) and the plan file (--plan)");
+      return -1;
+    }
+    if ((parameters.device[0] != 0) && (PROFILE_Find(parameters.device) == NULL))
+    {
+      LOG_Print(LOG_LEVEL_ERROR, "Unknown device: %s", parameters.device);
+      return -1;
+    }
+    return (PLAN_Make(parameters.diff, parameters.file,
+                      (parameters.device[0] != 0) ? PROFILE_Find(parameters.device) : PROFILE_GetDefault(),
+                      parameters.plan) == true) ? EXIT_OK : EXIT_FAILED;
+  }
+  if ((parameters.stats[0] != 0) && (STATS_Open(parameters.stats) == false))
+    return -1;
+  atexit(STATS_Close);
+  if ((parameters.stats_export[0] != 0) && !parameters.write && !parameters.check && !parameters.scan)
+    return (STATS_Export(parameters.stats_export) == true) ? EXIT_OK : EXIT_FAILED;
   if (parameters.iface < 0)
   {
     LOG_Print(LOG_LEVEL_ERROR, "Interface type (-i) is not set");
     return -1;
   }
-  if (strlen(parameters.port) == 0)
+  if ((strlen(parameters.port) == 0) && (parameters.ports[0] == 0) && (parameters.watch[0] == 0))
   {
     LOG_Print(LOG_LEVEL_ERROR, "COM port name is not set");
     return -1;
   }
-  if (!parameters.write && !parameters.check)
+  if (!parameters.write && !parameters.check && !parameters.scan && (parameters.read[0] == 0))
   {
     LOG_Print(LOG_LEVEL_LAST, "Nothing to do, stopping");
     return -1;
   }
-  if (strlen(parameters.file) == 0)
+  if ((parameters.write || parameters.check) && (strlen(parameters.file) == 0))
   {
     LOG_Print(LOG_LEVEL_ERROR, "File name is missing");
     return -1;
   }
+  if (((parameters.ports[0] != 0) || (parameters.watch[0] != 0)) && (parameters.plan[0] != 0))
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "Delta plan is applied with -c only");
+    return -1;
+  }
+  if ((parameters.scan || (parameters.ports[0] != 0) || (parameters.watch[0] != 0)) && (parameters.read[0] != 0))
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "Firmware can be read from one device only");
+    return -1;
+  }
+  if (parameters.scan && (parameters.write || parameters.check) && (strcmp(parameters.file, "-") == 0))
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "Standard input can be written to one device only");
+    return -1;
+  }
+  if ((parameters.device[0] != 0) && (PROFILE_Find(parameters.device) == NULL))
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "Unknown device: %s", parameters.device);
+    return -1;
+  }
+
+  if ((parameters.log_file[0] != 0) && (parameters.log_format == LOG_FORMAT_CONSOLE))
+    parameters.log_format = LOG_FORMAT_TEXT;
+  if (LOG_Start(parameters.log_file, parameters.log_format) == false)
+    return -1;
+  atexit(LOG_Stop);
 
-  APP_Execute(&parameters);
+  PROGRESS_Setup(parameters.progress_rate, parameters.progress_fd);
+  TIMER_Setup(parameters.timer_spin);
+  /**< only this thread does the protocol I/O, the log writer started before keeps normal priority */
+  if (parameters.rt && (RT_Setup(parameters.rt_cpu) == false))
+    return -1;
+  #ifdef __linux
+  if (parameters.ports[0] != 0)
+  {
+    if (!parameters.write && !parameters.check)
+    {
+      LOG_Print(LOG_LEVEL_ERROR, "Ports file is used for writing or testing only");
+      return -1;
+    }
+    return finish(&parameters, (ENGINE_RunFile(&parameters, parameters.ports) == true) ? EXIT_OK : EXIT_FAILED);
+  }
+  if (parameters.watch[0] != 0)
+  {
+    if (!parameters.write && !parameters.check)
+    {
+      LOG_Print(LOG_LEVEL_ERROR, "Watch mode is used for writing or testing only");
+      return -1;
+    }
+    return finish(&parameters, (ENGINE_Watch(&parameters, parameters.watch) == true) ? EXIT_OK : EXIT_FAILED);
+  }
+  #endif
+  if (parameters.scan)
+  {
+    cnt = MSPROG_Scan(&parameters, ids);
+    if (!parameters.write && !parameters.check)
+      return finish(&parameters, EXIT_OK);
+    /**< the worst result is reported, skipped only if all devices were up to date */
+    status = EXIT_SKIPPED;
+    for (i = 0; i < cnt; i++)
+    {
+      LOG_Print(LOG_LEVEL_LAST, "Device ID %u (%u of %u):", ids[i], i + 1, cnt);
+      parameters.bus_id = (int8_t)ids[i];
+      res = execute(&parameters);
+      if (res == EXIT_FAILED)
+        status = EXIT_FAILED;
+      else if ((res == EXIT_OK) && (status == EXIT_SKIPPED))
+        status = EXIT_OK;
+    }
+    /**< nothing to write or test is a failure, scripts must see an empty bus */
+    if (cnt == 0)
+    {
+      LOG_Print(LOG_LEVEL_ERROR, "No device answered on the bus");
+      status = EXIT_FAILED;
+    }
+    return finish(&parameters, status);
+  }
 
-  return 0;
+  return finish(&parameters, execute(&parameters));
 }
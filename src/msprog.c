@@ -0,0 +1,889 @@
+#include <stdlib.h>
+#include <stdatomic.h>
+#include "app.h"
+#include "crc16.h"
+#include "crc32.h"
+#include "ihex.h"
+#include "journal.h"
+#include "log.h"
+#include "msprog.h"
+#include "plan.h"
+#include "sleep.h"
+#include "stream.h"
+
+static atomic_uint MSPROG_Sessions;
+
+/** \brief Set log context of the calling thread to the session
+ *
+ * \param [in] s Session
+ * \return Nothing
+ *
+ */
+static void MSPROG_Enter(tSession *s)
+{
+  LOG_SetContext(s->id, s->parameters.port, s->parameters.bus_id);
+}
+
+/** \brief Create session and open its port
+ *
+ * \param [in] parameters Session parameters, copied into the session
+ * \return session or NULL if failed
+ *
+ */
+static tSession *MSPROG_Create(tParam *parameters)
+{
+  tSession *s;
+
+  if ((s = calloc(1, sizeof(tSession))) == NULL)
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "Unable to allocate session");
+    return NULL;
+  }
+  memcpy(&s->parameters, parameters, sizeof(tParam));
+  s->id = atomic_fetch_add(&MSPROG_Sessions, 1) + 1;
+  MSPROG_Enter(s);
+  STATS_Begin(&s->run);
+  s->profile = PROFILE_GetDefault();
+  if (PHY_Init(&s->phy, s->parameters.port, PHY_BAUDRATE, false) == false)
+  {
+    free(s);
+    return NULL;
+  }
+  if ((s->parameters.record[0] != 0) && (RECORD_Start(&s->phy.record, s->parameters.record, s->id) == false))
+  {
+    PHY_Close(&s->phy);
+    free(s);
+    return NULL;
+  }
+  APP_TuneLink(s);
+
+  return s;
+}
+
+/** \brief Open session: port, adapter interface, baudrate and bus ID
+ *
+ * \param [in] parameters Session parameters, copied into the session
+ * \return session or NULL if failed
+ *
+ */
+tSession *MSPROG_Open(tParam *parameters)
+{
+  tSession *s;
+
+  /**< without explicit device the profile is detected after the bootloader is started */
+  if ((parameters->device[0] != 0) && (PROFILE_Find(parameters->device) == NULL))
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "Unknown device: %s", parameters->device);
+    return NULL;
+  }
+  if ((s = MSPROG_Create(parameters)) == NULL)
+    return NULL;
+  s->maxlen = PROFILE_GetMaxFlash();
+  if (s->parameters.device[0] != 0)
+  {
+    s->device = PROFILE_Find(s->parameters.device);
+    s->profile = s->device;
+    s->maxlen = s->device->flash_size;
+  }
+  TIMING_Load(&s->timing, &s->parameters);
+
+  if (APP_SetupAdapter(s) == false)
+  {
+    s->run.failed = true;
+    MSPROG_Close(s);
+    return NULL;
+  }
+  if (s->parameters.bus_id >= 0)
+  {
+    if (APP_SetId(s, s->parameters.bus_id) == false)
+    {
+      LOG_Print(LOG_LEVEL_ERROR, "Unable to set bus ID: %d\n", s->parameters.bus_id);
+      s->run.failed = true;
+      MSPROG_Close(s);
+      return NULL;
+    }
+  }
+
+  return s;
+}
+
+/** \brief Load firmware image from Hex file
+ *
+ * Standard input ("-"), compressed files and all files with the stream parameter
+ * are not loaded here, they are decoded page by page while writing.
+ *
+ * \param [in] session Session
+ * \param [in] filename Name of the Hex file
+ * \return true if succeed
+ *
+ */
+bool MSPROG_LoadImage(tSession *session, char *filename)
+{
+  MSPROG_Enter(session);
+  session->len = 0;
+  session->stream[0] = 0;
+  if ((session->parameters.stream == true) || (STREAM_IsStream(filename) == true))
+  {
+    strncpy(session->stream, filename, FILENAME_LEN);
+    session->stream[FILENAME_LEN - 1] = 0;
+    return true;
+  }
+  if (session->fdata == NULL)
+    session->fdata = malloc(session->maxlen);
+  if (session->fdata == NULL)
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "Unable to allocate %d bytes\n", (int)session->maxlen);
+    session->run.failed = true;
+    return false;
+  }
+  if (APP_OpenFile(filename, session->fdata, session->maxlen, &session->len) == false)
+  {
+    session->len = 0;
+    session->run.failed = true;
+    return false;
+  }
+
+  return true;
+}
+
+/** \brief Start bootloader once per session and detect profile
+ *
+ * \param [in] s Session
+ * \return true if the bootloader is running
+ *
+ */
+static bool MSPROG_Boot(tSession *s)
+{
+  uint32_t ready_ms;
+
+  if (s->started == true)
+    return true;
+  if (APP_EnterBootloader(s, 0, &ready_ms) == false)
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "Unable to start bootloader\n");
+    return false;
+  }
+  s->started = true;
+  APP_GetInfo(s, &s->info);
+  if (s->device == NULL)
+  {
+    if ((s->info.name[0] != 0) && ((s->device = PROFILE_Find(s->info.name)) != NULL))
+      s->profile = s->device;
+    LOG_Print(LOG_LEVEL_INFO, "Device profile: %s (reported as \"%s\")", s->profile->name, s->info.name);
+  }
+  TIMING_Bind(&s->timing, s->profile);
+  TIMING_Boot(&s->timing, ready_ms);
+
+  return true;
+}
+
+/** \brief Start bootloader once per session, detect profile and check image size
+ *
+ * \param [in] s Session
+ * \return true if the bootloader is running and the image fits
+ *
+ */
+static bool MSPROG_Start(tSession *s)
+{
+  if ((s->len == 0) && (s->stream[0] == 0))
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "Firmware image is not loaded");
+    return false;
+  }
+  if (MSPROG_Boot(s) == false)
+    return false;
+  /**< the size of a stream is checked while it is decoded */
+  if (s->stream[0] != 0)
+    return true;
+  if (s->len > s->profile->flash_size)
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "Hex file is larger than flash of %s", s->profile->name);
+    return false;
+  }
+  s->pages = (s->len - 1) / s->profile->page_size + 1;
+
+  return true;
+}
+
+/** \brief Power-cycle a hanging target and restart its bootloader within the recovery budget
+ *
+ * \param [in] s Session
+ * \return true if the bootloader is running again
+ *
+ */
+static bool MSPROG_Recover(tSession *s)
+{
+  uint64_t budget = (uint64_t)s->parameters.recover_ms * 1000;
+  uint64_t start;
+  uint32_t ready_ms;
+  uint32_t left_ms;
+  bool res;
+
+  if (s->recover_us >= budget)
+    return false;
+  if (s->power != APP_POWER_YES)
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "Target doesn't answer, adapter has no power control to recover it");
+    return false;
+  }
+  left_ms = (uint32_t)((budget - s->recover_us) / 1000);
+  /**< the target must stay off for its full time to reset */
+  if (left_ms <= s->profile->power_off_ms)
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "Target doesn't answer, %u ms of recovery time left is too short to power-cycle it",
+              left_ms);
+    return false;
+  }
+  LOG_Print(LOG_LEVEL_WARNING, "Target doesn't answer, power-cycling it (%u ms of recovery time left)", left_ms);
+  start = usclock();
+  PHY_Flush(&s->phy);
+  res = APP_EnterBootloader(s, left_ms, &ready_ms);
+  s->recover_us += usclock() - start;
+  if (res == false)
+    LOG_Print(LOG_LEVEL_ERROR, "Unable to restart bootloader");
+
+  return res;
+}
+
+/** \brief Check if the firmware is already the same as the loaded image
+ *
+ * One range checksum is asked if the bootloader supports it, otherwise pages are
+ * compared in pipelined windows until the first difference.
+ *
+ * \param [in] session Session
+ * \return true if the firmware is the same
+ *
+ */
+bool MSPROG_IsSame(tSession *session)
+{
+  tSession *s = session;
+  uint32_t crc;
+  uint32_t image;
+  uint16_t same;
+
+  MSPROG_Enter(s);
+  if (MSPROG_Start(s) == false)
+    return false;
+  if (s->stream[0] != 0)
+  {
+    LOG_Print(LOG_LEVEL_INFO, "Streamed image can't be compared before writing");
+    return false;
+  }
+  if (APP_GetHash(s, 0, s->pages, &crc) == true)
+  {
+    image = CRC32_Calc(s->fdata, (uint32_t)s->pages * s->profile->page_size);
+    LOG_Print(LOG_LEVEL_INFO, "Firmware CRC32: %08X, image CRC32: %08X", crc, image);
+    s->run.skipped = (crc == image);
+    return crc == image;
+  }
+  same = APP_CheckPages(s, 0, s->pages, s->fdata);
+  if (same < s->pages)
+    LOG_Print(LOG_LEVEL_INFO, "Firmware differs from page %u", same);
+  s->run.skipped = (same == s->pages);
+
+  return same == s->pages;
+}
+
+/** \brief Write image while it is decoded, complete pages are sent in transfer units
+ *
+ * \param [in] s Session
+ * \return true if succeed
+ *
+ */
+static bool MSPROG_WriteStream(tSession *s)
+{
+  tStream stream;
+  tTransfer transfer;
+  uint16_t page_size = s->profile->page_size;
+  uint8_t *buf;
+  uint8_t *data;
+  uint16_t first;
+  uint32_t cnt;
+  uint64_t sent;
+  uint16_t n;
+  uint16_t i;
+  uint8_t errors;
+  bool done;
+  bool res = false;
+
+  if (s->parameters.resume != RESUME_NONE)
+    LOG_Print(LOG_LEVEL_WARNING, "Streamed image can't be resumed, writing from the start");
+  if (STREAM_Open(&stream, s->stream, page_size, s->profile->flash_size) == false)
+    return false;
+  APP_NegotiateUnit(s, &transfer, &s->info, s->parameters.max_unit);
+  free(s->crc);
+  s->crc = malloc(s->profile->flash_size / page_size * sizeof(uint16_t));
+  buf = malloc(transfer.max_unit);
+  if ((s->crc == NULL) || (buf == NULL))
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "Unable to allocate stream buffers");
+    free(buf);
+    STREAM_Close(&stream);
+    return false;
+  }
+
+  PROGRESS_Start(&s->progress, "Writing  FW: ", "write", 0, 0, page_size);
+  TIMER_Start(&s->timer, usclock());
+  first = 0;
+  cnt = 0;
+  done = false;
+  errors = 0;
+  while (errors < s->profile->retries)
+  {
+    /**< pages are taken from the stream only when the transfer unit can't be filled otherwise */
+    while ((done == false) && (cnt + page_size <= transfer.unit))
+    {
+      if (STREAM_Next(&stream, &data) == false)
+      {
+        done = true;
+        break;
+      }
+      memcpy(&buf[cnt], data, page_size);
+      cnt += page_size;
+    }
+    if (stream.error || (cnt == 0))
+      break;
+    n = (cnt < transfer.unit) ? (uint16_t)cnt : transfer.unit;
+    TIMER_Add(&s->timer, s->profile->gap_ms * 1000);
+    TIMER_Wait(&s->timer);
+    sent = usclock();
+    if (APP_WriteBulk(s, first, buf, n) == false)
+    {
+      TIMER_Start(&s->timer, usclock());
+      s->run.retries[s->fault]++;
+      PROGRESS_Retry(&s->progress);
+      /**< a shorter transfer is tried first, only failures of single pages use up the retries */
+      if (APP_AdaptUnit(s, &transfer, false) == false)
+        errors++;
+      APP_AdaptPace(s, false);
+      /**< unconfirmed pages are still buffered, writing continues with them */
+      if ((errors >= s->profile->retries) && (MSPROG_Recover(s) == true))
+        errors = 0;
+      continue;
+    }
+    /**< the page is programmed after the reply, the pause is counted from there and includes the gap */
+    TIMER_Start(&s->timer, usclock());
+    TIMER_Add(&s->timer, s->timing.page_ms * 1000);
+    STATS_Page(&s->run, (uint32_t)(usclock() - sent), n / page_size, n);
+    errors = 0;
+    APP_AdaptUnit(s, &transfer, true);
+    APP_AdaptPace(s, true);
+    for (i = 0; i < n / page_size; i++)
+      s->crc[first + i] = CRC16_CalcData(&buf[i * page_size], page_size);
+    first += n / page_size;
+    cnt -= n;
+    memmove(buf, &buf[n], cnt);
+    PROGRESS_Update(&s->progress, first);
+  }
+  s->pages = first;
+  if (errors >= s->profile->retries)
+  {
+    PROGRESS_Break(&s->progress);
+    LOG_Print(LOG_LEVEL_ERROR, "Problem flashing Hex file");
+  } else if (stream.error)
+  {
+    PROGRESS_Break(&s->progress);
+  } else if (first == 0)
+  {
+    PROGRESS_Break(&s->progress);
+    LOG_Print(LOG_LEVEL_ERROR, "Hex stream is empty");
+  } else
+  {
+    PROGRESS_Finish(&s->progress, first);
+    s->acked = APP_AckHasCrc(s);
+    res = true;
+  }
+  free(buf);
+  STREAM_Close(&stream);
+  if (res == false)
+  {
+    free(s->crc);
+    s->crc = NULL;
+  }
+
+  return res;
+}
+
+/** \brief Compare streamed image with the firmware page by page while it is decoded
+ *
+ * \param [in] s Session
+ * \return true if the firmware is the same
+ *
+ */
+static bool MSPROG_VerifyStream(tSession *s)
+{
+  tStream stream;
+  uint8_t *data;
+  uint16_t page = 0;
+  uint8_t errors = 0;
+
+  if (STREAM_Open(&stream, s->stream, s->profile->page_size, s->profile->flash_size) == false)
+    return false;
+  PROGRESS_Start(&s->progress, "Checking FW: ", "check", 0, 0, s->profile->page_size);
+  while (STREAM_Next(&stream, &data) == true)
+  {
+    errors = 0;
+    while (APP_CheckFlash(s, page, data, s->profile->page_size) == false)
+    {
+      s->run.retries[(s->fault == STATS_CAUSE_TIMEOUT) ? STATS_CAUSE_TIMEOUT : STATS_CAUSE_MISMATCH]++;
+      if ((++errors >= s->profile->retries) && (s->fault == STATS_CAUSE_TIMEOUT) && (MSPROG_Recover(s) == true))
+        errors = 0;
+      if (errors >= s->profile->retries)
+        break;
+      PROGRESS_Retry(&s->progress);
+      TIMER_Sleep(&s->timer, s->profile->gap_ms * 1000);
+    }
+    if (errors >= s->profile->retries)
+      break;
+    s->run.pages_verified++;
+    PROGRESS_Update(&s->progress, ++page);
+  }
+  STREAM_Close(&stream);
+  if ((errors >= s->profile->retries) || stream.error || (page == 0))
+  {
+    PROGRESS_Break(&s->progress);
+    if (errors >= s->profile->retries)
+      LOG_Print(LOG_LEVEL_ERROR, "Hex file differs from the firmware");
+    else if (page == 0)
+      LOG_Print(LOG_LEVEL_ERROR, "Hex stream is empty");
+    return false;
+  }
+  PROGRESS_Finish(&s->progress, page);
+
+  return true;
+}
+
+/** \brief Write consecutive pages of the loaded image in transfer units
+ *
+ * \param [in] s Session
+ * \param [in,out] transfer Transfer unit, adapted to the link
+ * \param [in] first First page
+ * \param [in] last Page after the last one to write
+ * \param [in,out] journal Journal to confirm written pages in, NULL if none
+ * \param [in,out] done Progress counter, written pages are added
+ * \return true if succeed
+ *
+ */
+static bool MSPROG_WritePages(tSession *s, tTransfer *transfer, uint16_t first, uint16_t last, tJournal *journal,
+                              uint16_t *done)
+{
+  uint32_t i = (uint32_t)first * s->profile->page_size;
+  uint32_t end = (uint32_t)last * s->profile->page_size;
+  uint64_t sent;
+  uint16_t n;
+  uint8_t errors;
+
+  errors = 0;
+  while ((i < end) & (errors < s->profile->retries))
+  {
+    n = transfer->unit;
+    if (n > end - i)
+      n = (uint16_t)(end - i);
+    TIMER_Add(&s->timer, s->profile->gap_ms * 1000);
+    TIMER_Wait(&s->timer);
+    sent = usclock();
+    if (APP_WriteBulk(s, i / s->profile->page_size, &s->fdata[i], n) == false)
+    {
+      TIMER_Start(&s->timer, usclock());
+      s->run.retries[s->fault]++;
+      PROGRESS_Retry(&s->progress);
+      if (APP_AdaptUnit(s, transfer, false) == false)
+        errors++;
+      APP_AdaptPace(s, false);
+      /**< writing continues from the last confirmed page */
+      if ((errors >= s->profile->retries) && (MSPROG_Recover(s) == true))
+        errors = 0;
+      continue;
+    }
+    /**< the page is programmed after the reply, the pause is counted from there and includes the gap */
+    TIMER_Start(&s->timer, usclock());
+    TIMER_Add(&s->timer, s->timing.page_ms * 1000);
+    STATS_Page(&s->run, (uint32_t)(usclock() - sent), n / s->profile->page_size, n);
+    errors = 0;
+    APP_AdaptUnit(s, transfer, true);
+    APP_AdaptPace(s, true);
+    i += n;
+    *done += n / s->profile->page_size;
+    if (journal != NULL)
+      JOURNAL_Confirm(journal, i / s->profile->page_size);
+    PROGRESS_Update(&s->progress, *done);
+  }
+
+  return errors < s->profile->retries;
+}
+
+/** \brief Write loaded image, continue from the journal if resume is requested
+ *
+ * \param [in] s Session
+ * \return true if succeed
+ *
+ */
+static bool MSPROG_WriteImage(tSession *s)
+{
+  tJournal journal;
+  tTransfer transfer;
+  uint16_t done;
+  bool resumed;
+
+  JOURNAL_Init(&journal, &s->parameters, CRC32_Calc(s->fdata, s->len), s->pages);
+  done = 0;
+  if (s->parameters.resume != RESUME_NONE)
+    done = APP_Resume(s, &journal, s->fdata, s->parameters.resume);
+  resumed = (done > 0);
+  APP_NegotiateUnit(s, &transfer, &s->info, s->parameters.max_unit);
+  PROGRESS_Start(&s->progress, "Writing  FW: ", "write", done, s->pages, s->profile->page_size);
+  TIMER_Start(&s->timer, usclock());
+  if (MSPROG_WritePages(s, &transfer, done, s->pages, &journal, &done) == false)
+  {
+    PROGRESS_Break(&s->progress);
+    LOG_Print(LOG_LEVEL_ERROR, "Problem flashing Hex file");
+    if (JOURNAL_Save(&journal) == true)
+      LOG_Print(LOG_LEVEL_LAST, "Checkpoint saved at page %u of %u, use --resume to continue", journal.confirmed, s->pages);
+    return false;
+  }
+  JOURNAL_Remove(&journal);
+  /**< pages before the checkpoint were confirmed by an earlier run */
+  s->acked = (resumed == false) && APP_AckHasCrc(s);
+
+  return true;
+}
+
+/** \brief Write only the pages of the delta plan after the base firmware is confirmed by one range checksum,
+ *         the whole image is written if it can't be confirmed
+ *
+ * \param [in] s Session
+ * \return true if succeed
+ *
+ */
+static bool MSPROG_WritePlan(tSession *s)
+{
+  tPlan plan;
+  tTransfer transfer;
+  uint32_t crc;
+  uint16_t i, n;
+  uint16_t done = 0;
+  bool res = true;
+
+  if (PLAN_Load(&plan, s->parameters.plan) == false)
+    return false;
+  if ((plan.page_size != s->profile->page_size) || (plan.new_pages != s->pages) ||
+      (plan.new_hash != CRC32_Calc(s->fdata, (uint32_t)s->pages * s->profile->page_size)))
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "Delta plan %s was made for another image or page size", s->parameters.plan);
+    PLAN_Free(&plan);
+    return false;
+  }
+  if (APP_GetHash(s, 0, plan.old_pages, &crc) == false)
+  {
+    LOG_Print(LOG_LEVEL_WARNING, "Bootloader can't confirm the base firmware, writing the whole image");
+    PLAN_Free(&plan);
+    return MSPROG_WriteImage(s);
+  }
+  if (crc != plan.old_hash)
+  {
+    LOG_Print(LOG_LEVEL_WARNING, "Device doesn't run the base firmware of the plan (CRC32 %08X instead of %08X), "
+              "writing the whole image", crc, plan.old_hash);
+    PLAN_Free(&plan);
+    return MSPROG_WriteImage(s);
+  }
+  LOG_Print(LOG_LEVEL_INFO, "Base firmware confirmed, writing %u of %u pages", plan.cnt, s->pages);
+  APP_NegotiateUnit(s, &transfer, &s->info, s->parameters.max_unit);
+  PROGRESS_Start(&s->progress, "Writing  FW: ", "write", 0, plan.cnt, s->profile->page_size);
+  TIMER_Start(&s->timer, usclock());
+  /**< runs of consecutive pages are written like small images */
+  for (i = 0; (i < plan.cnt) && (res == true); i += n)
+  {
+    for (n = 1; (i + n < plan.cnt) && (plan.pages[i + n] == plan.pages[i] + n); n++);
+    res = MSPROG_WritePages(s, &transfer, plan.pages[i], plan.pages[i] + n, NULL, &done);
+  }
+  PLAN_Free(&plan);
+  if (res == false)
+  {
+    PROGRESS_Break(&s->progress);
+    LOG_Print(LOG_LEVEL_ERROR, "Problem flashing Hex file");
+    return false;
+  }
+  /**< the other pages are the same in both images and the base firmware was confirmed */
+  s->acked = APP_AckHasCrc(s);
+
+  return true;
+}
+
+/** \brief Write loaded or streamed image
+ *
+ * \param [in] session Session
+ * \return true if succeed
+ *
+ */
+bool MSPROG_Write(tSession *session)
+{
+  tSession *s = session;
+  uint64_t start;
+  bool res;
+
+  MSPROG_Enter(s);
+  s->acked = false;
+  if (MSPROG_Start(s) == false)
+  {
+    s->run.failed = true;
+    return false;
+  }
+  start = usclock();
+  if ((s->stream[0] != 0) && (s->parameters.plan[0] != 0))
+    LOG_Print(LOG_LEVEL_WARNING, "Delta plan can't be applied to a streamed image, writing it whole");
+  if (s->stream[0] != 0)
+    res = MSPROG_WriteStream(s);
+  else if (s->parameters.plan[0] != 0)
+    res = MSPROG_WritePlan(s);
+  else
+    res = MSPROG_WriteImage(s);
+  s->run.write_us += usclock() - start;
+  if (res == true)
+    s->run.done = true;
+  else
+    s->run.failed = true;
+  if (s->run.wire_bytes < s->run.sent_bytes)
+    LOG_Print(LOG_LEVEL_INFO, "Compressed transfers: %u of %u bytes on the wire (%u%%), %u kB/s effective",
+              (uint32_t)s->run.wire_bytes, (uint32_t)s->run.sent_bytes, (uint32_t)(s->run.wire_bytes * 100 / s->run.sent_bytes),
+              (uint32_t)(s->run.bytes * 1000 / (s->run.write_us + 1)));
+
+  return res;
+}
+
+/** \brief Compare loaded image or checksums of the written stream with the firmware
+ *
+ * \param [in] s Session
+ * \return true if the firmware is the same
+ *
+ */
+static bool MSPROG_VerifyImage(tSession *s)
+{
+  uint32_t i;
+  uint16_t crc;
+  uint8_t errors;
+
+  PROGRESS_Start(&s->progress, "Checking FW: ", "check", 0, s->pages, s->profile->page_size);
+  errors = 0;
+  i = 0;
+  while ((i < (uint32_t)s->pages * s->profile->page_size) & (errors < s->profile->retries))
+  {
+    if (s->crc != NULL)
+      crc = s->crc[i / s->profile->page_size];
+    else
+      crc = CRC16_CalcData(&s->fdata[i], s->profile->page_size);
+    if (APP_CheckPage(s, i / s->profile->page_size, crc) == false)
+    {
+      errors++;
+      s->run.retries[(s->fault == STATS_CAUSE_TIMEOUT) ? STATS_CAUSE_TIMEOUT : STATS_CAUSE_MISMATCH]++;
+      PROGRESS_Retry(&s->progress);
+      TIMER_Sleep(&s->timer, s->profile->gap_ms * 1000);
+      /**< only a silent target is restarted, a mismatch is a real difference */
+      if ((errors >= s->profile->retries) && (s->fault == STATS_CAUSE_TIMEOUT) && (MSPROG_Recover(s) == true))
+        errors = 0;
+      continue;
+    }
+    errors = 0;
+    s->run.pages_verified++;
+    i += s->profile->page_size;
+    PROGRESS_Update(&s->progress, i / s->profile->page_size);
+  }
+  if (errors >= s->profile->retries)
+  {
+    PROGRESS_Break(&s->progress);
+    LOG_Print(LOG_LEVEL_ERROR, "Hex file differs from the firmware");
+    return false;
+  }
+
+  return true;
+}
+
+/** \brief Compare image with the firmware by page checksums
+ *
+ * \param [in] session Session
+ * \return true if the firmware is the same
+ *
+ */
+bool MSPROG_Verify(tSession *session)
+{
+  tSession *s = session;
+  bool res;
+
+  MSPROG_Enter(s);
+  if (MSPROG_Start(s) == false)
+  {
+    s->run.failed = true;
+    return false;
+  }
+  if (s->acked == true)
+  {
+    LOG_Print(LOG_LEVEL_INFO, "Write replies confirmed the checksums of all %u pages, check pass skipped", s->pages);
+    s->run.pages_verified += s->pages;
+    res = true;
+  } else if ((s->stream[0] != 0) && (s->crc == NULL))
+  {
+    /**< a stream can't be read twice, after writing its page checksums are used */
+    res = MSPROG_VerifyStream(s);
+  } else
+  {
+    res = MSPROG_VerifyImage(s);
+  }
+  if (res == true)
+    s->run.done = true;
+  else
+    s->run.failed = true;
+
+  return res;
+}
+
+/** \brief Read the whole flash in transfer units and save it as Hex file
+ *
+ * \param [in] s Session
+ * \param [in] filename Name of the Hex file to create
+ * \return true if succeed
+ *
+ */
+static bool MSPROG_ReadImage(tSession *s, char *filename)
+{
+  tTransfer transfer;
+  uint8_t *data;
+  FILE *fp;
+  uint32_t size;
+  uint32_t i;
+  uint16_t n;
+  uint8_t errors;
+
+  if ((s->info.features & s->profile->features & PROFILE_FEATURE_READ) == 0)
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "Bootloader of %s doesn't support reading", s->profile->name);
+    return false;
+  }
+  size = s->profile->flash_size;
+  if ((data = malloc(size)) == NULL)
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "Unable to allocate %u bytes", size);
+    return false;
+  }
+
+  APP_NegotiateUnit(s, &transfer, &s->info, s->parameters.max_unit);
+  PROGRESS_Start(&s->progress, "Reading  FW: ", "read", 0, size / s->profile->page_size, s->profile->page_size);
+  errors = 0;
+  i = 0;
+  while ((i < size) && (errors < s->profile->retries))
+  {
+    n = transfer.unit;
+    if (n > size - i)
+      n = (uint16_t)(size - i);
+    if (APP_ReadFlash(s, i / s->profile->page_size, &data[i], n) == false)
+    {
+      s->run.retries[s->fault]++;
+      PROGRESS_Retry(&s->progress);
+      if (APP_AdaptUnit(s, &transfer, false) == false)
+        errors++;
+      /**< the rest of a broken transfer must not be taken for the next reply */
+      TIMER_Sleep(&s->timer, s->profile->gap_ms * 1000);
+      PHY_Flush(&s->phy);
+      if ((errors >= s->profile->retries) && (s->fault == STATS_CAUSE_TIMEOUT) && (MSPROG_Recover(s) == true))
+        errors = 0;
+      continue;
+    }
+    errors = 0;
+    APP_AdaptUnit(s, &transfer, true);
+    i += n;
+    PROGRESS_Update(&s->progress, i / s->profile->page_size);
+  }
+  if (errors >= s->profile->retries)
+  {
+    PROGRESS_Break(&s->progress);
+    LOG_Print(LOG_LEVEL_ERROR, "Problem reading firmware");
+    free(data);
+    return false;
+  }
+
+  if ((fp = fopen(filename, "wt")) == NULL)
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "Unable to create file: %s", filename);
+    free(data);
+    return false;
+  }
+  if ((IHEX_WriteFile(fp, data, size, 0) != IHEX_ERROR_NONE) | (fclose(fp) != 0))
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "Problem writing Hex file: %s", filename);
+    free(data);
+    return false;
+  }
+  free(data);
+  LOG_Print(LOG_LEVEL_INFO, "Firmware saved to %s", filename);
+
+  return true;
+}
+
+/** \brief Read the firmware back from the device
+ *
+ * \param [in] session Session
+ * \param [in] filename Name of the Hex file to create
+ * \return true if succeed
+ *
+ */
+bool MSPROG_Read(tSession *session, char *filename)
+{
+  tSession *s = session;
+  bool res = false;
+
+  MSPROG_Enter(s);
+  if (MSPROG_Boot(s) == true)
+    res = MSPROG_ReadImage(s, filename);
+  if (res == true)
+    s->run.done = true;
+  else
+    s->run.failed = true;
+
+  return res;
+}
+
+/** \brief Leave bootloader, close port and free the session
+ *
+ * \param [in] session Session, may be NULL
+ * \return Nothing
+ *
+ */
+void MSPROG_Close(tSession *session)
+{
+  if (session == NULL)
+    return;
+  MSPROG_Enter(session);
+  APP_LeaveBootloader(session);
+  /**< only timing proven by a successful run is kept */
+  if ((session->started == true) && (session->run.failed == false))
+    TIMING_Save(&session->timing);
+  TIMER_Report(&session->timer);
+  PHY_Close(&session->phy);
+  STATS_Add(&session->run, session->parameters.iface);
+  free(session->fdata);
+  free(session->crc);
+  free(session);
+}
+
+/** \brief Find devices on the bus
+ *
+ * \param [in] parameters Parameters with port, interface, baudrate and ID range
+ * \param [out] ids List of IDs which answered (MSPROG_SCAN_MAX_IDS entries)
+ * \return number of found devices
+ *
+ */
+uint8_t MSPROG_Scan(tParam *parameters, uint8_t *ids)
+{
+  tSession *s;
+  uint8_t found = 0;
+
+  if ((s = MSPROG_Create(parameters)) == NULL)
+    return 0;
+  s->parameters.bus_id = -1;
+  MSPROG_Enter(s);
+  if (APP_SetupAdapter(s) == true)
+    found = APP_Scan(s, ids);
+  PHY_Close(&s->phy);
+  STATS_Add(&s->run, s->parameters.iface);
+  free(s);
+
+  return found;
+}
@@ -0,0 +1,24 @@
+#ifndef MSPROG_H
+#define MSPROG_H
+
+#include "defines.h"
+
+#define MSPROG_SCAN_MAX_IDS (128)
+
+/**< Library interface: every session owns its port and buffers, so sessions may run
+ *   on separate threads. Profiles (PROFILE_LoadFile), logging (LOG_Start), progress
+ *   output (PROGRESS_Setup) and timing (TIMER_Setup) are process-wide and are set up
+ *   once before any session.
+ */
+typedef struct tSession tSession;
+
+tSession *MSPROG_Open(tParam *parameters);
+bool MSPROG_LoadImage(tSession *session, char *filename);
+bool MSPROG_IsSame(tSession *session);
+bool MSPROG_Write(tSession *session);
+bool MSPROG_Verify(tSession *session);
+bool MSPROG_Read(tSession *session, char *filename);
+void MSPROG_Close(tSession *session);
+uint8_t MSPROG_Scan(tParam *parameters, uint8_t *ids);
+
+#endif
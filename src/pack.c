@@ -0,0 +1,147 @@
+#include "pack.h"
+
+/** \brief Append pending literals to the packed data
+ *
+ * \param [in] src Literal bytes
+ * \param [in] len Number of literals, up to PACK_LITERAL_MAX
+ * \param [out] dst Packed data
+ * \param [in,out] out Length of packed data
+ * \param [in] maxlen Size of dst
+ * \return true if the literals fit into dst
+ *
+ */
+static bool PACK_Literals(uint8_t *src, uint16_t len, uint8_t *dst, uint16_t *out, uint16_t maxlen)
+{
+  if (len == 0)
+    return true;
+  if (*out + 1 + len > maxlen)
+    return false;
+  dst[(*out)++] = (uint8_t)(len - 1);
+  memcpy(&dst[*out], src, len);
+  *out += len;
+
+  return true;
+}
+
+/** \brief Hash of the three bytes a copy starts with
+ *
+ * \param [in] src Data
+ * \return hash value
+ *
+ */
+static uint16_t PACK_Hash(uint8_t *src)
+{
+  return (uint16_t)((src[0] << 4) ^ (src[1] << 2) ^ src[2]) & (PACK_HASH_SIZE - 1);
+}
+
+/** \brief Compress data with literal runs and short copies (distance 1 is a plain run-length)
+ *
+ * \param [in] src Data to compress
+ * \param [in] len Length of data, less than PACK_NONE
+ * \param [out] dst Packed data
+ * \param [in] maxlen Size of dst, compression is abandoned beyond it
+ * \return length of packed data, 0 if it doesn't fit into maxlen bytes
+ *
+ */
+uint16_t PACK_Compress(uint8_t *src, uint16_t len, uint8_t *dst, uint16_t maxlen)
+{
+  uint16_t pos = 0;
+  uint16_t lit = 0;
+  uint16_t out = 0;
+  uint16_t best, dist = 0;
+  uint16_t limit, cand, n;
+  uint16_t head[PACK_HASH_SIZE];
+  uint16_t prev[PACK_WINDOW];   /**< earlier position with the same hash, by position modulo window */
+
+  for (n = 0; n < PACK_HASH_SIZE; n++)
+    head[n] = PACK_NONE;
+  while (pos < len)
+  {
+    best = 0;
+    limit = (len - pos < PACK_MATCH_MAX) ? (len - pos) : PACK_MATCH_MAX;
+    if (limit >= PACK_MATCH_MIN)
+    {
+      /**< chain entries older than the window are overwritten, so the walk stops there */
+      for (cand = head[PACK_Hash(&src[pos])]; (cand != PACK_NONE) && (pos - cand <= PACK_WINDOW) && (best < limit);
+           cand = prev[cand % PACK_WINDOW])
+      {
+        for (n = 0; (n < limit) && (src[pos + n] == src[cand + n]); n++);
+        if (n > best)
+        {
+          best = n;
+          dist = pos - cand;
+        }
+      }
+    }
+    if (best < PACK_MATCH_MIN)
+      best = 1;
+    for (n = pos; (n < pos + best) && (n + PACK_MATCH_MIN <= len); n++)
+    {
+      prev[n % PACK_WINDOW] = head[PACK_Hash(&src[n])];
+      head[PACK_Hash(&src[n])] = n;
+    }
+    if (best < PACK_MATCH_MIN)
+    {
+      if (++pos - lit == PACK_LITERAL_MAX)
+      {
+        if (PACK_Literals(&src[lit], pos - lit, dst, &out, maxlen) == false)
+          return 0;
+        lit = pos;
+      }
+      continue;
+    }
+    if ((PACK_Literals(&src[lit], pos - lit, dst, &out, maxlen) == false) || (out + 2 > maxlen))
+      return 0;
+    dst[out++] = (uint8_t)(0x80 | (best - PACK_MATCH_MIN));
+    dst[out++] = (uint8_t)(dist - 1);
+    pos += best;
+    lit = pos;
+  }
+  if (PACK_Literals(&src[lit], pos - lit, dst, &out, maxlen) == false)
+    return 0;
+
+  return out;
+}
+
+/** \brief Decompress data packed by PACK_Compress(), the same loop fits into a bootloader
+ *
+ * \param [in] src Packed data
+ * \param [in] len Length of packed data
+ * \param [out] dst Unpacked data
+ * \param [in] maxlen Size of dst
+ * \return length of unpacked data, 0 if packed data is broken
+ *
+ */
+uint16_t PACK_Decompress(uint8_t *src, uint16_t len, uint8_t *dst, uint16_t maxlen)
+{
+  uint16_t pos = 0;
+  uint16_t out = 0;
+  uint16_t n, d;
+
+  while (pos < len)
+  {
+    if (src[pos] < 0x80)
+    {
+      n = src[pos++] + 1;
+      if ((pos + n > len) || (out + n > maxlen))
+        return 0;
+      memcpy(&dst[out], &src[pos], n);
+      pos += n;
+    } else
+    {
+      if (pos + 2 > len)
+        return 0;
+      n = (src[pos++] & 0x7F) + PACK_MATCH_MIN;
+      d = src[pos++] + 1;
+      if ((d > out) || (out + n > maxlen))
+        return 0;
+      /**< copies may overlap, so byte by byte */
+      for (; n > 0; n--, out++)
+        dst[out] = dst[out - d];
+      continue;
+    }
+    out += n;
+  }
+
+  return out;
+}
@@ -0,0 +1,16 @@
+#ifndef PACK_H
+#define PACK_H
+
+#include "defines.h"
+
+#define PACK_LITERAL_MAX    (128)   /**< token 0x00..0x7F: 1..128 literal bytes follow */
+#define PACK_MATCH_MIN      (3)     /**< token 0x80..0xFF: copy 3..130 bytes, distance byte follows */
+#define PACK_MATCH_MAX      (PACK_MATCH_MIN + 0x7F)
+#define PACK_WINDOW         (256)   /**< largest distance of a copy */
+#define PACK_HASH_SIZE      (4096)  /**< heads of the match chains */
+#define PACK_NONE           (0xFFFF)
+
+uint16_t PACK_Compress(uint8_t *src, uint16_t len, uint8_t *dst, uint16_t maxlen);
+uint16_t PACK_Decompress(uint8_t *src, uint16_t len, uint8_t *dst, uint16_t maxlen);
+
+#endif
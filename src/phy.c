@@ -1,22 +1,58 @@
 #include <unistd.h>
-#include "com.h"
 #include "log.h"
 #include "phy.h"
+#include "record.h"
 #include "sleep.h"
+#include "transport.h"
+
+/** \brief Fill receive buffer from the transport
+ *
+ * \param [in] phy Physical interface
+ * \return number of buffered bytes, 0 on timeout or -1 on error
+ *
+ */
+static int PHY_Fill(tPhy *phy)
+{
+  tChunk chunk;
+  int val;
+
+  if (phy->link.rx_pos < phy->link.rx_len)
+    return phy->link.rx_len - phy->link.rx_pos;
+  phy->link.rx_pos = 0;
+  phy->link.rx_len = 0;
+  val = phy->link.transport->read(&phy->link, phy->link.rx, TRANSPORT_RX_LEN);
+  if (val > 0)
+  {
+    phy->link.rx_len = (uint16_t)val;
+    chunk.data = phy->link.rx;
+    chunk.len = phy->link.rx_len;
+    RECORD_Frame(&phy->record, RECORD_DIR_RX, &chunk, 1);
+  }
+
+  return val;
+}
 
 /** \brief Initialize physical interface
  *
- * \param [in] port Port name as string
+ * \param [in] phy Physical interface
+ * \param [in] port Port name as string, backend is selected by prefix (tcp://, pty://)
  * \param [in] baudrate Transmission baudrate
  * \param [in] onDTR True if using DTR for power
  * \return true if success
  *
  */
-bool PHY_Init(char *port, uint32_t baudrate, bool onDTR)
+bool PHY_Init(tPhy *phy, char *port, uint32_t baudrate, bool onDTR)
 {
-  bool res = COM_Open(port, baudrate, false, false);
+  char *address;
+  bool res;
+
+  memset(phy, 0, sizeof(tPhy));
+  phy->link.fd = -1;
+  phy->link.peer_fd = -1;
+  phy->link.transport = TRANSPORT_Find(port, &address);
+  res = phy->link.transport->open(&phy->link, address, baudrate);
   if (res == true)
-    LOG_Print(LOG_LEVEL_LAST, "Opened %s at %u baud", port, baudrate);
+    LOG_Print(LOG_LEVEL_LAST, "Opened %s (%s) at %u baud", port, phy->link.transport->name, baudrate);
   else
     LOG_Print(LOG_LEVEL_ERROR, "Can't open port: %s", port);
   return res;
@@ -24,59 +60,246 @@ bool PHY_Init(char *port, uint32_t baudrate, bool onDTR)
 
 /** \brief Send data to physical interface
  *
+ * \param [in] phy Physical interface
  * \param [in] data Buffer with data
  * \param [in] len Length of data buffer
  * \return true if success
  *
  */
-bool PHY_Send(uint8_t *data, uint16_t len)
+bool PHY_Send(tPhy *phy, uint8_t *data, uint16_t len)
 {
-  COM_Write(data, len);
+  tChunk chunk = {data, len};
 
-  return true;
+  return PHY_SendFrame(phy, &chunk, 1);
+}
+
+/** \brief Send frame assembled from several parts with one write
+ *
+ * \param [in] phy Physical interface
+ * \param [in] chunks Parts of the frame
+ * \param [in] cnt Number of parts, up to TRANSPORT_MAX_CHUNKS
+ * \return true if success
+ *
+ */
+bool PHY_SendFrame(tPhy *phy, const tChunk *chunks, uint8_t cnt)
+{
+  RECORD_Frame(&phy->record, RECORD_DIR_TX, chunks, cnt);
+  return (phy->link.transport->write(&phy->link, chunks, cnt) == 0);
 }
 
 /** \brief Receive data from physical interface to data buffer
  *
+ * \param [in] phy Physical interface
  * \param [out] data Data buffer to write data in
  * \param [in] len Length of data to be received
  * \return true if success
  *
  */
-bool PHY_Receive(uint8_t *data, uint16_t len)
+bool PHY_Receive(tPhy *phy, uint8_t *data, uint16_t len)
 {
-  int val = COM_Read(data, len);
-  return (val == len);
+  uint16_t cnt;
+
+  while (len > 0)
+  {
+    if (PHY_Fill(phy) <= 0)
+      return false;
+    cnt = phy->link.rx_len - phy->link.rx_pos;
+    if (cnt > len)
+      cnt = len;
+    memcpy(data, &phy->link.rx[phy->link.rx_pos], cnt);
+    phy->link.rx_pos += cnt;
+    data += cnt;
+    len -= cnt;
+  }
+
+  return true;
 }
 
 /** \brief Receive line with end character
  *
+ * \param [in] phy Physical interface
  * \param line Pointer to received line
+ * \param size Size of the line buffer
  * \param end End character
+ * \param timeout Time to wait for the line in ms, 0 to stop at the first read timeout
  * \return True if succeed
  *
  */
-bool PHY_ReceiveLine(char *line, char endl)
+bool PHY_ReceiveLine(tPhy *phy, char *line, uint16_t size, char endl, uint32_t timeout)
 {
   char ch = 0;
+  uint16_t len = 0;
+  uint64_t deadline = usclock() + (uint64_t)timeout * 1000;
+  int val;
 
-  while (COM_Read((uint8_t*)&ch, 1) > 0)
+  while (1)
   {
+    if ((val = PHY_Fill(phy)) <= 0)
+    {
+      /**< a closed link won't deliver the rest of the line */
+      if ((val < 0) || (timeout == 0) || (usclock() >= deadline))
+        break;
+      continue;
+    }
+    ch = (char)phy->link.rx[phy->link.rx_pos++];
     if (ch == endl)
       break;
-    *line++ = ch;
+    if (len < size - 1)
+      line[len++] = ch;
   }
-  *line = 0;
+  line[len] = 0;
 
   return (ch == endl);
 }
 
+/** \brief Take one complete line from the receive buffer without waiting
+ *
+ * \param [in] phy Physical interface
+ * \param [out] line Buffer for the line
+ * \param [in] size Size of the line buffer
+ * \param [in] endl End character
+ * \param [in] fill Read the transport once before, only if it has data for sure
+ * \return 1 if a line was taken, 0 if there is no complete line or -1 on error
+ *
+ */
+int PHY_PollLine(tPhy *phy, char *line, uint16_t size, char endl, bool fill)
+{
+  tLink *link = &phy->link;
+  tChunk chunk;
+  uint16_t i;
+  int val;
+
+  if (fill)
+  {
+    /**< the unfinished line moves to the start, a line longer than the buffer is dropped */
+    memmove(link->rx, &link->rx[link->rx_pos], link->rx_len - link->rx_pos);
+    link->rx_len -= link->rx_pos;
+    link->rx_pos = 0;
+    if (link->rx_len == TRANSPORT_RX_LEN)
+      link->rx_len = 0;
+    val = link->transport->read(link, &link->rx[link->rx_len], TRANSPORT_RX_LEN - link->rx_len);
+    if (val < 0)
+      return -1;
+    chunk.data = &link->rx[link->rx_len];
+    chunk.len = (uint16_t)val;
+    if (val > 0)
+      RECORD_Frame(&phy->record, RECORD_DIR_RX, &chunk, 1);
+    link->rx_len += (uint16_t)val;
+  }
+  for (i = link->rx_pos; i < link->rx_len; i++)
+  {
+    if (link->rx[i] != (uint8_t)endl)
+      continue;
+    val = i - link->rx_pos;
+    if (val > size - 1)
+      val = size - 1;
+    memcpy(line, &link->rx[link->rx_pos], val);
+    line[val] = 0;
+    link->rx_pos = i + 1;
+    return 1;
+  }
+
+  return 0;
+}
+
+/** \brief Get descriptor to wait for received data on
+ *
+ * \param [in] phy Physical interface
+ * \return descriptor or -1 if the interface has none
+ *
+ */
+int PHY_GetFd(tPhy *phy)
+{
+  return phy->link.fd;
+}
+
+/** \brief Set timeout for receiving
+ *
+ * \param [in] phy Physical interface
+ * \param [in] ms Timeout in ms, 0 to restore the default one
+ * \return Nothing
+ *
+ */
+void PHY_SetTimeout(tPhy *phy, uint16_t ms)
+{
+  if (ms == 0)
+    ms = phy->link.default_timeout;
+  phy->link.transport->set_timeout(&phy->link, ms);
+}
+
+/** \brief Discard all received data
+ *
+ * \param [in] phy Physical interface
+ * \return Nothing
+ *
+ */
+void PHY_Flush(tPhy *phy)
+{
+  phy->link.rx_pos = 0;
+  phy->link.rx_len = 0;
+  phy->link.transport->flush(&phy->link);
+}
+
+/** \brief Wait until all sent data has left the interface
+ *
+ * \param [in] phy Physical interface
+ * \return true if the interface knows when data is sent
+ *
+ */
+bool PHY_Drain(tPhy *phy)
+{
+  if (phy->link.transport->drain == NULL)
+    return false;
+  phy->link.transport->drain(&phy->link);
+
+  return true;
+}
+
+/** \brief Check if reply latency of the interface can be lowered
+ *
+ * \param [in] phy Physical interface
+ * \return true if the interface is an USB serial adapter with tuning support
+ *
+ */
+bool PHY_IsTunable(tPhy *phy)
+{
+  return ((phy->link.transport->tune != NULL) && (phy->link.usb == true));
+}
+
+/** \brief Lower reply latency of the interface where permitted
+ *
+ * \param [in] phy Physical interface
+ * \return true if any setting was changed
+ *
+ */
+bool PHY_Tune(tPhy *phy)
+{
+  if (PHY_IsTunable(phy) == false)
+    return false;
+
+  return phy->link.transport->tune(&phy->link);
+}
+
+/** \brief Get time needed to transmit data with current baudrate
+ *
+ * \param [in] phy Physical interface
+ * \param [in] len Length of data
+ * \return time in ms
+ *
+ */
+uint16_t PHY_GetTransTime(tPhy *phy, uint16_t len)
+{
+  return (uint16_t)(len * 1000 * 11 / phy->link.baudrate + 1);
+}
+
 /** \brief Close physical interface
  *
+ * \param [in] phy Physical interface
  * \return Nothing
  *
  */
-void PHY_Close(void)
+void PHY_Close(tPhy *phy)
 {
-  COM_Close();
+  phy->link.transport->close(&phy->link);
+  RECORD_Stop(&phy->record);
 }
@@ -2,13 +2,31 @@
 #define PHY_H
 
 #include "defines.h"
+#include "record.h"
+#include "transport.h"
 
 #define PHY_BAUDRATE      (115200)
 
-bool PHY_Init(char *port, uint32_t baudrate, bool onDTR);
-bool PHY_Send(uint8_t *data, uint16_t len);
-bool PHY_Receive(uint8_t *data, uint16_t len);
-bool PHY_ReceiveLine(char *line, char endl);
-void PHY_Close(void);
+/**< one opened port, every session has its own */
+typedef struct
+{
+  tLink     link;
+  tRecord   record;
+} tPhy;
+
+bool PHY_Init(tPhy *phy, char *port, uint32_t baudrate, bool onDTR);
+bool PHY_Send(tPhy *phy, uint8_t *data, uint16_t len);
+bool PHY_SendFrame(tPhy *phy, const tChunk *chunks, uint8_t cnt);
+bool PHY_Receive(tPhy *phy, uint8_t *data, uint16_t len);
+bool PHY_ReceiveLine(tPhy *phy, char *line, uint16_t size, char endl, uint32_t timeout);
+int PHY_PollLine(tPhy *phy, char *line, uint16_t size, char endl, bool fill);
+int PHY_GetFd(tPhy *phy);
+void PHY_SetTimeout(tPhy *phy, uint16_t ms);
+void PHY_Flush(tPhy *phy);
+bool PHY_Drain(tPhy *phy);
+bool PHY_IsTunable(tPhy *phy);
+bool PHY_Tune(tPhy *phy);
+uint16_t PHY_GetTransTime(tPhy *phy, uint16_t len);
+void PHY_Close(tPhy *phy);
 
 #endif
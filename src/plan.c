@@ -0,0 +1,148 @@
+#include <stdlib.h>
+#include "app.h"
+#include "crc16.h"
+#include "crc32.h"
+#include "log.h"
+#include "plan.h"
+
+/** \brief Compare two images page by page and save the differing pages as delta plan
+ *
+ * The plan is a text file: header, page size, number of pages and CRC32 of both
+ * images, then one line "page N OLD NEW" with the CRC16 of both versions per differing page
+ *
+ * \param [in] old_file Hex file with the firmware the devices run
+ * \param [in] new_file Hex file with the new firmware
+ * \param [in] profile Device profile for the page size
+ * \param [in] filename Name of the plan file to create
+ * \return true if succeed
+ *
+ */
+bool PLAN_Make(char *old_file, char *new_file, tProfile *profile, char *filename)
+{
+  uint32_t maxlen = PROFILE_GetMaxFlash();
+  uint16_t page_size = profile->page_size;
+  uint8_t *old_data = malloc(maxlen);
+  uint8_t *new_data = malloc(maxlen);
+  uint32_t old_len = 0;
+  uint32_t new_len = 0;
+  uint16_t old_pages, new_pages;
+  uint16_t page, cnt = 0;
+  FILE *fp;
+  bool res = false;
+
+  if ((old_data == NULL) || (new_data == NULL))
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "Unable to allocate image buffers");
+  } else if ((APP_OpenFile(old_file, old_data, maxlen, &old_len) == true) &&
+             (APP_OpenFile(new_file, new_data, maxlen, &new_len) == true))
+  {
+    if ((old_len == 0) || (new_len == 0))
+    {
+      LOG_Print(LOG_LEVEL_ERROR, "Hex file is empty");
+    } else if ((old_len > profile->flash_size) || (new_len > profile->flash_size))
+    {
+      LOG_Print(LOG_LEVEL_ERROR, "Hex file is larger than flash of %s", profile->name);
+    } else if ((fp = fopen(filename, "wt")) == NULL)
+    {
+      LOG_Print(LOG_LEVEL_ERROR, "Unable to create file: %s", filename);
+    } else
+    {
+      /**< both buffers are zero-filled, so pages beyond the base firmware always differ */
+      old_pages = (old_len - 1) / page_size + 1;
+      new_pages = (new_len - 1) / page_size + 1;
+      fprintf(fp, "%s\n", PLAN_HEADER);
+      fprintf(fp, "page_size %u\n", page_size);
+      fprintf(fp, "old %u %08X\n", old_pages, CRC32_Calc(old_data, (uint32_t)old_pages * page_size));
+      fprintf(fp, "new %u %08X\n", new_pages, CRC32_Calc(new_data, (uint32_t)new_pages * page_size));
+      for (page = 0; page < new_pages; page++)
+      {
+        if (memcmp(&old_data[(uint32_t)page * page_size], &new_data[(uint32_t)page * page_size], page_size) == 0)
+          continue;
+        fprintf(fp, "page %u %04X %04X\n", page, CRC16_CalcData(&old_data[(uint32_t)page * page_size], page_size),
+                CRC16_CalcData(&new_data[(uint32_t)page * page_size], page_size));
+        cnt++;
+      }
+      res = (ferror(fp) == 0);
+      if (fclose(fp) != 0)
+        res = false;
+      if (res == true)
+        LOG_Print(LOG_LEVEL_LAST, "Delta plan: %u of %u pages differ, saved to %s", cnt, new_pages, filename);
+      else
+        LOG_Print(LOG_LEVEL_ERROR, "Unable to write file: %s", filename);
+    }
+  }
+  free(old_data);
+  free(new_data);
+
+  return res;
+}
+
+/** \brief Load delta plan
+ *
+ * \param [out] plan Plan, must be freed with PLAN_Free() if loaded
+ * \param [in] filename Name of the plan file
+ * \return true if succeed
+ *
+ */
+bool PLAN_Load(tPlan *plan, char *filename)
+{
+  char str[128];
+  unsigned int a, b, c;
+  bool header = false;
+  bool res = true;
+  FILE *fp;
+
+  memset(plan, 0, sizeof(tPlan));
+  if ((fp = fopen(filename, "rt")) == NULL)
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "Unable to open file: %s", filename);
+    return false;
+  }
+  if ((fgets(str, sizeof(str), fp) != NULL) && (strncmp(str, PLAN_HEADER, strlen(PLAN_HEADER)) == 0))
+    header = true;
+  while (header && res && (fgets(str, sizeof(str), fp) != NULL))
+  {
+    if (sscanf(str, "page_size %u", &a) == 1)
+    {
+      plan->page_size = (uint16_t)a;
+    } else if (sscanf(str, "old %u %x", &a, &b) == 2)
+    {
+      plan->old_pages = (uint16_t)a;
+      plan->old_hash = (uint32_t)b;
+    } else if ((sscanf(str, "new %u %x", &a, &b) == 2) && (plan->pages == NULL))
+    {
+      plan->new_pages = (uint16_t)a;
+      plan->new_hash = (uint32_t)b;
+      plan->pages = malloc(((size_t)a + 1) * sizeof(uint16_t));
+      res = (plan->pages != NULL);
+    } else if (sscanf(str, "page %u %x %x", &a, &b, &c) == 3)
+    {
+      /**< pages follow the image sizes, each one once and in ascending order */
+      res = (plan->pages != NULL) && (a < plan->new_pages) && ((plan->cnt == 0) || (a > plan->pages[plan->cnt - 1]));
+      if (res == true)
+        plan->pages[plan->cnt++] = (uint16_t)a;
+    }
+  }
+  fclose(fp);
+  if ((header == false) || (res == false) || (plan->page_size == 0) || (plan->old_pages == 0) || (plan->pages == NULL))
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "Delta plan %s has wrong format", filename);
+    PLAN_Free(plan);
+    return false;
+  }
+
+  return true;
+}
+
+/** \brief Free loaded plan
+ *
+ * \param [in] plan Plan
+ * \return Nothing
+ *
+ */
+void PLAN_Free(tPlan *plan)
+{
+  free(plan->pages);
+  plan->pages = NULL;
+  plan->cnt = 0;
+}
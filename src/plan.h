@@ -0,0 +1,25 @@
+#ifndef PLAN_H
+#define PLAN_H
+
+#include "defines.h"
+#include "profile.h"
+
+#define PLAN_HEADER         "MSPROG-PLAN 1"
+
+/**< pages differing between the base firmware and the new image */
+typedef struct
+{
+  uint16_t  page_size;
+  uint16_t  old_pages;
+  uint32_t  old_hash;       /**< CRC32 of the base firmware pages */
+  uint16_t  new_pages;
+  uint32_t  new_hash;       /**< CRC32 of the new image pages */
+  uint16_t  cnt;
+  uint16_t  *pages;         /**< differing pages in ascending order */
+} tPlan;
+
+bool PLAN_Make(char *old_file, char *new_file, tProfile *profile, char *filename);
+bool PLAN_Load(tPlan *plan, char *filename);
+void PLAN_Free(tPlan *plan);
+
+#endif
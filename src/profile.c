@@ -0,0 +1,156 @@
+#include "log.h"
+#include "profile.h"
+
+/**< features every built-in bootloader version may have */
+#define PROFILE_FEATURES_COMMON (PROFILE_FEATURE_HASH | PROFILE_FEATURE_READ | PROFILE_FEATURE_PACK | PROFILE_FEATURE_ACK_CRC)
+
+/**< built-in profiles, "generic" keeps the worst case pacing for unknown devices; the DA15 devices
+ *   use it as well until their timing is measured, a profiles file may raise unit and pacing */
+static tProfile PROFILE_List[PROFILE_MAX] =
+{
+  /* name      flash         page  unit  boot  off  page gap retries features */
+  {"generic",  1024UL * 128, 256,  256,  50,   500, 5,   1,  4,      PROFILE_FEATURES_COMMON},
+  {"DA15A",    1024UL * 128, 256,  256,  50,   500, 5,   1,  4,      PROFILE_FEATURE_BULK | PROFILE_FEATURES_COMMON},
+  {"DA15T",    1024UL * 128, 256,  256,  50,   500, 5,   1,  4,      PROFILE_FEATURE_BULK | PROFILE_FEATURES_COMMON},
+  {"DA15NT",   1024UL * 128, 256,  256,  50,   500, 5,   1,  4,      PROFILE_FEATURE_BULK | PROFILE_FEATURES_COMMON},
+};
+
+static uint8_t PROFILE_Number = 4;
+
+/** \brief Find profile by name (case insensitive)
+ *
+ * \param [in] name Profile name
+ * \return pointer to the profile or NULL if not found
+ *
+ */
+tProfile *PROFILE_Find(char *name)
+{
+  uint8_t i;
+  uint8_t x;
+
+  for (i = 0; i < PROFILE_Number; i++)
+  {
+    for (x = 0; (name[x] != 0) && (toupper((unsigned char)name[x]) == toupper((unsigned char)PROFILE_List[i].name[x])); x++);
+    if ((name[x] == 0) && (PROFILE_List[i].name[x] == 0))
+      return &PROFILE_List[i];
+  }
+
+  return NULL;
+}
+
+/** \brief Get profile for unknown devices
+ *
+ * \return pointer to the default profile
+ *
+ */
+tProfile *PROFILE_GetDefault(void)
+{
+  return PROFILE_Find(PROFILE_DEFAULT);
+}
+
+/** \brief Get largest flash size of all known profiles
+ *
+ * \return flash size in bytes
+ *
+ */
+uint32_t PROFILE_GetMaxFlash(void)
+{
+  uint8_t i;
+  uint32_t res = 0;
+
+  for (i = 0; i < PROFILE_Number; i++)
+  {
+    if (PROFILE_List[i].flash_size > res)
+      res = PROFILE_List[i].flash_size;
+  }
+
+  return res;
+}
+
+/** \brief Load additional profiles from text file, profiles with known names are replaced
+ *
+ * Every line has the format (numbers are decimal, features are hex, '#' starts a comment):
+ * name flash_size page_size max_unit boot_ms power_off_ms page_ms gap_ms retries features
+ *
+ * \param [in] filename Name of the file
+ * \return true if succeed
+ *
+ */
+bool PROFILE_LoadFile(char *filename)
+{
+  FILE *fp;
+  char str[128];
+  char name[DEVICE_LEN];
+  unsigned int flash, page, unit, boot, off, page_ms, gap, retries, features;
+  uint16_t line = 0;
+  tProfile *prof;
+
+  if ((fp = fopen(filename, "rt")) == NULL)
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "Unable to open profiles file: %s", filename);
+    return false;
+  }
+  while (fgets(str, sizeof(str), fp) != NULL)
+  {
+    line++;
+    str[strcspn(str, "#\r\n")] = 0;
+    if (strspn(str, " \t") == strlen(str))
+      continue;
+    if ((sscanf(str, "%15s %u %u %u %u %u %u %u %u %x", name, &flash, &page, &unit, &boot, &off,
+                &page_ms, &gap, &retries, &features) != 10) ||
+        (page == 0) || (page > UINT16_MAX) || (unit < page) || (unit > UINT16_MAX) || (flash % page != 0) ||
+        (boot > UINT16_MAX) || (off > UINT16_MAX) || (page_ms > UINT8_MAX) || (gap > UINT8_MAX) ||
+        (retries == 0) || (retries > UINT8_MAX) || (features > UINT16_MAX))
+    {
+      LOG_Print(LOG_LEVEL_ERROR, "Wrong profile in %s, line %u", filename, line);
+      fclose(fp);
+      return false;
+    }
+    prof = PROFILE_Find(name);
+    if (prof == NULL)
+    {
+      if (PROFILE_Number >= PROFILE_MAX)
+      {
+        LOG_Print(LOG_LEVEL_ERROR, "Too many profiles in %s", filename);
+        fclose(fp);
+        return false;
+      }
+      prof = &PROFILE_List[PROFILE_Number++];
+    }
+    strcpy(prof->name, name);
+    prof->flash_size = flash;
+    prof->page_size = (uint16_t)page;
+    prof->max_unit = (uint16_t)(unit - unit % page);
+    prof->boot_ms = (uint16_t)boot;
+    prof->power_off_ms = (uint16_t)off;
+    prof->page_ms = (uint8_t)page_ms;
+    prof->gap_ms = (uint8_t)gap;
+    prof->retries = (uint8_t)retries;
+    prof->features = (uint16_t)features;
+  }
+  fclose(fp);
+
+  return true;
+}
+
+/** \brief Get number of known profiles
+ *
+ * \return number of profiles as uint8_t
+ *
+ */
+uint8_t PROFILE_GetNumber(void)
+{
+  return PROFILE_Number;
+}
+
+/** \brief Get profile name by number
+ *
+ * \return Profile name as string
+ *
+ */
+char *PROFILE_GetNameByNumber(uint8_t number)
+{
+  if (number >= PROFILE_Number)
+    number = 0;
+  return PROFILE_List[number].name;
+}
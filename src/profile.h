@@ -0,0 +1,36 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include "defines.h"
+
+#define PROFILE_MAX             (16)
+#define PROFILE_DEFAULT         "generic"
+
+#define PROFILE_FEATURE_BULK    (1U << 0)
+#define PROFILE_FEATURE_HASH    (1U << 1)   /**< CRC32 of a page range */
+#define PROFILE_FEATURE_READ    (1U << 2)   /**< flash readback */
+#define PROFILE_FEATURE_PACK    (1U << 3)   /**< compressed transfers */
+#define PROFILE_FEATURE_ACK_CRC (1U << 4)   /**< write replies carry CRC16 of the programmed data */
+
+typedef struct
+{
+  char      name[DEVICE_LEN];
+  uint32_t  flash_size;     /**< bytes available for the application */
+  uint16_t  page_size;      /**< flash page size in bytes */
+  uint16_t  max_unit;       /**< largest transfer unit in bytes */
+  uint16_t  boot_ms;        /**< time from power on to bootloader ready */
+  uint16_t  power_off_ms;   /**< time to keep power off for a clean reset */
+  uint8_t   page_ms;        /**< pause after each page programming */
+  uint8_t   gap_ms;         /**< pause before each transfer and after errors */
+  uint8_t   retries;        /**< consecutive errors before giving up */
+  uint16_t  features;       /**< PROFILE_FEATURE_xxx allowed for the device */
+} tProfile;
+
+bool PROFILE_LoadFile(char *filename);
+tProfile *PROFILE_Find(char *name);
+tProfile *PROFILE_GetDefault(void);
+uint32_t PROFILE_GetMaxFlash(void);
+uint8_t PROFILE_GetNumber(void);
+char *PROFILE_GetNameByNumber(uint8_t number);
+
+#endif
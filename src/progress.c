@@ -1,44 +1,292 @@
 #include <stdio.h>
 #include <string.h>
+#ifdef __linux
+#include <poll.h>
+#endif
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "log.h"
 #include "progress.h"
+#include "sleep.h"
 
-/** \brief Print progress bar with prefix
+static uint32_t PROGRESS_IntervalUs = 1000000UL / PROGRESS_RATE_DEFAULT;
+static bool PROGRESS_Human = true;
+static int PROGRESS_Fd = -1;
+static atomic_uint PROGRESS_Dropped;
+static pthread_mutex_t PROGRESS_Lock = PTHREAD_MUTEX_INITIALIZER;
+static char PROGRESS_Tail[PROGRESS_LINE_LEN];  /**< rest of a line the reader didn't take completely */
+static int PROGRESS_TailLen;
+
+/** \brief Configure progress output
  *
- * \param [in] iteration Current iteration
- * \param [in] total Total number of iterations
- * \param [in] prefix Prefix text
- * \param [in] fill Char to use for filling the bar
- * \return Noting
+ * \param [in] rate Maximal number of redraws per second, 0 switches terminal bar off
+ * \param [in] fd File descriptor for JSON lines stream or -1
+ * \return Nothing
+ *
+ */
+void PROGRESS_Setup(uint8_t rate, int fd)
+{
+  PROGRESS_Human = (rate > 0);
+  if (rate > 0)
+    PROGRESS_IntervalUs = 1000000UL / rate;
+  PROGRESS_Fd = fd;
+}
+
+/** \brief Check if the progress stream takes data without blocking
+ *
+ * The descriptor may be shared with stdout, so its flags are never changed
+ *
+ * \return true if writing doesn't block
+ *
+ */
+static bool PROGRESS_Ready(void)
+{
+  #ifdef __linux
+  struct pollfd pfd;
+
+  pfd.fd = PROGRESS_Fd;
+  pfd.events = POLLOUT;
+  pfd.revents = 0;
+
+  return (poll(&pfd, 1, 0) == 1) && (pfd.revents & POLLOUT);
+  #else
+  return true;
+  #endif
+}
+
+/** \brief Write the rest of a cut line
+ *
+ * \param [in] wait Block until the whole rest is written
+ * \return Nothing
+ *
+ */
+static void PROGRESS_WriteTail(bool wait)
+{
+  ssize_t n;
+
+  while ((PROGRESS_TailLen > 0) && (wait || PROGRESS_Ready()))
+  {
+    if ((n = write(PROGRESS_Fd, PROGRESS_Tail, PROGRESS_TailLen)) <= 0)
+      break;
+    PROGRESS_TailLen -= (int)n;
+    memmove(PROGRESS_Tail, &PROGRESS_Tail[n], PROGRESS_TailLen);
+    if (wait == false)
+      break;
+  }
+}
+
+/** \brief Write one line to the progress stream, the reader never sees half a line
+ *
+ * \param [in] line Line with line end
+ * \param [in] len Length of the line
+ * \param [in] last Last line of the phase, it is completed even if the reader is slow
+ * \return Nothing
+ *
+ */
+static void PROGRESS_Write(char *line, int len, bool last)
+{
+  ssize_t n = 0;
+
+  pthread_mutex_lock(&PROGRESS_Lock);
+  PROGRESS_WriteTail(false);
+  /**< a slow reader on the other side must not stall the flashing, whole lines are dropped */
+  if ((PROGRESS_TailLen == 0) && (PROGRESS_Ready() == true))
+    n = write(PROGRESS_Fd, line, len);
+  if (n <= 0)
+  {
+    atomic_fetch_add(&PROGRESS_Dropped, 1);
+  } else if (n < len)
+  {
+    PROGRESS_TailLen = len - (int)n;
+    memcpy(PROGRESS_Tail, &line[n], PROGRESS_TailLen);
+  }
+  if (last == true)
+    PROGRESS_WriteTail(true);
+  pthread_mutex_unlock(&PROGRESS_Lock);
+}
+
+/** \brief Take throughput sample for the current iteration
+ *
+ * \param [in,out] p Progress state
+ * \param [in] now Current time in microseconds
+ * \return Nothing
+ *
+ */
+static void PROGRESS_Sample(tProgress *p, uint64_t now)
+{
+  uint32_t bytes = (uint32_t)p->iteration * p->unit;
+  uint64_t dt = now - p->last_us;
+
+  if (dt > 0 && bytes > p->last_bytes)
+  {
+    p->rate = (uint32_t)((uint64_t)(bytes - p->last_bytes) * 1000000UL / dt);
+    if (p->avg_rate == 0)
+      p->avg_rate = p->rate;
+    else
+      p->avg_rate = (uint32_t)((int32_t)p->avg_rate + (((int32_t)p->rate - (int32_t)p->avg_rate) >> PROGRESS_AVG_SHIFT));
+  }
+  p->last_us = now;
+  p->last_bytes = bytes;
+}
+
+/** \brief Draw progress bar with prefix on the terminal
+ *
+ * \param [in,out] p Progress state
+ * \return Nothing
  *
  */
-void PROGRESS_Print(uint16_t iteration, uint16_t total, char *prefix, char fill)
+static void PROGRESS_Draw(tProgress *p)
 {
   uint8_t filledLength;
-  float percent;
+  uint16_t percent;
   char bar[PROGRESS_BAR_LENGTH + 1];
   char bar2[PROGRESS_BAR_LENGTH + 1];
 
-  memset(bar, fill, PROGRESS_BAR_LENGTH);
+  memset(bar, PROGRESS_FILL, PROGRESS_BAR_LENGTH);
   bar[PROGRESS_BAR_LENGTH] = 0;
   memset(bar2, ' ', PROGRESS_BAR_LENGTH);
   bar2[PROGRESS_BAR_LENGTH] = 0;
-  percent = (float)iteration / total * 100;
-  filledLength = (uint8_t)(PROGRESS_BAR_LENGTH * iteration / total);
+  if (p->total > 0)
+  {
+    percent = (uint16_t)((uint32_t)p->iteration * 1000 / p->total);
+    filledLength = (uint8_t)(PROGRESS_BAR_LENGTH * (uint32_t)p->iteration / p->total);
+  } else
+  {
+    percent = 1000;
+    filledLength = PROGRESS_BAR_LENGTH;
+  }
 
-  printf("\r%s [%.*s%.*s] %.1f%%", prefix, filledLength, bar, PROGRESS_BAR_LENGTH - filledLength, bar2, percent);
+  /**< queued log lines must appear before the bar on the same terminal */
+  LOG_Flush();
+  if (p->total == 0)
+  {
+    /**< length of a streamed image is not known until its end */
+    printf("\r%s %u pages %u.%u kB/s ", p->prefix, p->iteration, p->avg_rate / 1000, p->avg_rate % 1000 / 100);
+    fflush(stdout);
+    return;
+  }
+  printf("\r%s [%.*s%.*s] %u.%u%% %u.%u kB/s ", p->prefix, filledLength, bar, PROGRESS_BAR_LENGTH - filledLength, bar2,
+         percent / 10, percent % 10, p->avg_rate / 1000, p->avg_rate % 1000 / 100);
   fflush(stdout);
 
   // Print New Line on Complete
-  if (iteration >= total)
+  if (p->iteration >= p->total)
     printf("\n");
 }
 
+/** \brief Emit one JSON line with the current state to the progress stream
+ *
+ * \param [in,out] p Progress state
+ * \param [in] now Current time in microseconds
+ * \param [in] state State name ("run", "done" or "failed")
+ * \return Nothing
+ *
+ */
+static void PROGRESS_Emit(tProgress *p, uint64_t now, char *state)
+{
+  char line[PROGRESS_LINE_LEN];
+  uint32_t bytes = (uint32_t)p->iteration * p->unit;
+  uint32_t total_bytes = (uint32_t)p->total * p->unit;
+  uint32_t eta_ms = 0;
+  int len;
+
+  if (p->avg_rate > 0 && total_bytes > bytes)
+    eta_ms = (uint32_t)((uint64_t)(total_bytes - bytes) * 1000 / p->avg_rate);
+  len = snprintf(line, sizeof(line),
+                 "{\"phase\":\"%s\",\"state\":\"%s\",\"page\":%u,\"pages\":%u,\"bytes\":%u,\"total_bytes\":%u,"
+                 "\"rate\":%u,\"avg_rate\":%u,\"eta_ms\":%u,\"retries\":%u,\"elapsed_ms\":%u,\"dropped\":%u}\n",
+                 p->phase, state, p->iteration, p->total, bytes, total_bytes,
+                 p->rate, p->avg_rate, eta_ms, p->retries, (uint32_t)((now - p->start_us) / 1000), atomic_load(&PROGRESS_Dropped));
+  if (len <= 0 || len >= (int)sizeof(line))
+    return;
+  PROGRESS_Write(line, len, strcmp(state, "run") != 0);
+}
+
+/** \brief Start new progress phase
+ *
+ * \param [in,out] p Progress state
+ * \param [in] prefix Prefix text for the terminal bar
+ * \param [in] phase Phase name for the JSON stream
+ * \param [in] first First iteration (already done before this phase)
+ * \param [in] total Total number of iterations, 0 if not known yet
+ * \param [in] unit Number of bytes per iteration
+ * \return Nothing
+ *
+ */
+void PROGRESS_Start(tProgress *p, char *prefix, char *phase, uint16_t first, uint16_t total, uint32_t unit)
+{
+  memset(p, 0, sizeof(tProgress));
+  p->prefix = prefix;
+  p->phase = phase;
+  p->iteration = first;
+  p->total = total;
+  p->unit = unit;
+  p->last_bytes = (uint32_t)first * unit;
+  p->start_us = usclock();
+  p->last_us = p->start_us;
+  if (PROGRESS_Human)
+    PROGRESS_Draw(p);
+  if (PROGRESS_Fd >= 0)
+    PROGRESS_Emit(p, p->start_us, "run");
+}
+
+/** \brief Update progress, output is rate-limited except for the last iteration
+ *
+ * \param [in,out] p Progress state
+ * \param [in] iteration Current iteration
+ * \return Nothing
+ *
+ */
+void PROGRESS_Update(tProgress *p, uint16_t iteration)
+{
+  uint64_t now;
+
+  p->iteration = iteration;
+  now = usclock();
+  if (((p->total == 0) || (iteration < p->total)) && (now - p->last_us < PROGRESS_IntervalUs))
+    return;
+  PROGRESS_Sample(p, now);
+  if (PROGRESS_Human)
+    PROGRESS_Draw(p);
+  if (PROGRESS_Fd >= 0)
+    PROGRESS_Emit(p, now, ((p->total > 0) && (iteration >= p->total)) ? "done" : "run");
+}
+
+/** \brief Finish phase with the total which was not known at the start
+ *
+ * \param [in,out] p Progress state
+ * \param [in] total Total number of iterations
+ * \return Nothing
+ *
+ */
+void PROGRESS_Finish(tProgress *p, uint16_t total)
+{
+  p->total = total;
+  PROGRESS_Update(p, total);
+}
+
+/** \brief Count one retry in the current phase
+ *
+ * \param [in,out] p Progress state
+ * \return Nothing
+ *
+ */
+void PROGRESS_Retry(tProgress *p)
+{
+  p->retries++;
+}
+
 /** \brief Do break in the output
  *
+ * \param [in,out] p Progress state
  * \return Nothing
  *
  */
-void PROGRESS_Break(void)
+void PROGRESS_Break(tProgress *p)
 {
-  printf("\n");
+  if (PROGRESS_Human)
+    printf("\n");
+  if (PROGRESS_Fd >= 0)
+    PROGRESS_Emit(p, usclock(), "failed");
 }
@@ -5,8 +5,32 @@
 #include <stdbool.h>
 
 #define PROGRESS_BAR_LENGTH   (20)
+#define PROGRESS_FILL         '#'
+#define PROGRESS_RATE_DEFAULT (10)
+#define PROGRESS_AVG_SHIFT    (3)
+#define PROGRESS_LINE_LEN     (256)
 
-void PROGRESS_Print(uint16_t iteration, uint16_t total, char *prefix, char fill);
-void PROGRESS_Break(void);
+/**< state of one progress phase, every session has its own */
+typedef struct
+{
+  char      *prefix;
+  char      *phase;
+  uint16_t  iteration;
+  uint16_t  total;
+  uint32_t  unit;
+  uint32_t  retries;
+  uint64_t  start_us;
+  uint64_t  last_us;
+  uint32_t  last_bytes;
+  uint32_t  rate;
+  uint32_t  avg_rate;
+} tProgress;
+
+void PROGRESS_Setup(uint8_t rate, int fd);
+void PROGRESS_Start(tProgress *p, char *prefix, char *phase, uint16_t first, uint16_t total, uint32_t unit);
+void PROGRESS_Update(tProgress *p, uint16_t iteration);
+void PROGRESS_Finish(tProgress *p, uint16_t total);
+void PROGRESS_Retry(tProgress *p);
+void PROGRESS_Break(tProgress *p);
 
 #endif
@@ -0,0 +1,130 @@
+#ifdef __linux
+#define _DEFAULT_SOURCE
+#define _XOPEN_SOURCE 600
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <termios.h>
+#include "log.h"
+#include "transport.h"
+
+/** \brief Create pseudo-terminal for a device emulator
+ *
+ * The emulator opens the slave side as if it was a serial port, the name of the slave
+ * is logged and may be published as a symbolic link, e.g. "pty:///tmp/msprog-dev"
+ *
+ * \param [in] link Link to open
+ * \param [in] address Name of the symbolic link to the slave side, may be empty
+ * \param [in] baudrate Emulated baudrate, used for timing only
+ * \return true if succeed
+ *
+ */
+static bool PTY_Open(tLink *link, char *address, uint32_t baudrate)
+{
+  struct termios settings;
+  char *slave;
+  int fd;
+
+  fd = posix_openpt(O_RDWR | O_NOCTTY);
+  if (fd < 0)
+    return false;
+  if ((grantpt(fd) != 0) || (unlockpt(fd) != 0) || ((slave = ptsname(fd)) == NULL))
+  {
+    close(fd);
+    return false;
+  }
+  /* keep the slave opened, otherwise reading the master fails until the emulator attaches */
+  link->peer_fd = open(slave, O_RDWR | O_NOCTTY);
+  if (link->peer_fd < 0)
+  {
+    close(fd);
+    return false;
+  }
+  tcgetattr(link->peer_fd, &settings);
+  cfmakeraw(&settings);
+  tcsetattr(link->peer_fd, TCSANOW, &settings);
+  if (address[0] != 0)
+  {
+    unlink(address);
+    if (symlink(slave, address) != 0)
+      LOG_Print(LOG_LEVEL_WARNING, "Can't create link %s: %s", address, strerror(errno));
+    else
+      link->priv = strdup(address);
+  }
+  LOG_Print(LOG_LEVEL_LAST, "Device side of pseudo-terminal: %s", slave);
+  link->fd = fd;
+  link->baudrate = baudrate;
+  link->default_timeout = TRANSPORT_TIMEOUT_MS;
+  link->timeout = link->default_timeout;
+
+  return true;
+}
+
+/** \brief Send frame to the emulator
+ *
+ * \param [in] link Opened link
+ * \param [in] chunks Parts of the frame
+ * \param [in] cnt Number of parts
+ * \return 0 if everything Ok
+ *
+ */
+static int PTY_Write(tLink *link, const tChunk *chunks, uint8_t cnt)
+{
+  return TRANSPORT_WriteFd(link, chunks, cnt, -1);
+}
+
+/** \brief Set read timeout
+ *
+ * \param [in] link Opened link
+ * \param [in] ms Time to wait for the first byte in milliseconds
+ * \return Nothing
+ *
+ */
+static void PTY_SetTimeout(tLink *link, uint16_t ms)
+{
+  link->timeout = ms;
+}
+
+/** \brief Discard all received and not yet read data
+ *
+ * \param [in] link Opened link
+ * \return Nothing
+ *
+ */
+static void PTY_Flush(tLink *link)
+{
+  tcflush(link->fd, TCIFLUSH);
+}
+
+/** \brief Close pseudo-terminal
+ *
+ * \param [in] link Opened link
+ * \return Nothing
+ *
+ */
+static void PTY_Close(tLink *link)
+{
+  LOG_Print(LOG_LEVEL_INFO, "Closing pseudo-terminal");
+  if (link->priv != NULL)
+  {
+    unlink(link->priv);
+    free(link->priv);
+  }
+  close(link->peer_fd);
+  close(link->fd);
+}
+
+const tTransport PTY_Transport =
+{
+  "pty",
+  "pty://",
+  PTY_Open,
+  PTY_Write,
+  TRANSPORT_ReadFd,
+  PTY_SetTimeout,
+  PTY_Flush,
+  NULL,
+  NULL,
+  PTY_Close
+};
+#endif // __linux
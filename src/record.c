@@ -0,0 +1,163 @@
+#include <errno.h>
+#ifdef __linux
+#include <sys/file.h>
+#endif
+#include "log.h"
+#include "record.h"
+#include "sleep.h"
+
+#define RECORD_BUFFER_LEN   (64 * 1024)
+
+/** \brief Write number as varint
+ *
+ * \param [in] rec Recording
+ * \param [in] val Number to write
+ * \return Nothing
+ *
+ */
+static void RECORD_PutVarint(tRecord *rec, uint64_t val)
+{
+  uint8_t buf[10];
+  uint8_t len = 0;
+
+  do
+  {
+    buf[len] = val & 0x7F;
+    val >>= 7;
+    if (val != 0)
+      buf[len] |= 0x80;
+    len++;
+  } while (val != 0);
+  fwrite(buf, 1, len, rec->file);
+}
+
+/** \brief Read varint from buffer
+ *
+ * \param [in] data Buffer
+ * \param [in] size Size of the buffer
+ * \param [in,out] pos Position in the buffer
+ * \param [out] ok Cleared if the buffer ends inside of the number or it's too large
+ * \return decoded number
+ *
+ */
+uint32_t RECORD_GetVarint(const uint8_t *data, uint32_t size, uint32_t *pos, bool *ok)
+{
+  uint32_t val = 0;
+  uint8_t shift = 0;
+
+  while (*pos < size)
+  {
+    val |= (uint32_t)(data[*pos] & 0x7F) << shift;
+    if ((data[(*pos)++] & 0x80) == 0)
+      return val;
+    shift += 7;
+    if (shift > 28)
+      break;
+  }
+  *ok = false;
+
+  return 0;
+}
+
+/** \brief Open recording for appending, only one session at a time may write it
+ *
+ * \param [in] filename Name of the recording
+ * \return file or NULL if failed, errno is EWOULDBLOCK if another session writes it
+ *
+ */
+static FILE *RECORD_Claim(char *filename)
+{
+  FILE *fp = fopen(filename, "ab");
+
+  #ifdef __linux
+  /**< the lock is released by fclose() */
+  if ((fp != NULL) && (flock(fileno(fp), LOCK_EX | LOCK_NB) != 0))
+  {
+    fclose(fp);
+    errno = EWOULDBLOCK;
+    return NULL;
+  }
+  #endif
+
+  return fp;
+}
+
+/** \brief Start recording of all transfers, sessions are appended to an existing recording
+ *
+ * \param [out] rec Recording
+ * \param [in] filename Name of the recording
+ * \param [in] id Session ID, the recording is FILE-ID.EXT if another session writes FILE.EXT now
+ * \return true if succeed
+ *
+ */
+bool RECORD_Start(tRecord *rec, char *filename, uint32_t id)
+{
+  char name[FILENAME_LEN + 16];
+  char *ext;
+
+  if (((rec->file = RECORD_Claim(filename)) == NULL) && (errno == EWOULDBLOCK))
+  {
+    /**< buffered records of concurrent sessions would interleave and break the framing */
+    ext = strrchr(filename, '.');
+    if ((ext == NULL) || (strpbrk(ext, "/\\") != NULL))
+      ext = filename + strlen(filename);
+    snprintf(name, sizeof(name), "%.*s-%u%s", (int)(ext - filename), filename, id, ext);
+    if ((rec->file = RECORD_Claim(name)) != NULL)
+      LOG_Print(LOG_LEVEL_INFO, "Recording %s is in use, recording to %s", filename, name);
+    filename = name;
+  }
+  if (rec->file == NULL)
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "Unable to create recording: %s", filename);
+    return false;
+  }
+  setvbuf(rec->file, NULL, _IOFBF, RECORD_BUFFER_LEN);
+  fseek(rec->file, 0, SEEK_END);
+  if (ftell(rec->file) == 0)
+    fwrite(RECORD_MAGIC, 1, RECORD_MAGIC_LEN, rec->file);
+  rec->last = usclock();
+
+  return true;
+}
+
+/** \brief Record one transfer, does nothing if recording isn't started
+ *
+ * \param [in] rec Recording
+ * \param [in] dir RECORD_DIR_TX or RECORD_DIR_RX
+ * \param [in] chunks Parts of the transfer
+ * \param [in] cnt Number of parts
+ * \return Nothing
+ *
+ */
+void RECORD_Frame(tRecord *rec, uint8_t dir, const tChunk *chunks, uint8_t cnt)
+{
+  uint64_t now;
+  uint32_t len = 0;
+  uint8_t i;
+
+  if (rec->file == NULL)
+    return;
+  now = usclock();
+  for (i = 0; i < cnt; i++)
+    len += chunks[i].len;
+  RECORD_PutVarint(rec, now - rec->last);
+  RECORD_PutVarint(rec, ((uint64_t)len << 1) | dir);
+  for (i = 0; i < cnt; i++)
+    fwrite(chunks[i].data, 1, chunks[i].len, rec->file);
+  rec->last = now;
+}
+
+/** \brief Stop recording and write all buffered records
+ *
+ * \param [in] rec Recording
+ * \return Nothing
+ *
+ */
+void RECORD_Stop(tRecord *rec)
+{
+  if (rec->file == NULL)
+    return;
+  if (fclose(rec->file) != 0)
+    LOG_Print(LOG_LEVEL_ERROR, "Unable to write recording");
+  rec->file = NULL;
+}
@@ -0,0 +1,32 @@
+#ifndef RECORD_H
+#define RECORD_H
+
+#include "defines.h"
+#include "transport.h"
+
+/**< Recording starts with RECORD_MAGIC, then every transfer is one record:
+ *   varint  time since the previous record in us
+ *   varint  length << 1 | direction
+ *   bytes   data
+ *   varint is 7 bits per byte, least significant first, bit 7 set if more bytes follow
+ */
+#define RECORD_MAGIC      "MSPREC\x01"
+#define RECORD_MAGIC_LEN  (7)
+
+enum {
+  RECORD_DIR_TX,
+  RECORD_DIR_RX
+};
+
+typedef struct
+{
+  FILE      *file;
+  uint64_t  last;       /**< time of the previous record */
+} tRecord;
+
+bool RECORD_Start(tRecord *rec, char *filename, uint32_t id);
+void RECORD_Frame(tRecord *rec, uint8_t dir, const tChunk *chunks, uint8_t cnt);
+void RECORD_Stop(tRecord *rec);
+uint32_t RECORD_GetVarint(const uint8_t *data, uint32_t size, uint32_t *pos, bool *ok);
+
+#endif
@@ -0,0 +1,286 @@
+#include <stdlib.h>
+#include "log.h"
+#include "record.h"
+#include "sleep.h"
+#include "timer.h"
+#include "transport.h"
+
+/**< state of the recording being played */
+typedef struct
+{
+  uint8_t   *data;
+  uint32_t  size;
+  uint32_t  pos;        /**< next record in data */
+  bool      have;       /**< current record is decoded */
+  uint8_t   dir;
+  uint32_t  delta;
+  uint32_t  len;
+  uint32_t  offset;     /**< bytes of the current record already consumed */
+  uint32_t  start;      /**< position of the current record data */
+  uint64_t  base;       /**< real time of the previous record */
+  uint32_t  speed;      /**< 0 - no delays, 1 - original timing, N - N times faster */
+  uint32_t  records;    /**< records decoded so far */
+  uint32_t  tx_bytes;   /**< bytes sent by the program */
+  int64_t   diverged;   /**< first sent byte differing from the recording, -1 if none */
+} tReplay;
+
+/** \brief Make sure the current record has data left, decode the next one if needed
+ *
+ * \param [in] r Replay state
+ * \return false if the recording is over
+ *
+ */
+static bool REPLAY_Next(tReplay *r)
+{
+  bool ok = true;
+  uint32_t val;
+
+  if ((r->have == true) && (r->offset < r->len))
+    return true;
+  if (r->have == true)
+    r->pos = r->start + r->len;
+  r->have = false;
+  while (r->pos < r->size)
+  {
+    r->delta = RECORD_GetVarint(r->data, r->size, &r->pos, &ok);
+    val = RECORD_GetVarint(r->data, r->size, &r->pos, &ok);
+    if ((ok == false) || ((val >> 1) > r->size - r->pos))
+    {
+      LOG_Print(LOG_LEVEL_WARNING, "Recording is truncated at byte %u", r->pos);
+      r->pos = r->size;
+      break;
+    }
+    r->dir = val & 1;
+    r->len = val >> 1;
+    r->start = r->pos;
+    r->offset = 0;
+    r->records++;
+    if (r->len == 0)
+      continue;
+    r->have = true;
+    return true;
+  }
+
+  return false;
+}
+
+/** \brief Get real time when the current record is due
+ *
+ * \param [in] r Replay state
+ * \return time in us as returned by usclock()
+ *
+ */
+static uint64_t REPLAY_Due(tReplay *r)
+{
+  if (r->speed == 0)
+    return r->base;
+
+  return r->base + r->delta / r->speed;
+}
+
+/** \brief Open recording as a port, address is "FILE" or "FILE@SPEED"
+ *
+ * \param [in] link Link to open
+ * \param [in] address Name of the recording with optional speed factor (0 for no delays)
+ * \param [in] baudrate Baudrate used for timing only
+ * \return true if succeed
+ *
+ */
+static bool REPLAY_Open(tLink *link, char *address, uint32_t baudrate)
+{
+  tReplay *r;
+  char filename[COMPORT_LEN];
+  char *speed;
+  FILE *fp;
+  long size;
+
+  if ((r = calloc(1, sizeof(tReplay))) == NULL)
+    return false;
+  link->priv = r;
+  r->speed = 1;
+  r->diverged = -1;
+  snprintf(filename, sizeof(filename), "%s", address);
+  speed = strrchr(filename, '@');
+  if (speed != NULL)
+  {
+    *speed++ = 0;
+    r->speed = (uint32_t)strtoul(speed, NULL, 10);
+  }
+  if ((fp = fopen(filename, "rb")) == NULL)
+  {
+    free(r);
+    return false;
+  }
+  fseek(fp, 0, SEEK_END);
+  size = ftell(fp);
+  fseek(fp, 0, SEEK_SET);
+  if ((size < RECORD_MAGIC_LEN) || ((r->data = malloc(size)) == NULL) ||
+      (fread(r->data, 1, size, fp) != (size_t)size) || (memcmp(r->data, RECORD_MAGIC, RECORD_MAGIC_LEN) != 0))
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "Not a recording: %s", filename);
+    free(r->data);
+    free(r);
+    fclose(fp);
+    return false;
+  }
+  fclose(fp);
+  r->size = (uint32_t)size;
+  r->pos = RECORD_MAGIC_LEN;
+  r->base = usclock();
+  link->baudrate = baudrate;
+  link->default_timeout = TRANSPORT_TIMEOUT_MS;
+  link->timeout = link->default_timeout;
+
+  return true;
+}
+
+/** \brief Compare sent data with the recording, received records left over are skipped
+ *
+ * \param [in] link Opened link
+ * \param [in] chunks Parts of the frame
+ * \param [in] cnt Number of parts
+ * \return 0 if everything Ok
+ *
+ */
+static int REPLAY_Write(tLink *link, const tChunk *chunks, uint8_t cnt)
+{
+  tReplay *r = link->priv;
+  const uint8_t *data;
+  uint16_t len;
+  uint32_t n;
+  uint8_t i;
+
+  for (i = 0; i < cnt; i++)
+  {
+    data = chunks[i].data;
+    len = chunks[i].len;
+    while ((len > 0) && (REPLAY_Next(r) == true))
+    {
+      if (r->dir == RECORD_DIR_RX)
+      {
+        /**< device answered something the program didn't wait for */
+        r->offset = r->len;
+        continue;
+      }
+      if (r->offset == 0)
+        r->base = usclock();
+      n = r->len - r->offset;
+      if (n > len)
+        n = len;
+      if ((r->diverged < 0) && (memcmp(data, &r->data[r->start + r->offset], n) != 0))
+      {
+        r->diverged = r->tx_bytes;
+        LOG_Print(LOG_LEVEL_WARNING, "Sent data differs from the recording at byte %u", r->tx_bytes);
+      }
+      r->offset += n;
+      r->tx_bytes += n;
+      data += n;
+      len -= n;
+    }
+  }
+
+  return 0;
+}
+
+/** \brief Deliver recorded data when it's due
+ *
+ * \param [in] link Opened link
+ * \param [out] data Data buffer to read data in
+ * \param [in] len Size of data buffer
+ * \return number of received bytes, 0 on timeout
+ *
+ */
+static int REPLAY_Read(tLink *link, uint8_t *data, uint16_t len)
+{
+  tReplay *r = link->priv;
+  uint64_t now = usclock();
+  uint64_t due;
+  uint32_t n;
+
+  /**< nothing comes until the program sends what was sent in the recording */
+  if ((REPLAY_Next(r) == false) || (r->dir == RECORD_DIR_TX))
+  {
+    msleep(link->timeout);
+    return 0;
+  }
+  due = (r->offset == 0) ? REPLAY_Due(r) : now;
+  if (due > now + (uint64_t)link->timeout * 1000)
+  {
+    msleep(link->timeout);
+    return 0;
+  }
+  if (due > now)
+    TIMER_SleepUntil(due);
+  if (r->offset == 0)
+    r->base = due;
+  n = r->len - r->offset;
+  if (n > len)
+    n = len;
+  memcpy(data, &r->data[r->start + r->offset], n);
+  r->offset += n;
+
+  return (int)n;
+}
+
+/** \brief Set read timeout
+ *
+ * \param [in] link Opened link
+ * \param [in] ms Time to wait for the first byte in milliseconds
+ * \return Nothing
+ *
+ */
+static void REPLAY_SetTimeout(tLink *link, uint16_t ms)
+{
+  link->timeout = ms;
+}
+
+/** \brief Drop recorded data which would be already received by now
+ *
+ * \param [in] link Opened link
+ * \return Nothing
+ *
+ */
+static void REPLAY_Flush(tLink *link)
+{
+  tReplay *r = link->priv;
+
+  while ((REPLAY_Next(r) == true) && (r->dir == RECORD_DIR_RX))
+  {
+    if ((r->offset == 0) && (REPLAY_Due(r) > usclock()))
+      break;
+    if (r->offset == 0)
+      r->base = REPLAY_Due(r);
+    r->offset = r->len;
+  }
+}
+
+/** \brief Close recording and report how much of it was played
+ *
+ * \param [in] link Opened link
+ * \return Nothing
+ *
+ */
+static void REPLAY_Close(tLink *link)
+{
+  tReplay *r = link->priv;
+
+  LOG_Print(LOG_LEVEL_INFO, "Replay stopped at byte %u of %u after %u records%s",
+            (r->have == true) ? r->start + r->offset : r->pos, r->size, r->records,
+            (r->diverged < 0) ? "" : ", sent data differed");
+  free(r->data);
+  free(r);
+}
+
+const tTransport REPLAY_Transport =
+{
+  "replay",
+  "replay://",
+  REPLAY_Open,
+  REPLAY_Write,
+  REPLAY_Read,
+  REPLAY_SetTimeout,
+  REPLAY_Flush,
+  NULL,
+  NULL,
+  REPLAY_Close
+};
@@ -0,0 +1,126 @@
+#ifdef __linux
+#define _GNU_SOURCE
+#include <errno.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#endif
+#include "log.h"
+#include "rt.h"
+#include "sleep.h"
+
+static bool RT_Active;
+static int16_t RT_Cpu;
+static bool RT_Fifo;
+static bool RT_Locked;
+#ifdef __linux
+static struct rusage RT_Usage;  /**< thread usage when the mode was set up */
+#endif
+
+/** \brief Touch the stack the I/O loop will use, so it doesn't fault in the middle of a page
+ *
+ * \return Nothing
+ *
+ */
+static void RT_PrefaultStack(void)
+{
+  volatile uint8_t stack[RT_PREFAULT_STACK];
+  uint32_t i;
+
+  for (i = 0; i < sizeof(stack); i += 4096)
+    stack[i] = 0;
+}
+
+/** \brief Set up low-jitter mode for the calling thread, which does the protocol I/O
+ *
+ * Every step is optional: without privileges the thread keeps running with normal
+ * priority or unlocked memory, only a warning is logged
+ *
+ * \param [in] cpu CPU to pin the thread to, -1 to keep its affinity
+ * \return false if the CPU doesn't exist
+ *
+ */
+bool RT_Setup(int16_t cpu)
+{
+  #ifdef __linux
+  struct sched_param param;
+  cpu_set_t set;
+  int res;
+
+  if (cpu >= 0)
+  {
+    CPU_ZERO(&set);
+    if (cpu < CPU_SETSIZE)
+      CPU_SET(cpu, &set);
+    /**< an empty set is rejected as well */
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+    {
+      LOG_Print(LOG_LEVEL_ERROR, "Can't pin I/O thread to CPU %d", cpu);
+      return false;
+    }
+  }
+  memset(&param, 0, sizeof(param));
+  param.sched_priority = RT_PRIORITY;
+  if ((res = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param)) == 0)
+    RT_Fifo = true;
+  else
+    LOG_Print(LOG_LEVEL_WARNING, "SCHED_FIFO not permitted, normal priority is used (%s)", strerror(res));
+  if (mlockall(MCL_CURRENT | MCL_FUTURE) == 0)
+  {
+    /**< freed memory stays mapped and locked, the next allocation doesn't fault */
+    mallopt(M_TRIM_THRESHOLD, -1);
+    mallopt(M_MMAP_MAX, 0);
+    RT_Locked = true;
+  } else
+  {
+    LOG_Print(LOG_LEVEL_WARNING, "Memory can't be locked, see RLIMIT_MEMLOCK (%s)", strerror(errno));
+  }
+  RT_PrefaultStack();
+  getrusage(RUSAGE_THREAD, &RT_Usage);
+  #endif
+  #ifdef __MINGW32__
+  if ((cpu >= 0) && ((cpu >= (int16_t)(sizeof(DWORD_PTR) * 8)) ||
+      (SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << cpu) == 0)))
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "Can't pin I/O thread to CPU %d", cpu);
+    return false;
+  }
+  if (SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL) != 0)
+    RT_Fifo = true;
+  else
+    LOG_Print(LOG_LEVEL_WARNING, "Time-critical priority not permitted, normal priority is used");
+  RT_PrefaultStack();
+  #endif
+  RT_Active = true;
+  RT_Cpu = cpu;
+
+  return true;
+}
+
+/** \brief Report the low-jitter settings and how often the I/O thread was disturbed
+ *
+ * \return Nothing
+ *
+ */
+void RT_Report(void)
+{
+  #ifdef __linux
+  struct rusage usage;
+  #endif
+  char cpu[8] = "any";
+
+  if (RT_Active == false)
+    return;
+  if (RT_Cpu >= 0)
+    snprintf(cpu, sizeof(cpu), "%d", RT_Cpu);
+  LOG_Print(LOG_LEVEL_INFO, "Low-jitter mode: CPU %s, %s priority, memory %s", cpu, RT_Fifo ? "real-time" : "normal",
+            RT_Locked ? "locked" : "not locked");
+  #ifdef __linux
+  if (getrusage(RUSAGE_THREAD, &usage) == 0)
+    LOG_Print(LOG_LEVEL_INFO, "I/O thread: %ld involuntary context switches, %ld page faults (%ld major)",
+              usage.ru_nivcsw - RT_Usage.ru_nivcsw, usage.ru_minflt - RT_Usage.ru_minflt + usage.ru_majflt - RT_Usage.ru_majflt,
+              usage.ru_majflt - RT_Usage.ru_majflt);
+  #endif
+}
@@ -0,0 +1,12 @@
+#ifndef RT_H
+#define RT_H
+
+#include "defines.h"
+
+#define RT_PRIORITY         (50)            /**< SCHED_FIFO priority, below kernel interrupt threads */
+#define RT_PREFAULT_STACK   (1024UL * 256)
+
+bool RT_Setup(int16_t cpu);
+void RT_Report(void);
+
+#endif
@@ -1,3 +1,4 @@
+#include <time.h>
 #include "sleep.h"
 
 void msleep(uint32_t msec)
@@ -10,3 +11,24 @@ void msleep(uint32_t msec)
   #endif // __linux
 }
 
+/** \brief Get monotonic time
+ *
+ * \return time in microseconds from an arbitrary point as uint64_t
+ *
+ */
+uint64_t usclock(void)
+{
+  #ifdef __MINGW32__
+  LARGE_INTEGER freq, cnt;
+
+  QueryPerformanceFrequency(&freq);
+  QueryPerformanceCounter(&cnt);
+  return (uint64_t)(cnt.QuadPart / freq.QuadPart * 1000000 + cnt.QuadPart % freq.QuadPart * 1000000 / freq.QuadPart);
+  #endif // __MINGW32__
+  #ifdef __linux
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+  #endif // __linux
+}
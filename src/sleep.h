@@ -9,5 +9,6 @@
 #endif
 
 void msleep(uint32_t usec);
+uint64_t usclock(void);
 
 #endif
@@ -0,0 +1,371 @@
+#ifdef __MINGW32__
+#include <windows.h>
+#endif
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+#ifdef __linux
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#include "ifaces.h"
+#include "log.h"
+#include "sleep.h"
+#include "stats.h"
+
+#define STATS_PATH_LEN      (FILENAME_LEN + 8)
+
+/**< upper bounds of the histogram buckets in us, the last one is +Inf */
+static const uint64_t STATS_PageBounds[STATS_BUCKETS - 1] = {
+  1000, 2000, 5000, 10000, 20000, 50000, 100000, 200000, 500000
+};
+static const uint64_t STATS_SessionBounds[STATS_BUCKETS - 1] = {
+  1000000, 2000000, 5000000, 10000000, 20000000, 50000000, 100000000, 200000000, 500000000
+};
+
+static tStatsFile *STATS_Data = NULL;
+#ifdef __MINGW32__
+static HANDLE STATS_Mapping = NULL;
+#endif
+
+/** \brief Find histogram bucket for the value
+ *
+ * \param [in] bounds Upper bounds of the buckets
+ * \param [in] us Value in us
+ * \return bucket index
+ *
+ */
+static uint8_t STATS_Bucket(const uint64_t *bounds, uint64_t us)
+{
+  uint8_t i;
+
+  for (i = 0; i < STATS_BUCKETS - 1; i++)
+  {
+    if (us <= bounds[i])
+      break;
+  }
+
+  return i;
+}
+
+/** \brief Map stats file into memory, a new file is created and initialized
+ *
+ * \param [in] filename Name of the stats file
+ * \return true if succeed
+ *
+ */
+bool STATS_Open(char *filename)
+{
+  tStatsFile *data = NULL;
+  #ifdef __linux
+  struct stat st;
+  int fd;
+
+  if ((fd = open(filename, O_RDWR | O_CREAT, 0644)) < 0)
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "Unable to open stats file: %s", filename);
+    return false;
+  }
+  /**< only one process may grow and initialize a new file */
+  flock(fd, LOCK_EX);
+  if ((fstat(fd, &st) == 0) && ((st.st_size >= (off_t)sizeof(tStatsFile)) || (ftruncate(fd, sizeof(tStatsFile)) == 0)))
+  {
+    data = mmap(NULL, sizeof(tStatsFile), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED)
+      data = NULL;
+  }
+  if ((data != NULL) && (data->magic == 0))
+  {
+    data->version = STATS_VERSION;
+    data->size = sizeof(tStatsFile);
+    data->magic = STATS_MAGIC;
+  }
+  flock(fd, LOCK_UN);
+  close(fd);
+  #endif
+  #ifdef __MINGW32__
+  HANDLE file;
+
+  file = CreateFileA(filename, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+                     OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file == INVALID_HANDLE_VALUE)
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "Unable to open stats file: %s", filename);
+    return false;
+  }
+  /**< the mapping grows a new file to the mapped size */
+  STATS_Mapping = CreateFileMappingA(file, NULL, PAGE_READWRITE, 0, sizeof(tStatsFile), NULL);
+  CloseHandle(file);
+  if (STATS_Mapping != NULL)
+    data = MapViewOfFile(STATS_Mapping, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(tStatsFile));
+  if ((data != NULL) && (InterlockedCompareExchange((volatile LONG *)&data->magic, 1, 0) == 0))
+  {
+    data->version = STATS_VERSION;
+    data->size = sizeof(tStatsFile);
+    data->magic = STATS_MAGIC;
+  }
+  #endif
+
+  if (data == NULL)
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "Unable to map stats file: %s", filename);
+    return false;
+  }
+  if ((data->magic != STATS_MAGIC) || (data->version != STATS_VERSION) || (data->size != sizeof(tStatsFile)))
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "Stats file has wrong format: %s", filename);
+    #ifdef __linux
+    munmap(data, sizeof(tStatsFile));
+    #endif
+    #ifdef __MINGW32__
+    UnmapViewOfFile(data);
+    CloseHandle(STATS_Mapping);
+    #endif
+    return false;
+  }
+  STATS_Data = data;
+
+  return true;
+}
+
+/** \brief Unmap stats file
+ *
+ * \return Nothing
+ *
+ */
+void STATS_Close(void)
+{
+  if (STATS_Data == NULL)
+    return;
+  #ifdef __linux
+  munmap(STATS_Data, sizeof(tStatsFile));
+  #endif
+  #ifdef __MINGW32__
+  UnmapViewOfFile(STATS_Data);
+  CloseHandle(STATS_Mapping);
+  #endif
+  STATS_Data = NULL;
+}
+
+/** \brief Start counting for a new session
+ *
+ * \param [out] run Session counters
+ * \return Nothing
+ *
+ */
+void STATS_Begin(tStatsRun *run)
+{
+  memset(run, 0, sizeof(tStatsRun));
+  run->start_us = usclock();
+}
+
+/** \brief Count written transfer
+ *
+ * \param [in,out] run Session counters
+ * \param [in] us Time from the command to the reply
+ * \param [in] pages Number of pages in the transfer
+ * \param [in] bytes Number of bytes in the transfer
+ * \return Nothing
+ *
+ */
+void STATS_Page(tStatsRun *run, uint32_t us, uint16_t pages, uint32_t bytes)
+{
+  if (pages == 0)
+    return;
+  run->pages_written += pages;
+  run->bytes += bytes;
+  run->page_hist[STATS_Bucket(STATS_PageBounds, us / pages)] += pages;
+  run->page_sum_us += us;
+}
+
+/** \brief Add counters of the finished session to the stats file
+ *
+ * \param [in] run Session counters
+ * \param [in] iface Interface of the session or -1
+ * \return Nothing
+ *
+ */
+void STATS_Add(tStatsRun *run, int8_t iface)
+{
+  tStatsFile *d = STATS_Data;
+  tStatsIface *f;
+  uint64_t link_us;
+  uint8_t i;
+
+  if (d == NULL)
+    return;
+  link_us = usclock() - run->start_us;
+  /**< sessions without write or check (e.g. bus scan) only count the link time */
+  if (run->failed || run->done || run->skipped)
+  {
+    i = run->failed ? STATS_RESULT_FAILED : (run->done ? STATS_RESULT_OK : STATS_RESULT_SKIPPED);
+    atomic_fetch_add(&d->sessions[i], 1);
+    atomic_fetch_add(&d->session.buckets[STATS_Bucket(STATS_SessionBounds, link_us)], 1);
+    atomic_fetch_add(&d->session.sum_us, link_us);
+    atomic_fetch_add(&d->session.count, 1);
+  }
+  atomic_fetch_add(&d->pages_written, run->pages_written);
+  atomic_fetch_add(&d->pages_verified, run->pages_verified);
+  atomic_fetch_add(&d->bytes, run->bytes);
+  atomic_fetch_add(&d->sent_bytes, run->sent_bytes);
+  atomic_fetch_add(&d->wire_bytes, run->wire_bytes);
+  for (i = 0; i < STATS_CAUSES; i++)
+    atomic_fetch_add(&d->retries[i], run->retries[i]);
+  atomic_fetch_add(&d->timeouts, run->timeouts);
+  atomic_fetch_add(&d->link_us, link_us);
+
+  if ((iface + 1 < 0) || (iface + 1 >= STATS_MAX_IFACES))
+    return;
+  f = &d->iface[iface + 1];
+  atomic_fetch_add(&f->bytes, run->bytes);
+  atomic_fetch_add(&f->write_us, run->write_us);
+  for (i = 0; i < STATS_BUCKETS; i++)
+    atomic_fetch_add(&f->page.buckets[i], run->page_hist[i]);
+  atomic_fetch_add(&f->page.sum_us, run->page_sum_us);
+  atomic_fetch_add(&f->page.count, run->pages_written);
+}
+
+/** \brief Print HELP and TYPE lines of a metric
+ *
+ * \param [in] f Output file
+ * \param [in] name Metric name without prefix
+ * \param [in] type Metric type
+ * \param [in] help Description
+ * \return Nothing
+ *
+ */
+static void STATS_Header(FILE *f, char *name, char *type, char *help)
+{
+  fprintf(f, "# HELP %s%s %s\n", STATS_PREFIX, name, help);
+  fprintf(f, "# TYPE %s%s %s\n", STATS_PREFIX, name, type);
+}
+
+/** \brief Print histogram samples, the buckets are cumulative
+ *
+ * \param [in] f Output file
+ * \param [in] name Metric name without prefix
+ * \param [in] labels Labels with trailing comma or empty string
+ * \param [in] h Histogram
+ * \param [in] bounds Upper bounds of the buckets in us
+ * \return Nothing
+ *
+ */
+static void STATS_Histogram(FILE *f, char *name, char *labels, tStatsHist *h, const uint64_t *bounds)
+{
+  unsigned long long sum = 0;
+  uint64_t sum_us = atomic_load(&h->sum_us);
+  uint8_t i;
+
+  for (i = 0; i < STATS_BUCKETS; i++)
+  {
+    sum += atomic_load(&h->buckets[i]);
+    if (i < STATS_BUCKETS - 1)
+      fprintf(f, "%s%s_bucket{%sle=\"%g\"} %llu\n", STATS_PREFIX, name, labels, bounds[i] / 1e6, sum);
+    else
+      fprintf(f, "%s%s_bucket{%sle=\"+Inf\"} %llu\n", STATS_PREFIX, name, labels, sum);
+  }
+  /**< sum and count have the same labels without le */
+  if (labels[0] != 0)
+  {
+    fprintf(f, "%s%s_sum{%.*s} %.6f\n", STATS_PREFIX, name, (int)strlen(labels) - 1, labels, sum_us / 1e6);
+    fprintf(f, "%s%s_count{%.*s} %llu\n", STATS_PREFIX, name, (int)strlen(labels) - 1, labels,
+            (unsigned long long)atomic_load(&h->count));
+    return;
+  }
+  fprintf(f, "%s%s_sum %.6f\n", STATS_PREFIX, name, sum_us / 1e6);
+  fprintf(f, "%s%s_count %llu\n", STATS_PREFIX, name, (unsigned long long)atomic_load(&h->count));
+}
+
+/** \brief Render stats as a Prometheus textfile, the file is replaced atomically
+ *
+ * \param [in] filename Name of the output file (e.g. msprog.prom in the collector directory)
+ * \return true if succeed
+ *
+ */
+bool STATS_Export(char *filename)
+{
+  static const char *results[STATS_RESULTS] = {"ok", "failed", "skipped"};
+  static const char *causes[STATS_CAUSES] = {"timeout", "rejected", "mismatch"};
+  tStatsFile *d = STATS_Data;
+  char tmp[STATS_PATH_LEN];
+  char labels[IFACES_NAME_LEN + 16];
+  char *names[STATS_MAX_IFACES];
+  uint8_t cnt;
+  uint8_t i;
+  FILE *f;
+
+  if (d == NULL)
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "Stats file is not set (--stats)");
+    return false;
+  }
+  names[0] = "none";
+  for (cnt = 1; (cnt < STATS_MAX_IFACES) && (cnt <= IFACES_GetNumber()); cnt++)
+    names[cnt] = IFACES_GetNameByNumber(cnt - 1);
+
+  /**< the collector must never read a half-written file */
+  snprintf(tmp, sizeof(tmp), "%s.tmp", filename);
+  if ((f = fopen(tmp, "wt")) == NULL)
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "Unable to create stats export: %s", tmp);
+    return false;
+  }
+  STATS_Header(f, "sessions_total", "counter", "Programming sessions by result.");
+  for (i = 0; i < STATS_RESULTS; i++)
+    fprintf(f, "%ssessions_total{result=\"%s\"} %llu\n", STATS_PREFIX, results[i],
+            (unsigned long long)atomic_load(&d->sessions[i]));
+  STATS_Header(f, "pages_written_total", "counter", "Flash pages written.");
+  fprintf(f, "%spages_written_total %llu\n", STATS_PREFIX, (unsigned long long)atomic_load(&d->pages_written));
+  STATS_Header(f, "pages_verified_total", "counter", "Flash pages verified by checksum.");
+  fprintf(f, "%spages_verified_total %llu\n", STATS_PREFIX, (unsigned long long)atomic_load(&d->pages_verified));
+  STATS_Header(f, "written_bytes_total", "counter", "Firmware bytes written.");
+  fprintf(f, "%swritten_bytes_total %llu\n", STATS_PREFIX, (unsigned long long)atomic_load(&d->bytes));
+  STATS_Header(f, "sent_bytes_total", "counter", "Write command and firmware bytes of all transfers, before compression.");
+  fprintf(f, "%ssent_bytes_total %llu\n", STATS_PREFIX, (unsigned long long)atomic_load(&d->sent_bytes));
+  STATS_Header(f, "wire_bytes_total", "counter", "Write command and firmware bytes on the wire, after compression.");
+  fprintf(f, "%swire_bytes_total %llu\n", STATS_PREFIX, (unsigned long long)atomic_load(&d->wire_bytes));
+  STATS_Header(f, "retries_total", "counter", "Repeated transfers by cause.");
+  for (i = 0; i < STATS_CAUSES; i++)
+    fprintf(f, "%sretries_total{cause=\"%s\"} %llu\n", STATS_PREFIX, causes[i],
+            (unsigned long long)atomic_load(&d->retries[i]));
+  STATS_Header(f, "timeouts_total", "counter", "Replies not received in time.");
+  fprintf(f, "%stimeouts_total %llu\n", STATS_PREFIX, (unsigned long long)atomic_load(&d->timeouts));
+  STATS_Header(f, "link_seconds_total", "counter", "Time the ports were open.");
+  fprintf(f, "%slink_seconds_total %.6f\n", STATS_PREFIX, atomic_load(&d->link_us) / 1e6);
+  STATS_Header(f, "session_seconds", "histogram", "Duration of programming sessions.");
+  STATS_Histogram(f, "session_seconds", "", &d->session, STATS_SessionBounds);
+
+  STATS_Header(f, "iface_written_bytes_total", "counter", "Firmware bytes written by interface.");
+  for (i = 0; i < cnt; i++)
+    fprintf(f, "%siface_written_bytes_total{iface=\"%s\"} %llu\n", STATS_PREFIX, names[i],
+            (unsigned long long)atomic_load(&d->iface[i].bytes));
+  STATS_Header(f, "iface_write_seconds_total", "counter", "Time of the write phase by interface.");
+  for (i = 0; i < cnt; i++)
+    fprintf(f, "%siface_write_seconds_total{iface=\"%s\"} %.6f\n", STATS_PREFIX, names[i],
+            atomic_load(&d->iface[i].write_us) / 1e6);
+  STATS_Header(f, "page_write_seconds", "histogram", "Time from write command to reply per page by interface.");
+  for (i = 0; i < cnt; i++)
+  {
+    snprintf(labels, sizeof(labels), "iface=\"%s\",", names[i]);
+    STATS_Histogram(f, "page_write_seconds", labels, &d->iface[i].page, STATS_PageBounds);
+  }
+
+  if (fclose(f) != 0)
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "Unable to write stats export: %s", tmp);
+    remove(tmp);
+    return false;
+  }
+  #ifdef __MINGW32__
+  remove(filename);
+  #endif
+  if (rename(tmp, filename) != 0)
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "Unable to replace stats export: %s", filename);
+    remove(tmp);
+    return false;
+  }
+
+  return true;
+}
@@ -0,0 +1,91 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdatomic.h>
+#include "defines.h"
+
+#define STATS_MAGIC         (0x5453504DUL)  /**< "MPST" */
+#define STATS_VERSION       (2)
+#define STATS_MAX_IFACES    (8)             /**< slot 0 is used without interface */
+#define STATS_BUCKETS       (10)
+#define STATS_PREFIX        "msprog_"
+
+/**< retry causes */
+enum {
+  STATS_CAUSE_TIMEOUT,
+  STATS_CAUSE_REJECTED,       /**< bootloader answered with an error */
+  STATS_CAUSE_MISMATCH,       /**< page checksum differs */
+  STATS_CAUSES
+};
+
+/**< session results */
+enum {
+  STATS_RESULT_OK,
+  STATS_RESULT_FAILED,
+  STATS_RESULT_SKIPPED,
+  STATS_RESULTS
+};
+
+/**< counters of one session, added to the stats file when it is closed */
+typedef struct
+{
+  uint64_t  start_us;
+  bool      done;           /**< write or check succeeded */
+  bool      failed;
+  bool      skipped;        /**< firmware was up to date */
+  uint32_t  pages_written;
+  uint32_t  pages_verified;
+  uint64_t  bytes;
+  uint64_t  sent_bytes;     /**< write command and image bytes of all transfers, retries included */
+  uint64_t  wire_bytes;     /**< write command and payload bytes on the wire, less than sent if compressed */
+  uint32_t  retries[STATS_CAUSES];
+  uint32_t  timeouts;
+  uint64_t  write_us;       /**< time of the write phase */
+  uint32_t  page_hist[STATS_BUCKETS];
+  uint64_t  page_sum_us;
+} tStatsRun;
+
+/**< histogram with the bucket bounds from STATS_PageBounds or STATS_SessionBounds */
+typedef struct
+{
+  atomic_ullong  buckets[STATS_BUCKETS];
+  atomic_ullong  sum_us;
+  atomic_ullong  count;
+} tStatsHist;
+
+/**< per-interface counters */
+typedef struct
+{
+  atomic_ullong  bytes;
+  atomic_ullong  write_us;
+  tStatsHist     page;
+} tStatsIface;
+
+/**< content of the stats file, shared by all msprog processes */
+typedef struct
+{
+  uint32_t       magic;
+  uint32_t       version;
+  uint32_t       size;
+  uint32_t       reserved;
+  atomic_ullong  sessions[STATS_RESULTS];
+  atomic_ullong  pages_written;
+  atomic_ullong  pages_verified;
+  atomic_ullong  bytes;
+  atomic_ullong  sent_bytes;
+  atomic_ullong  wire_bytes;
+  atomic_ullong  retries[STATS_CAUSES];
+  atomic_ullong  timeouts;
+  atomic_ullong  link_us;
+  tStatsHist     session;
+  tStatsIface    iface[STATS_MAX_IFACES];
+} tStatsFile;
+
+bool STATS_Open(char *filename);
+void STATS_Close(void);
+void STATS_Begin(tStatsRun *run);
+void STATS_Page(tStatsRun *run, uint32_t us, uint16_t pages, uint32_t bytes);
+void STATS_Add(tStatsRun *run, int8_t iface);
+bool STATS_Export(char *filename);
+
+#endif
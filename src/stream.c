@@ -0,0 +1,228 @@
+#include <stdlib.h>
+#ifdef __MINGW32__
+#include <fcntl.h>
+#include <io.h>
+#endif
+#include "log.h"
+#include "stream.h"
+
+/** \brief Check if the image has to be streamed instead of being loaded at once
+ *
+ * \param [in] filename Name of the Hex file
+ * \return true for standard input and compressed files
+ *
+ */
+bool STREAM_IsStream(char *filename)
+{
+  size_t len = strlen(filename);
+  size_t ext = strlen(STREAM_GZ_EXT);
+
+  if (strcmp(filename, STREAM_STDIN) == 0)
+    return true;
+
+  return (len > ext) && (strcmp(&filename[len - ext], STREAM_GZ_EXT) == 0);
+}
+
+/** \brief Open Hex stream, compressed and plain data are both accepted
+ *
+ * \param [out] stream Stream state
+ * \param [in] filename Name of the Hex file, "-" for standard input
+ * \param [in] page_size Flash page size
+ * \param [in] maxlen Flash size
+ * \return true if succeed
+ *
+ */
+bool STREAM_Open(tStream *stream, char *filename, uint16_t page_size, uint32_t maxlen)
+{
+  memset(stream, 0, sizeof(tStream));
+  stream->page_size = page_size;
+  stream->maxlen = maxlen;
+  stream->first_addr = UINT32_MAX;
+  stream->origin = true;
+  if (strcmp(filename, STREAM_STDIN) == 0)
+  {
+    #ifdef __MINGW32__
+    _setmode(_fileno(stdin), _O_BINARY);
+    #endif
+    /**< gzclose() closes the descriptor, standard input must stay open */
+    stream->gz = gzdopen(dup(STDIN_FILENO), "rb");
+  } else
+  {
+    stream->gz = gzopen(filename, "rb");
+  }
+  if (stream->gz == NULL)
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "Unable to open file: %s", filename);
+    return false;
+  }
+  stream->window = calloc(STREAM_WINDOW_PAGES * 2 + 1, page_size);
+  if (stream->window == NULL)
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "Unable to allocate stream window");
+    STREAM_Close(stream);
+    return false;
+  }
+  stream->used = &stream->window[STREAM_WINDOW_PAGES * page_size];
+  stream->page = &stream->used[STREAM_WINDOW_PAGES * page_size];
+
+  return true;
+}
+
+/** \brief Check if the data record fits in the window of pages
+ *
+ * \param [in] stream Stream state
+ * \param [in] addr Address of the record
+ * \return true if it fits
+ *
+ */
+static bool STREAM_Fits(tStream *stream, uint32_t addr)
+{
+  return addr + stream->rec.len <= ((uint32_t)stream->next + STREAM_WINDOW_PAGES) * stream->page_size;
+}
+
+/** \brief Copy the current data record into the window of pages
+ *
+ * \param [in,out] stream Stream state
+ * \param [in] addr Address of the record
+ * \return Nothing
+ *
+ */
+static void STREAM_Store(tStream *stream, uint32_t addr)
+{
+  uint32_t pos;
+  uint32_t slot;
+  uint8_t i;
+
+  for (i = 0; i < stream->rec.len; i++)
+  {
+    pos = addr + i;
+    slot = (pos / stream->page_size) % STREAM_WINDOW_PAGES;
+    stream->window[slot * stream->page_size + pos % stream->page_size] = stream->rec.data[i];
+    if (stream->used[slot * stream->page_size + pos % stream->page_size] == 0)
+    {
+      stream->used[slot * stream->page_size + pos % stream->page_size] = 1;
+      stream->filled[slot]++;
+    }
+    if ((stream->rec.data[i] != 0xFF) && (pos + 1 > stream->max_addr))
+      stream->max_addr = pos + 1;
+  }
+}
+
+/** \brief Stop the stream with an error
+ *
+ * \param [in,out] stream Stream state
+ * \param [in] text Error description
+ * \return always false
+ *
+ */
+static bool STREAM_Fail(tStream *stream, char *text)
+{
+  stream->error = true;
+  LOG_Print(LOG_LEVEL_ERROR, "Problem reading Hex stream: %s", text);
+
+  return false;
+}
+
+/** \brief Get the next complete page
+ *
+ * A page is complete when all its bytes are set. Pages with gaps are kept until
+ * the window is needed for the following records or the end of file is reached.
+ *
+ * \param [in,out] stream Stream state
+ * \param [out] data Page data, valid until the next call
+ * \return true if a page is available, false at the end of the image or on error
+ *
+ */
+bool STREAM_Next(tStream *stream, uint8_t **data)
+{
+  char str[IHEX_MAX_STRING];
+  uint32_t start;
+  uint32_t addr;
+  uint32_t slot;
+
+  if (stream->error)
+    return false;
+  while (true)
+  {
+    start = (uint32_t)stream->next * stream->page_size;
+    if (stream->pending && STREAM_Fits(stream, stream->rec.addr + stream->segment - stream->first_addr))
+    {
+      STREAM_Store(stream, stream->rec.addr + stream->segment - stream->first_addr);
+      stream->pending = false;
+    }
+    /**< trailing empty pages are not written, the same as for the loaded image */
+    if (stream->eof && stream->max_addr <= start)
+      return false;
+    if (stream->eof || stream->pending || (stream->filled[stream->next % STREAM_WINDOW_PAGES] == stream->page_size))
+      break;
+
+    if (gzgets(stream->gz, str, sizeof(str)) == NULL)
+      return STREAM_Fail(stream, "unexpected end of data");
+    if (IHEX_ParseRecord(str, &stream->rec) != IHEX_ERROR_NONE)
+      return STREAM_Fail(stream, "wrong format");
+    if (stream->rec.addr + stream->segment >= stream->maxlen)
+      return STREAM_Fail(stream, "image is larger than flash");
+    if (stream->first_addr == UINT32_MAX)
+      stream->first_addr = stream->rec.addr;
+    switch (stream->rec.type)
+    {
+      case IHEX_DATA_RECORD:
+        stream->origin = false;
+        /**< the page was already sent, only the window ahead of it is kept */
+        if ((stream->rec.addr + stream->segment < stream->first_addr) ||
+            (stream->rec.addr + stream->segment - stream->first_addr < start))
+          return STREAM_Fail(stream, "record is too far out of order");
+        addr = stream->rec.addr + stream->segment - stream->first_addr;
+        if (addr + stream->rec.len > stream->maxlen)
+          return STREAM_Fail(stream, "image is larger than flash");
+        if (STREAM_Fits(stream, addr))
+          STREAM_Store(stream, addr);
+        else
+          stream->pending = true;
+        break;
+      case IHEX_END_OF_FILE_RECORD:
+        stream->eof = true;
+        break;
+      case IHEX_EXTENDED_SEGMENT_ADDRESS_RECORD:
+        if (stream->rec.len != 2)
+          return STREAM_Fail(stream, "wrong format");
+        stream->segment = (uint32_t)((stream->rec.data[0] << 8) + stream->rec.data[1]) << 4;
+        break;
+      case IHEX_EXTENDED_LINEAR_ADDRESS_RECORD:
+        if (IHEX_GetLinear(&stream->rec, stream->origin, &stream->base, &stream->segment) != IHEX_ERROR_NONE)
+          return STREAM_Fail(stream, "wrong linear address");
+        break;
+      case IHEX_START_SEGMENT_ADDRESS_RECORD:
+      case IHEX_START_LINEAR_ADDRESS_RECORD:
+        break;
+      default:
+        return STREAM_Fail(stream, "wrong format");
+    }
+  }
+
+  /**< the slot is reused for the page one window ahead, gaps are zero like in the loaded image */
+  slot = (uint32_t)(stream->next % STREAM_WINDOW_PAGES) * stream->page_size;
+  memcpy(stream->page, &stream->window[slot], stream->page_size);
+  memset(&stream->window[slot], 0, stream->page_size);
+  memset(&stream->used[slot], 0, stream->page_size);
+  stream->filled[stream->next % STREAM_WINDOW_PAGES] = 0;
+  stream->next++;
+  *data = stream->page;
+
+  return true;
+}
+
+/** \brief Close Hex stream
+ *
+ * \param [in,out] stream Stream state
+ * \return Nothing
+ *
+ */
+void STREAM_Close(tStream *stream)
+{
+  if (stream->gz != NULL)
+    gzclose(stream->gz);
+  stream->gz = NULL;
+  free(stream->window);
+  stream->window = NULL;
+}
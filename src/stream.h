@@ -0,0 +1,39 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <zlib.h>
+#include "defines.h"
+#include "ihex.h"
+
+#define STREAM_STDIN          "-"
+#define STREAM_GZ_EXT         ".gz"
+#define STREAM_WINDOW_PAGES   (16)    /**< pages kept for records arriving out of order */
+
+/**< Hex file decoded on the fly, only a window of pages is kept in memory */
+typedef struct
+{
+  gzFile      gz;
+  uint16_t    page_size;
+  uint32_t    maxlen;
+  uint8_t     *window;        /**< ring of STREAM_WINDOW_PAGES pages starting at the next page */
+  uint8_t     *used;          /**< bytes of the window which were set by records */
+  uint16_t    filled[STREAM_WINDOW_PAGES]; /**< number of used bytes in every page of the window */
+  uint8_t     *page;          /**< copy of the last emitted page */
+  uint16_t    next;           /**< next page to emit */
+  uint32_t    max_addr;       /**< end of the last non-empty data */
+  uint32_t    first_addr;
+  uint32_t    segment;
+  uint32_t    base;           /**< upper address bits of the image start */
+  bool        origin;         /**< no data record was read yet */
+  bool        pending;        /**< record doesn't fit in the window yet */
+  bool        eof;
+  bool        error;
+  tIhexRecord rec;
+} tStream;
+
+bool STREAM_IsStream(char *filename);
+bool STREAM_Open(tStream *stream, char *filename, uint16_t page_size, uint32_t maxlen);
+bool STREAM_Next(tStream *stream, uint8_t **data);
+void STREAM_Close(tStream *stream);
+
+#endif
@@ -0,0 +1,169 @@
+#ifdef __linux
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include "log.h"
+#include "transport.h"
+
+/** \brief Connect socket to the address, waiting at most the transport timeout
+ *
+ * \param [in] fd Socket
+ * \param [in] ai Address to connect to
+ * \return true if succeed
+ *
+ */
+static bool TCP_Connect(int fd, struct addrinfo *ai)
+{
+  struct pollfd pfd = {fd, POLLOUT, 0};
+  socklen_t len = sizeof(int);
+  int flags = fcntl(fd, F_GETFL);
+  int err = 0;
+
+  /**< an unreachable gateway would block for the kernel SYN timeout of about 2 minutes */
+  if ((flags < 0) || (fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0))
+    return false;
+  if (connect(fd, ai->ai_addr, ai->ai_addrlen) < 0)
+  {
+    if (errno != EINPROGRESS)
+      return false;
+    if ((poll(&pfd, 1, TRANSPORT_TIMEOUT_MS) <= 0) ||
+        (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0) || (err != 0))
+      return false;
+  }
+
+  return (fcntl(fd, F_SETFL, flags) == 0);
+}
+
+/** \brief Connect to the serial-to-network gateway
+ *
+ * \param [in] link Link to open
+ * \param [in] address Gateway address as "host:port"
+ * \param [in] baudrate Baudrate of the bus behind the gateway, used for timing only
+ * \return true if succeed
+ *
+ */
+static bool TCP_Open(tLink *link, char *address, uint32_t baudrate)
+{
+  char host[COMPORT_LEN];
+  char *port;
+  struct addrinfo hints;
+  struct addrinfo *list;
+  struct addrinfo *ai;
+  int fd = -1;
+  int val = 1;
+  int res;
+
+  if (strlen(address) >= sizeof(host))
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "Network address is too long: %s", address);
+    return false;
+  }
+  strcpy(host, address);
+  port = strrchr(host, ':');
+  if (port == NULL)
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "Wrong network address, use tcp://host:port");
+    return false;
+  }
+  *port++ = 0;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  res = getaddrinfo(host, port, &hints, &list);
+  if (res != 0)
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "Can't resolve %s: %s", host, gai_strerror(res));
+    return false;
+  }
+  for (ai = list; ai != NULL; ai = ai->ai_next)
+  {
+    fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (fd < 0)
+      continue;
+    if (TCP_Connect(fd, ai) == true)
+      break;
+    close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(list);
+  if (fd < 0)
+    return false;
+  /* commands are short and latency bound, don't let Nagle hold them back */
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &val, sizeof(val));
+  link->fd = fd;
+  link->baudrate = baudrate;
+  link->default_timeout = TRANSPORT_TIMEOUT_MS;
+  link->timeout = link->default_timeout;
+
+  return true;
+}
+
+/** \brief Send frame to the gateway
+ *
+ * \param [in] link Opened link
+ * \param [in] chunks Parts of the frame
+ * \param [in] cnt Number of parts
+ * \return 0 if everything Ok
+ *
+ */
+static int TCP_Write(tLink *link, const tChunk *chunks, uint8_t cnt)
+{
+  return TRANSPORT_WriteFd(link, chunks, cnt, MSG_NOSIGNAL);
+}
+
+/** \brief Set read timeout
+ *
+ * \param [in] link Opened link
+ * \param [in] ms Time to wait for the first byte in milliseconds
+ * \return Nothing
+ *
+ */
+static void TCP_SetTimeout(tLink *link, uint16_t ms)
+{
+  link->timeout = ms;
+}
+
+/** \brief Discard all received and not yet read data
+ *
+ * \param [in] link Opened link
+ * \return Nothing
+ *
+ */
+static void TCP_Flush(tLink *link)
+{
+  uint8_t buf[64];
+
+  while (recv(link->fd, buf, sizeof(buf), MSG_DONTWAIT) > 0);
+}
+
+/** \brief Close connection to the gateway
+ *
+ * \param [in] link Opened link
+ * \return Nothing
+ *
+ */
+static void TCP_Close(tLink *link)
+{
+  LOG_Print(LOG_LEVEL_INFO, "Closing network connection");
+  close(link->fd);
+}
+
+const tTransport TCP_Transport =
+{
+  "tcp",
+  "tcp://",
+  TCP_Open,
+  TCP_Write,
+  TRANSPORT_ReadFd,
+  TCP_SetTimeout,
+  TCP_Flush,
+  NULL,
+  NULL,
+  TCP_Close
+};
+#endif // __linux
@@ -0,0 +1,135 @@
+#include <errno.h>
+#include <time.h>
+#include "log.h"
+#include "sleep.h"
+#include "timer.h"
+
+static uint16_t TIMER_SpinUs;
+
+/** \brief Configure waiting
+ *
+ * \param [in] spin_us Last part of every wait done by polling the clock, 0 to sleep only
+ * \return Nothing
+ *
+ */
+void TIMER_Setup(uint16_t spin_us)
+{
+  TIMER_SpinUs = (spin_us > TIMER_SPIN_MAX_US) ? TIMER_SPIN_MAX_US : spin_us;
+}
+
+/** \brief Sleep until the absolute time, the rest is polled if spinning is set up
+ *
+ * \param [in] deadline Time in us on the usclock() scale
+ * \return oversleep in us
+ *
+ */
+uint32_t TIMER_SleepUntil(uint64_t deadline)
+{
+  uint64_t now = usclock();
+  uint64_t wake;
+  #ifdef __linux
+  struct timespec ts;
+  #endif
+
+  if (deadline > now + TIMER_SpinUs)
+  {
+    wake = deadline - TIMER_SpinUs;
+    #ifdef __linux
+    /**< the same clock as usclock(), an absolute wake time doesn't drift on EINTR */
+    ts.tv_sec = (time_t)(wake / 1000000);
+    ts.tv_nsec = (long)(wake % 1000000 * 1000);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+    #endif
+    #ifdef __MINGW32__
+    while ((now = usclock()) < wake)
+      SleepEx((DWORD)((wake - now + 999) / 1000), false);
+    #endif
+  }
+  while ((now = usclock()) < deadline);
+
+  return (uint32_t)(now - deadline);
+}
+
+/** \brief Set the deadline to a moment, usually the event the next delay is counted from
+ *
+ * \param [in,out] t Timer
+ * \param [in] from Time in us on the usclock() scale
+ * \return Nothing
+ *
+ */
+void TIMER_Start(tTimer *t, uint64_t from)
+{
+  t->deadline = from;
+}
+
+/** \brief Move the deadline forward
+ *
+ * \param [in,out] t Timer
+ * \param [in] us Delay in us
+ * \return Nothing
+ *
+ */
+void TIMER_Add(tTimer *t, uint32_t us)
+{
+  t->deadline += us;
+}
+
+/** \brief Wait for the deadline and count the oversleep
+ *
+ * \param [in,out] t Timer
+ * \return Nothing
+ *
+ */
+void TIMER_Wait(tTimer *t)
+{
+  uint32_t late;
+  uint8_t i;
+
+  if (t->deadline <= usclock())
+    return;
+  late = TIMER_SleepUntil(t->deadline);
+  t->waits++;
+  t->late_us += late;
+  if (late > t->max_late_us)
+    t->max_late_us = late;
+  for (i = 0; (i < TIMER_BUCKETS - 1) && ((late >> i) != 0); i++);
+  t->hist[i]++;
+}
+
+/** \brief Wait for a delay counted from now
+ *
+ * \param [in,out] t Timer
+ * \param [in] us Delay in us
+ * \return Nothing
+ *
+ */
+void TIMER_Sleep(tTimer *t, uint32_t us)
+{
+  TIMER_Start(t, usclock());
+  TIMER_Add(t, us);
+  TIMER_Wait(t);
+}
+
+/** \brief Report the oversleep of all waits
+ *
+ * \param [in] t Timer
+ * \return Nothing
+ *
+ */
+void TIMER_Report(tTimer *t)
+{
+  uint32_t cnt = 0;
+  uint8_t i;
+
+  if (t->waits == 0)
+    return;
+  /**< bucket where 99% of the waits are reached */
+  for (i = 0; i < TIMER_BUCKETS - 1; i++)
+  {
+    cnt += t->hist[i];
+    if (cnt * 100ULL >= t->waits * 99ULL)
+      break;
+  }
+  LOG_Print(LOG_LEVEL_INFO, "Pacing: %u waits, oversleep %u us on average, below %u us for 99%%, %u us at most",
+            t->waits, (uint32_t)(t->late_us / t->waits), 1U << i, t->max_late_us);
+}
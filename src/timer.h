@@ -0,0 +1,28 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define TIMER_SPIN_MAX_US   (1000)
+#define TIMER_BUCKETS       (16)    /**< oversleep below 2^N us, the last one takes the rest */
+
+/**< pacing of one session, delays are counted from absolute deadlines */
+typedef struct
+{
+  uint64_t  deadline;       /**< time in us on the usclock() scale */
+  uint32_t  waits;
+  uint64_t  late_us;        /**< total oversleep */
+  uint32_t  max_late_us;
+  uint32_t  hist[TIMER_BUCKETS];
+} tTimer;
+
+void TIMER_Setup(uint16_t spin_us);
+uint32_t TIMER_SleepUntil(uint64_t deadline);
+void TIMER_Start(tTimer *t, uint64_t from);
+void TIMER_Add(tTimer *t, uint32_t us);
+void TIMER_Wait(tTimer *t);
+void TIMER_Sleep(tTimer *t, uint32_t us);
+void TIMER_Report(tTimer *t);
+
+#endif
@@ -0,0 +1,220 @@
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+#ifdef __linux
+#include <sys/file.h>
+#endif
+#include "ifaces.h"
+#include "log.h"
+#include "timing.h"
+
+#define TIMING_LINE_LEN     (TIMING_TARGET_LEN + 96)
+#define TIMING_LINE_FMT     "%287s %15s %u %u %u %u %u %u %u"  /**< widths are TIMING_TARGET_LEN and DEVICE_LEN */
+
+static char TIMING_File[FILENAME_LEN];
+
+/** \brief Set the timing database, process-wide like the profiles
+ *
+ * \param [in] filename Database file, empty to keep timing only for the session
+ * \return Nothing
+ *
+ */
+void TIMING_Setup(char *filename)
+{
+  strncpy(TIMING_File, filename, FILENAME_LEN);
+  TIMING_File[FILENAME_LEN - 1] = 0;
+}
+
+/** \brief Parse one database line
+ *
+ * \param [in] str Line
+ * \param [out] t Timing
+ * \return true if the line has an entry
+ *
+ */
+static bool TIMING_Parse(char *str, tTiming *t)
+{
+  unsigned int baudrate, boot_ms, reply_us, reply_max_us, page_ms, unit, runs;
+
+  memset(t, 0, sizeof(tTiming));
+  if (sscanf(str, TIMING_LINE_FMT, t->target, t->device, &baudrate, &boot_ms, &reply_us, &reply_max_us, &page_ms, &unit,
+             &runs) != 9)
+    return false;
+  t->baudrate = baudrate;
+  t->boot_ms = (uint16_t)boot_ms;
+  t->reply_us = reply_us;
+  t->reply_max_us = reply_max_us;
+  t->page_ms = (uint8_t)page_ms;
+  t->unit = (uint16_t)unit;
+  t->runs = runs;
+
+  return true;
+}
+
+/** \brief Load timing learned for the target in earlier runs
+ *
+ * \param [out] t Timing, not known if the database has no entry for target, device and baudrate
+ * \param [in] parameters Session parameters (port, interface, bus ID, device, baudrate)
+ * \return Nothing
+ *
+ */
+void TIMING_Load(tTiming *t, tParam *parameters)
+{
+  char str[TIMING_LINE_LEN];
+  tTiming entry;
+  FILE *fp;
+
+  memset(t, 0, sizeof(tTiming));
+  snprintf(t->target, TIMING_TARGET_LEN, "%s-%s-%d", parameters->port,
+           IFACES_GetNameByNumber((uint8_t)parameters->iface), parameters->bus_id);
+  t->baudrate = parameters->baudrate;
+  if ((TIMING_File[0] == 0) || ((fp = fopen(TIMING_File, "rt")) == NULL))
+    return;
+  #ifdef __linux
+  /**< the database is rewritten in place by TIMING_Save(), the lock is released by fclose() */
+  flock(fileno(fp), LOCK_SH);
+  #endif
+  if ((fgets(str, sizeof(str), fp) == NULL) || (strncmp(str, TIMING_HEADER, strlen(TIMING_HEADER)) != 0))
+  {
+    fclose(fp);
+    LOG_Print(LOG_LEVEL_WARNING, "Timing database %s has wrong format, ignoring", TIMING_File);
+    return;
+  }
+  while (fgets(str, sizeof(str), fp) != NULL)
+  {
+    if ((TIMING_Parse(str, &entry) == false) || (strcmp(entry.target, t->target) != 0) ||
+        (entry.baudrate != t->baudrate))
+      continue;
+    if ((parameters->device[0] != 0) && (strcmp(entry.device, parameters->device) != 0))
+      continue;
+    memcpy(t, &entry, sizeof(tTiming));
+    t->known = true;
+    break;
+  }
+  fclose(fp);
+}
+
+/** \brief Keep learned timing only if it belongs to the detected device, start from the profile otherwise
+ *
+ * \param [in,out] t Timing
+ * \param [in] profile Profile in use
+ * \return Nothing
+ *
+ */
+void TIMING_Bind(tTiming *t, tProfile *profile)
+{
+  if ((t->known == true) && (strcmp(t->device, profile->name) != 0))
+  {
+    LOG_Print(LOG_LEVEL_INFO, "Learned timing belongs to %s, starting from the profile", t->device);
+    t->known = false;
+  }
+  if (t->known == false)
+  {
+    t->reply_us = 0;
+    t->reply_max_us = 0;
+    t->page_ms = profile->page_ms;
+    t->unit = 0;
+    t->runs = 0;
+  }
+  strncpy(t->device, profile->name, DEVICE_LEN);
+  t->device[DEVICE_LEN - 1] = 0;
+  /**< the profile value is the proven one, learning only shortens it */
+  if (t->page_ms > profile->page_ms)
+    t->page_ms = profile->page_ms;
+  if (t->known == true)
+    LOG_Print(LOG_LEVEL_INFO, "Learned timing: boot %u ms, reply %u us (%u us at most), page pause %u ms, "
+              "unit %u bytes (%u runs)", t->boot_ms, t->reply_us, t->reply_max_us, t->page_ms, t->unit, t->runs);
+}
+
+/** \brief Refine boot time with the last measurement
+ *
+ * \param [in,out] t Timing
+ * \param [in] ready_ms Time from power on to bootloader ready
+ * \return Nothing
+ *
+ */
+void TIMING_Boot(tTiming *t, uint32_t ready_ms)
+{
+  if (ready_ms > UINT16_MAX)
+    ready_ms = UINT16_MAX;
+  t->boot_ms = (t->boot_ms == 0) ? (uint16_t)ready_ms : (uint16_t)((t->boot_ms * 3UL + ready_ms) / 4);
+}
+
+/** \brief Refine reply time with the last write
+ *
+ * \param [in,out] t Timing
+ * \param [in] us Time from the end of transmission to the reply per page
+ * \return Nothing
+ *
+ */
+void TIMING_Reply(tTiming *t, uint32_t us)
+{
+  t->reply_us = (t->reply_us == 0) ? us : (uint32_t)((t->reply_us * 7ULL + us) / 8);
+  if (us > t->reply_max_us)
+    t->reply_max_us = us;
+}
+
+/** \brief Store timing in the database, the entry of the target, device and baudrate is replaced
+ *
+ * The entry is moved to the end, the least recently saved entries are dropped when the database is full.
+ *
+ * \param [in,out] t Timing, the run is counted
+ * \return true if succeed or no database is used
+ *
+ */
+bool TIMING_Save(tTiming *t)
+{
+  char str[TIMING_LINE_LEN];
+  tTiming *entries;
+  tTiming entry;
+  uint16_t cnt = 0;
+  uint16_t i;
+  FILE *fp;
+  int fd;
+  bool res;
+
+  if ((TIMING_File[0] == 0) || (t->device[0] == 0))
+    return true;
+  if ((entries = malloc(TIMING_MAX_ENTRIES * sizeof(tTiming))) == NULL)
+    return false;
+  fd = open(TIMING_File, O_RDWR | O_CREAT, 0644);
+  if ((fd < 0) || ((fp = fdopen(fd, "r+")) == NULL))
+  {
+    if (fd >= 0)
+      close(fd);
+    free(entries);
+    LOG_Print(LOG_LEVEL_WARNING, "Unable to update timing database: %s", TIMING_File);
+    return false;
+  }
+  #ifdef __linux
+  /**< several msprog processes may share the database, the lock is released by fclose() */
+  flock(fd, LOCK_EX);
+  #endif
+  if ((fgets(str, sizeof(str), fp) != NULL) && (strncmp(str, TIMING_HEADER, strlen(TIMING_HEADER)) == 0))
+  {
+    while (fgets(str, sizeof(str), fp) != NULL)
+    {
+      if ((TIMING_Parse(str, &entry) == false) ||
+          ((strcmp(entry.target, t->target) == 0) && (strcmp(entry.device, t->device) == 0) &&
+           (entry.baudrate == t->baudrate)))
+        continue;
+      if (cnt == TIMING_MAX_ENTRIES - 1)
+        memmove(&entries[0], &entries[1], --cnt * sizeof(tTiming));
+      memcpy(&entries[cnt++], &entry, sizeof(tTiming));
+    }
+  }
+  t->runs++;
+  memcpy(&entries[cnt++], t, sizeof(tTiming));
+  rewind(fp);
+  fprintf(fp, "%s\n", TIMING_HEADER);
+  for (i = 0; i < cnt; i++)
+    fprintf(fp, "%s %s %u %u %u %u %u %u %u\n", entries[i].target, entries[i].device, entries[i].baudrate,
+            entries[i].boot_ms, entries[i].reply_us, entries[i].reply_max_us, entries[i].page_ms, entries[i].unit,
+            entries[i].runs);
+  fflush(fp);
+  res = (ferror(fp) == 0) && (ftruncate(fd, ftell(fp)) == 0);
+  fclose(fp);
+  free(entries);
+
+  return res;
+}
@@ -0,0 +1,35 @@
+#ifndef TIMING_H
+#define TIMING_H
+
+#include "defines.h"
+#include "profile.h"
+
+#define TIMING_HEADER       "MSPROG-TIMING 2"
+#define TIMING_TARGET_LEN   (COMPORT_LEN + 16)
+#define TIMING_MAX_ENTRIES  (256)
+
+/**< measured characteristics of one target, kept between runs */
+typedef struct
+{
+  char      target[TIMING_TARGET_LEN];  /**< port, interface and bus ID */
+  char      device[DEVICE_LEN];
+  uint32_t  baudrate;
+  bool      known;          /**< learned in an earlier run */
+  bool      settled;        /**< page pause caused an error, it isn't shortened any more */
+  uint8_t   successes;
+  uint16_t  boot_ms;        /**< power on to bootloader ready, 0 if unknown */
+  uint32_t  reply_us;       /**< write reply time per page after the transmission, 0 if unknown */
+  uint32_t  reply_max_us;   /**< the slowest write reply per page seen */
+  uint8_t   page_ms;        /**< pause after programming */
+  uint16_t  unit;           /**< transfer unit, 0 if unknown */
+  uint32_t  runs;
+} tTiming;
+
+void TIMING_Setup(char *filename);
+void TIMING_Load(tTiming *t, tParam *parameters);
+void TIMING_Bind(tTiming *t, tProfile *profile);
+void TIMING_Boot(tTiming *t, uint32_t ready_ms);
+void TIMING_Reply(tTiming *t, uint32_t us);
+bool TIMING_Save(tTiming *t);
+
+#endif
@@ -0,0 +1,129 @@
+#ifdef __linux
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+#include "transport.h"
+
+/**< backends with prefixes, the local serial port is used for everything else */
+static const tTransport *TRANSPORT_List[] =
+{
+  #ifdef __linux
+  &TCP_Transport,
+  &PTY_Transport,
+  #endif
+  &REPLAY_Transport,
+  &COM_Transport,
+};
+
+/** \brief Find transport backend for the port name
+ *
+ * \param [in] port Port name, e.g. "COM3", "/dev/ttyUSB0" or "tcp://host:port"
+ * \param [out] address Port name without the backend prefix
+ * \return pointer to the transport backend
+ *
+ */
+const tTransport *TRANSPORT_Find(char *port, char **address)
+{
+  uint8_t i;
+  size_t len;
+
+  for (i = 0; i < sizeof(TRANSPORT_List) / sizeof(TRANSPORT_List[0]); i++)
+  {
+    if (TRANSPORT_List[i]->prefix == NULL)
+      continue;
+    len = strlen(TRANSPORT_List[i]->prefix);
+    if (strncmp(port, TRANSPORT_List[i]->prefix, len) == 0)
+    {
+      *address = &port[len];
+      return TRANSPORT_List[i];
+    }
+  }
+  *address = port;
+
+  return &COM_Transport;
+}
+
+#ifdef __linux
+/** \brief Write all chunks to a stream descriptor with as few system calls as possible
+ *
+ * \param [in] link Opened link
+ * \param [in] chunks Parts of the frame
+ * \param [in] cnt Number of parts, up to TRANSPORT_MAX_CHUNKS
+ * \param [in] flags Flags for sendmsg() if the descriptor is a socket, -1 to use writev()
+ * \return 0 if everything Ok
+ *
+ */
+int TRANSPORT_WriteFd(tLink *link, const tChunk *chunks, uint8_t cnt, int flags)
+{
+  struct iovec iov[TRANSPORT_MAX_CHUNKS];
+  struct msghdr msg;
+  uint8_t first = 0;
+  uint8_t i;
+  ssize_t res;
+
+  if (cnt > TRANSPORT_MAX_CHUNKS)
+    return -1;
+  for (i = 0; i < cnt; i++)
+  {
+    iov[i].iov_base = (void*)chunks[i].data;
+    iov[i].iov_len = chunks[i].len;
+  }
+  while (first < cnt)
+  {
+    if (flags < 0)
+    {
+      res = writev(link->fd, &iov[first], cnt - first);
+    } else
+    {
+      memset(&msg, 0, sizeof(msg));
+      msg.msg_iov = &iov[first];
+      msg.msg_iovlen = cnt - first;
+      res = sendmsg(link->fd, &msg, flags);
+    }
+    if (res < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    /**< skip the parts already written, the rest is sent from the middle of the part */
+    while ((first < cnt) && ((size_t)res >= iov[first].iov_len))
+      res -= iov[first++].iov_len;
+    if (first < cnt)
+    {
+      iov[first].iov_base = (uint8_t*)iov[first].iov_base + res;
+      iov[first].iov_len -= res;
+    }
+  }
+
+  return 0;
+}
+
+/** \brief Read available data from a stream descriptor, waiting up to the link timeout
+ *
+ * \param [in] link Opened link
+ * \param [out] data Data buffer to read data in
+ * \param [in] len Size of data buffer
+ * \return number of received bytes, 0 on timeout or -1 on error
+ *
+ */
+int TRANSPORT_ReadFd(tLink *link, uint8_t *data, uint16_t len)
+{
+  struct pollfd pfd = {link->fd, POLLIN, 0};
+  ssize_t res;
+
+  if (poll(&pfd, 1, link->timeout) <= 0)
+    return 0;
+  res = read(link->fd, data, len);
+  if (res < 0)
+    return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+  /**< the descriptor was readable, no data means the peer has closed the connection */
+  if (res == 0)
+    return -1;
+
+  return (int)res;
+}
+#endif
@@ -0,0 +1,71 @@
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include "defines.h"
+#ifdef __MINGW32__
+#include <windows.h>
+#endif
+
+#define TRANSPORT_RX_LEN      (256)
+#define TRANSPORT_TIMEOUT_MS  (500)
+#define TRANSPORT_MAX_CHUNKS  (4)
+
+typedef struct tLink tLink;
+
+/**< one part of a frame, parts are transmitted back to back without copying */
+typedef struct
+{
+  const uint8_t *data;
+  uint16_t      len;
+} tChunk;
+
+/**< operations of one transport backend, selected by the prefix of the port name */
+typedef struct
+{
+  const char  *name;
+  const char  *prefix;
+  bool        (*open)(tLink *link, char *address, uint32_t baudrate);
+  int         (*write)(tLink *link, const tChunk *chunks, uint8_t cnt);
+  int         (*read)(tLink *link, uint8_t *data, uint16_t len);
+  void        (*set_timeout)(tLink *link, uint16_t ms);
+  void        (*flush)(tLink *link);
+  void        (*drain)(tLink *link);   /**< wait until sent, NULL if not known */
+  bool        (*tune)(tLink *link);    /**< lower reply latency, may be NULL */
+  void        (*close)(tLink *link);
+} tTransport;
+
+struct tLink
+{
+  const tTransport  *transport;
+  #ifdef __MINGW32__
+  HANDLE            handle;
+  #endif
+  int               fd;
+  int               peer_fd;
+  char              name[16];       /**< kernel name of the device */
+  bool              usb;            /**< USB serial adapter */
+  bool              low_latency;    /**< ASYNC_LOW_LATENCY was switched on by tune() */
+  uint16_t          latency_timer;  /**< latency timer before tune() in ms, 0 if not changed */
+  uint32_t          baudrate;
+  uint16_t          timeout;
+  uint16_t          default_timeout;
+  uint16_t          rx_pos;
+  uint16_t          rx_len;
+  uint8_t           rx[TRANSPORT_RX_LEN];
+  void              *priv;          /**< state of the backend */
+};
+
+extern const tTransport COM_Transport;
+extern const tTransport REPLAY_Transport;
+#ifdef __linux
+extern const tTransport TCP_Transport;
+extern const tTransport PTY_Transport;
+#endif
+
+const tTransport *TRANSPORT_Find(char *port, char **address);
+#ifdef __linux
+int TRANSPORT_WriteFd(tLink *link, const tChunk *chunks, uint8_t cnt, int flags);
+int TRANSPORT_ReadFd(tLink *link, uint8_t *data, uint16_t len);
+#endif
+
+#endif
@@ -0,0 +1,197 @@
+#ifdef __linux
+#include <errno.h>
+#include <fnmatch.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#include "log.h"
+#include "watch.h"
+
+#define WATCH_MASK    (IN_CREATE | IN_DELETE_SELF | IN_MOVE_SELF)
+
+/** \brief Watch the directory, or its nearest existing parent until the directory appears
+ *
+ * \param [in,out] w Watch
+ * \return true if succeed
+ *
+ */
+static bool WATCH_Arm(tWatch *w)
+{
+  char path[FILENAME_LEN];
+  char *sep;
+  bool ready = w->ready;
+  int wd;
+
+  strcpy(path, w->dir);
+  /**< directories like /dev/serial/by-id exist only while an adapter is plugged in */
+  while ((wd = inotify_add_watch(w->fd, path, WATCH_MASK)) < 0)
+  {
+    if ((errno != ENOENT) || ((sep = strrchr(path, '/')) == NULL) || (path[1] == 0))
+    {
+      LOG_Print(LOG_LEVEL_ERROR, "Unable to watch directory: %s", w->dir);
+      return false;
+    }
+    if (sep == path)
+      sep++;
+    *sep = 0;
+  }
+  if ((w->wd >= 0) && (w->wd != wd))
+    inotify_rm_watch(w->fd, w->wd);
+  w->wd = wd;
+  w->ready = (strcmp(path, w->dir) == 0);
+  if ((w->ready == false) && (ready == true))
+    LOG_Print(LOG_LEVEL_INFO, "Waiting for %s to appear", w->dir);
+  /**< the first nodes may be created together with the directory, before it was watched */
+  if ((w->ready == true) && (ready == false) && (w->scan == NULL))
+    w->scan = opendir(w->dir);
+
+  return true;
+}
+
+/** \brief Start watching a directory for new device nodes
+ *
+ * \param [in] w Watch
+ * \param [in] pattern Shell pattern of the nodes, e.g. /dev/ttyUSB* or /dev/serial/by-id/usb-FTDI*,
+ *                     nodes in /dev if no directory is given
+ * \return true if succeed
+ *
+ */
+bool WATCH_Open(tWatch *w, char *pattern)
+{
+  char *name = strrchr(pattern, '/');
+
+  memset(w, 0, sizeof(tWatch));
+  w->wd = -1;
+  if (name == NULL)
+  {
+    strncpy(w->dir, WATCH_DIR, FILENAME_LEN);
+    strncpy(w->pattern, pattern, FILENAME_LEN);
+  } else
+  {
+    snprintf(w->dir, FILENAME_LEN, "%.*s", (int)(name - pattern), pattern);
+    strncpy(w->pattern, name + 1, FILENAME_LEN);
+  }
+  w->pattern[FILENAME_LEN - 1] = 0;
+  if ((w->pattern[0] == 0) || (strlen(w->dir) + 2 > COMPORT_LEN))
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "Wrong device pattern: %s", pattern);
+    return false;
+  }
+  if ((w->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0)
+  {
+    LOG_Print(LOG_LEVEL_ERROR, "Unable to create inotify instance");
+    return false;
+  }
+  /**< nodes of unplugged adapters are removed, a new node is a new board, existing ones are not scanned */
+  w->ready = true;
+  if (WATCH_Arm(w) == false)
+  {
+    close(w->fd);
+    w->fd = -1;
+    return false;
+  }
+
+  return true;
+}
+
+/** \brief Get descriptor to wait for new nodes
+ *
+ * \param [in] w Watch
+ * \return descriptor
+ *
+ */
+int WATCH_GetFd(tWatch *w)
+{
+  return w->fd;
+}
+
+/** \brief Make the full name of a node if it matches the pattern
+ *
+ * \param [in] w Watch
+ * \param [in] name Node name in the directory
+ * \param [out] port Full name of the node (COMPORT_LEN bytes)
+ * \return true if the node matches
+ *
+ */
+static bool WATCH_Take(tWatch *w, char *name, char *port)
+{
+  if ((name[0] == '.') || (fnmatch(w->pattern, name, 0) != 0))
+    return false;
+  if (strlen(w->dir) + strlen(name) + 2 > COMPORT_LEN)
+  {
+    LOG_Print(LOG_LEVEL_WARNING, "Port name is too long: %s/%s", w->dir, name);
+    return false;
+  }
+  strcpy(port, w->dir);
+  strcat(port, "/");
+  strcat(port, name);
+
+  return true;
+}
+
+/** \brief Take the next new node matching the pattern, never blocks
+ *
+ * \param [in] w Watch
+ * \param [out] port Full name of the node (COMPORT_LEN bytes)
+ * \return true if a node was taken, false if there are no more events now
+ *
+ */
+bool WATCH_Next(tWatch *w, char *port)
+{
+  struct inotify_event *ev;
+  struct dirent *de;
+  ssize_t res;
+
+  while (1)
+  {
+    if (w->scan != NULL)
+    {
+      while ((de = readdir(w->scan)) != NULL)
+      {
+        if (WATCH_Take(w, de->d_name, port) == true)
+          return true;
+      }
+      closedir(w->scan);
+      w->scan = NULL;
+    }
+    if (w->pos >= w->len)
+    {
+      w->pos = 0;
+      w->len = 0;
+      if ((res = read(w->fd, w->buf, sizeof(w->buf))) <= 0)
+        return false;
+      w->len = (uint16_t)res;
+    }
+    ev = (struct inotify_event *)&w->buf[w->pos];
+    w->pos += sizeof(struct inotify_event) + ev->len;
+    if (ev->mask & IN_Q_OVERFLOW)
+      LOG_Print(LOG_LEVEL_WARNING, "Too many devices appeared at once, some of them are missed");
+    /**< events of a replaced watch are stale */
+    if (ev->wd != w->wd)
+      continue;
+    /**< a parent got a new entry or the directory is gone, the nearest existing one is watched */
+    if ((w->ready == false) || (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF)))
+    {
+      WATCH_Arm(w);
+      continue;
+    }
+    if ((ev->len > 0) && ((ev->mask & IN_ISDIR) == 0) && (WATCH_Take(w, ev->name, port) == true))
+      return true;
+  }
+}
+
+/** \brief Stop watching
+ *
+ * \param [in] w Watch
+ * \return Nothing
+ *
+ */
+void WATCH_Close(tWatch *w)
+{
+  if (w->scan != NULL)
+    closedir(w->scan);
+  w->scan = NULL;
+  if (w->fd >= 0)
+    close(w->fd);
+  w->fd = -1;
+}
+#endif
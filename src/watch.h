@@ -0,0 +1,32 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#include <dirent.h>
+#include "defines.h"
+
+#define WATCH_DIR           "/dev"
+#define WATCH_EVENTS_LEN    (4096)
+#define WATCH_SETTLE_MS     (500)   /**< udev sets owner and mode of a new node after it is created */
+
+/**< directory watched for new device nodes matching a pattern */
+typedef struct
+{
+  int       fd;
+  int       wd;             /**< watch of the directory or of its nearest existing parent */
+  bool      ready;          /**< the directory itself is watched */
+  DIR       *scan;          /**< nodes created before the directory was watched, NULL if none */
+  char      dir[FILENAME_LEN];
+  char      pattern[FILENAME_LEN];  /**< shell pattern of the node name */
+  uint8_t   buf[WATCH_EVENTS_LEN];
+  uint16_t  pos;
+  uint16_t  len;
+} tWatch;
+
+#ifdef __linux
+bool WATCH_Open(tWatch *w, char *pattern);
+int WATCH_GetFd(tWatch *w);
+bool WATCH_Next(tWatch *w, char *port);
+void WATCH_Close(tWatch *w);
+#endif
+
+#endif